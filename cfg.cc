@@ -0,0 +1,161 @@
+#include "cfg.hh"
+#include <cstdlib>
+#include <algorithm>
+
+ControlFlowGraph::ControlFlowGraph(const std::vector<Taco> & QA , unsigned int _from , unsigned int _to) :
+  from(_from) , to(_to) , blockIndex( _to > _from ? _to - _from - 1 : 0 , 0 ) {
+  std::vector<bool> leader( to - from + 1 , false );
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    const Taco & quad = QA[addr];
+    if( quad.isJump() ) {
+      unsigned int target = atoi( quad.z.c_str() );
+      if( from < target and target <= to ) {
+	targets.push_back( target );
+	leader[target - from] = true;
+      }
+    }
+    if( quad.isJump() or quad.opCode == OP_RETURN ) leader[addr + 1 - from] = true;
+  }
+  std::sort( targets.begin() , targets.end() );
+  targets.erase( std::unique( targets.begin() , targets.end() ) , targets.end() );
+
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    if( addr == from + 1 or leader[addr - from] ) blocks.emplace_back( addr , addr );
+    blocks.back().end = addr + 1;
+    blockIndex[addr - from - 1] = blocks.size() - 1;
+  }
+
+  for(unsigned int b = 0; b < blocks.size() ; b++ ) {
+    const Taco & quad = QA[ blocks[b].end - 1 ];
+    if( quad.isJump() ) {
+      unsigned int target = atoi( quad.z.c_str() );
+      if( from < target and target < to ) blocks[b].succ.push_back( blockOf( target ) );
+    }
+    if( quad.opCode != OP_GOTO and quad.opCode != OP_RETURN and b + 1 < blocks.size() ) {
+      if( blocks[b].succ.empty() or blocks[b].succ[0] != b + 1 ) blocks[b].succ.push_back( b + 1 );
+    }
+    for( unsigned int s : blocks[b].succ ) blocks[s].pred.push_back( b );
+  }
+
+  // Reverse postorder of a depth first search from the entry.
+  if( blocks.empty() ) return;
+  std::vector<bool> visited( blocks.size() , false );
+  std::vector< std::pair<unsigned int,unsigned int> > stack( 1 , std::make_pair( 0u , 0u ) );
+  visited[0] = true;
+  while( not stack.empty() ) {
+    unsigned int b = stack.back().first , & next = stack.back().second;
+    if( next < blocks[b].succ.size() ) {
+      unsigned int s = blocks[b].succ[next++];
+      if( not visited[s] ) {
+	visited[s] = true;
+	stack.emplace_back( s , 0 );
+      }
+    } else {
+      order.push_back( b );
+      stack.pop_back();
+    }
+  }
+  std::reverse( order.begin() , order.end() );
+}
+
+ControlFlowGraph::~ControlFlowGraph() { }
+
+unsigned int ControlFlowGraph::blockOf(unsigned int addr) const {
+  return blockIndex[addr - from - 1];
+}
+
+/*
+  Dominators after Cooper , Harvey and Kennedy's iterative algorithm
+  over the reverse postorder , and dominance frontiers from the join points.
+*/
+void ControlFlowGraph::computeDominators() {
+  if( order.empty() ) return;
+  std::vector<int> rank( blocks.size() , -1 );
+  for(unsigned int n = 0; n < order.size() ; n++ ) rank[ order[n] ] = n;
+
+  std::vector<int> idom( blocks.size() , -1 );
+  idom[0] = 0;
+  auto intersect = [&](int a , int b) {
+    while( a != b ) {
+      while( rank[a] > rank[b] ) a = idom[a];
+      while( rank[b] > rank[a] ) b = idom[b];
+    }
+    return a;
+  };
+  for( bool changed = true ; changed ; ) {
+    changed = false;
+    for(unsigned int n = 1; n < order.size() ; n++ ) {
+      unsigned int b = order[n];
+      int dom = -1;
+      for( unsigned int p : blocks[b].pred ) {
+	if( idom[p] < 0 ) continue; // not processed yet , or unreachable
+	dom = ( dom < 0 ? p : intersect( p , dom ) );
+      }
+      if( dom != idom[b] ) idom[b] = dom , changed = true;
+    }
+  }
+
+  for( unsigned int b : order ) {
+    blocks[b].children.clear() ; blocks[b].frontier.clear();
+  }
+  for( unsigned int b : order ) {
+    blocks[b].idom = ( b == 0 ? -1 : idom[b] );
+    if( b != 0 ) blocks[ idom[b] ].children.push_back( b );
+  }
+  // The entry is also entered from outside , when the function is called.
+  for( unsigned int b : order ) {
+    if( blocks[b].pred.size() + ( b == 0 ) < 2 ) continue;
+    for( unsigned int p : blocks[b].pred ) {
+      if( rank[p] < 0 ) continue;
+      for( int runner = p ; runner != blocks[b].idom ; runner = blocks[runner].idom ) {
+	std::vector<unsigned int> & frontier = blocks[runner].frontier;
+	if( std::find( frontier.begin() , frontier.end() , b ) == frontier.end() ) frontier.push_back( b );
+      }
+    }
+  }
+}
+
+bool ControlFlowGraph::dominates(unsigned int a , unsigned int b) const {
+  for( int runner = b ; runner >= 0 ; runner = blocks[runner].idom )
+    if( runner == (int) a ) return true;
+  return false;
+}
+
+std::vector<NaturalLoop> ControlFlowGraph::findLoops() const {
+  std::vector<NaturalLoop> loops;
+  for( unsigned int h : order ) {
+    NaturalLoop loop;
+    loop.header = h;
+    for( unsigned int p : blocks[h].pred )
+      if( dominates( h , p ) ) loop.latches.push_back( p );
+    if( loop.latches.empty() ) continue;
+
+    std::vector<bool> inLoop( blocks.size() , false );
+    std::vector<unsigned int> pending = loop.latches;
+    inLoop[h] = true;
+    for( unsigned int l : loop.latches ) inLoop[l] = true;
+    while( not pending.empty() ) {
+      unsigned int b = pending.back();
+      pending.pop_back();
+      if( b == h ) continue;
+      for( unsigned int p : blocks[b].pred )
+	if( not inLoop[p] and dominates( h , p ) ) inLoop[p] = true , pending.push_back( p );
+    }
+    for(unsigned int b = 0; b < blocks.size() ; b++ )
+      if( inLoop[b] ) loop.blocks.push_back( b );
+
+    loop.preheader = -1;
+    unsigned int entries = 0;
+    for( unsigned int p : blocks[h].pred ) {
+      if( inLoop[p] ) continue;
+      entries++;
+      if( blocks[p].succ.size() == 1 ) loop.preheader = p;
+    }
+    if( entries != 1 or h == 0 ) loop.preheader = -1;
+    loops.push_back( loop );
+  }
+  std::stable_sort( loops.begin() , loops.end() , [](const NaturalLoop & a , const NaturalLoop & b) {
+      return a.blocks.size() < b.blocks.size();
+    } );
+  return loops;
+}
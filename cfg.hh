@@ -0,0 +1,69 @@
+#ifndef MM_CFG_H
+#define MM_CFG_H
+
+#include <vector>
+#include "quads.hh"
+
+/* A run of quads [start,end) entered only at start and left only at end - 1. */
+class BasicBlock {
+public:
+  unsigned int start , end;
+  std::vector<unsigned int> succ , pred;
+
+  /* Immediate dominator ( -1 for the entry and for unreachable blocks ) ,
+     children in the dominator tree and dominance frontier. */
+  int idom;
+  std::vector<unsigned int> children , frontier;
+
+  BasicBlock(unsigned int _start,unsigned int _end) :
+    start(_start) , end(_end) , idom(-1) { }
+};
+
+/* Natural loop : the blocks reaching one of the latches without going
+   through the header , sorted. The preheader is the only block entering
+   the loop from outside , if it has no other successor , or -1. */
+class NaturalLoop {
+public:
+  unsigned int header;
+  std::vector<unsigned int> blocks , latches;
+  int preheader;
+};
+
+/**
+   Control flow graph of the function whose quads lie in [from,to].
+   Blocks start at jump targets and after jumps and returns. Block 0 is
+   the entry. Jumps to the end of the function and returns leave the graph.
+*/
+class ControlFlowGraph {
+public:
+
+  ControlFlowGraph(const std::vector<Taco> &,unsigned int,unsigned int);
+  virtual ~ControlFlowGraph();
+
+  unsigned int from , to;
+  std::vector<BasicBlock> blocks;
+
+  /* Addresses jumped to , in increasing order. */
+  std::vector<unsigned int> targets;
+
+  /* Blocks reachable from the entry , in reverse postorder. */
+  std::vector<unsigned int> order;
+
+  /* Block holding a quad. */
+  unsigned int blockOf(unsigned int) const;
+
+  /* Fill in dominator tree and dominance frontiers of reachable blocks. */
+  void computeDominators();
+
+  /* Wether a block dominates another. Needs the dominator tree. */
+  bool dominates(unsigned int,unsigned int) const;
+
+  /* Loops closed by a back edge to a dominating header , loops sharing
+     their header being merged. Inner loops come first. Needs the dominator tree. */
+  std::vector<NaturalLoop> findLoops() const;
+
+private:
+  std::vector<unsigned int> blockIndex; // addr - from - 1 -> block
+};
+
+#endif /* ! MM_CFG_H */
@@ -0,0 +1,221 @@
+#include "fusion.hh"
+#include <set>
+#include <algorithm>
+#include <functional>
+
+mm_fusion::mm_fusion(mm_translator & translator) :
+  mic(translator) , absorbed(translator.quadArray.size(),false) { }
+
+mm_fusion::~mm_fusion() { }
+
+bool mm_fusion::isMatrix(const std::string & id) {
+  if( id.empty() ) return false;
+  try {
+    return mic.getSymbol( mic.lookup(id) ).type.isMatrix();
+  } catch( int ) {
+    return false; // constants , labels
+  }
+}
+
+bool mm_fusion::isTemporary(const std::string & id) {
+  try {
+    return mic.isTemporary( mic.lookup(id) );
+  } catch( int ) {
+    return false;
+  }
+}
+
+bool mm_fusion::isElementwise(const Taco & quad) {
+  if( not isMatrix(quad.z) or not isTemporary(quad.z) or not isMatrix(quad.x) )
+    return false;
+  switch( quad.opCode ) {
+  case OP_PLUS : case OP_MINUS : return isMatrix(quad.y);
+  case OP_MULT : case OP_DIV : return not quad.y.empty() and not isMatrix(quad.y);
+  case OP_UMINUS : return true;
+  default : return false;
+  }
+}
+
+bool mm_fusion::isHeaderWrite(const Taco & quad) {
+  return quad.opCode == OP_LXC and ( quad.x == "0" or quad.x == "4" or quad.x == std::to_string( MATRIX_LD ) )
+    and isMatrix(quad.z) and isTemporary(quad.z);
+}
+
+void mm_fusion::fuseElementwiseChains() {
+  std::vector<Taco> & QA = mic.quadArray;
+  absorbed.assign(QA.size(),false);
+  for(unsigned int addr = 0; addr < QA.size() ; ) {
+    if( QA[addr].opCode == OP_FUNC_START ) {
+      unsigned int nxtAddr = addr;
+      for( ; nxtAddr < QA.size() and QA[nxtAddr].opCode != OP_FUNC_END ; nxtAddr++ ) ;
+      fuseFunction(addr , nxtAddr);
+      addr = nxtAddr + 1;
+    } else {
+      addr++;
+    }
+  }
+}
+
+/*
+  Splits the function body in regions of consecutive element-wise quads ,
+  shape copying allocations and header writes of static temporaries. A region never extends over a jump target ,
+  so it lies inside a single basic block.
+*/
+void mm_fusion::fuseFunction(unsigned int from , unsigned int to) {
+  std::vector<Taco> & QA = mic.quadArray;
+  std::vector<bool> isTarget( to - from + 1 , false );
+  for(unsigned int index = from + 1; index < to ; index++ ) {
+    if( QA[index].isJump() ) {
+      unsigned int target = atoi( QA[index].z.c_str() );
+      if( from <= target and target <= to ) isTarget[target - from] = true;
+    }
+  }
+
+  auto inRegion = [&](const Taco & quad) {
+    if( quad.opCode == OP_ALLOC ) return quad.y.empty() and isMatrix(quad.x);
+    return isHeaderWrite(quad) or isElementwise(quad);
+  };
+
+  for(unsigned int index = from + 1; index < to ; ) {
+    if( not inRegion( QA[index] ) ) { index++ ; continue; }
+    unsigned int start = index++;
+    while( index < to and not isTarget[index - from] and inRegion( QA[index] ) ) index++;
+    fuseRegion( from , to , start , index );
+  }
+}
+
+/*
+  Groups the element-wise quads of region [start,end) by the matrices they
+  touch , and turns every group that computes a single live value into a
+  fused loop. Groups share no matrix , so each can be evaluated at the
+  address of its last quad.
+*/
+void mm_fusion::fuseRegion(unsigned int from , unsigned int to , unsigned int start , unsigned int end) {
+  std::vector<Taco> & QA = mic.quadArray;
+
+  std::vector<unsigned int> steps , parent;
+  std::map<std::string,unsigned int> owner; // matrix -> first step touching it
+  std::function<unsigned int(unsigned int)> find = [&](unsigned int i) {
+    return parent[i] == i ? i : parent[i] = find(parent[i]);
+  };
+  for(unsigned int index = start; index < end ; index++ ) {
+    const Taco & quad = QA[index];
+    if( quad.opCode == OP_ALLOC or isHeaderWrite(quad) ) continue;
+    unsigned int step = steps.size();
+    steps.push_back(index);
+    parent.push_back(step);
+    for( const std::string * id : { &quad.z , &quad.x , &quad.y } ) {
+      if( not isMatrix(*id) ) continue;
+      auto it = owner.find(*id);
+      if( it == owner.end() ) owner[*id] = step;
+      else parent[ find(step) ] = find(it->second);
+    }
+  }
+
+  std::map< unsigned int , std::vector<unsigned int> > groups;
+  for(unsigned int step = 0; step < steps.size() ; step++ )
+    groups[ find(step) ].push_back( steps[step] );
+
+  for( auto & group : groups ) {
+    std::vector<unsigned int> & members = group.second;
+    if( members.size() < 2 ) continue;
+    unsigned int first = members.front() , last = members.back();
+    const std::string & z = QA[last].z;
+
+    std::set<std::string> touched , intermediates;
+    for( unsigned int index : members ) {
+      const Taco & quad = QA[index];
+      for( const std::string * id : { &quad.z , &quad.x , &quad.y } )
+	if( isMatrix(*id) ) touched.insert(*id);
+      if( quad.z != z ) intermediates.insert(quad.z);
+    }
+
+    /* Intermediate results live in registers only : they may be otherwise
+       referred to solely by their own allocation or header writes ( inside
+       the region ) and deallocation , all of which disappear. */
+    bool fusible = true;
+    std::vector<unsigned int> dropped;
+    for(unsigned int index = from + 1; fusible and index < to ; index++ ) {
+      if( std::binary_search( members.begin() , members.end() , index ) ) continue;
+      const Taco & quad = QA[index];
+      for( const std::string * id : { &quad.z , &quad.x , &quad.y } ) {
+	if( intermediates.count(*id) ) {
+	  if( quad.opCode == OP_DEALLOC or
+	      ( ( ( quad.opCode == OP_ALLOC and id == &quad.z ) or isHeaderWrite(quad) )
+		and start <= index and index < end ) )
+	    dropped.push_back(index);
+	  else
+	    fusible = false;
+	  break;
+	}
+	/* Anything else touching the group's matrices must stay out of its span. */
+	if( first < index and index < last and touched.count(*id) and not isHeaderWrite(quad) ) {
+	  fusible = false;
+	  break;
+	}
+      }
+    }
+    if( not fusible ) continue;
+
+    FusedLoop loop;
+    loop.z = z;
+    std::map<std::string,unsigned int> value; // matrix -> step holding its current value
+    auto operand = [&](const std::string & id) -> std::string {
+      if( id.empty() ) return id;
+      auto it = value.find(id);
+      if( it != value.end() ) return "%" + std::to_string(it->second);
+      std::vector<std::string> & list = isMatrix(id) ? loop.matrices : loop.scalars;
+      if( std::find( list.begin() , list.end() , id ) == list.end() ) list.push_back(id);
+      return id;
+    };
+    for( unsigned int index : members ) {
+      const Taco & quad = QA[index];
+      std::string x = operand(quad.x) , y = operand(quad.y);
+      loop.steps.emplace_back( quad.opCode , x , y );
+      value[quad.z] = loop.steps.size() - 1;
+    }
+
+    if( loop.matrices.size() > MAX_MATRICES or loop.scalars.size() > MAX_SCALARS ) continue;
+    for( const std::string & id : loop.matrices )
+      if( intermediates.count(id) ) fusible = false; // read before being computed
+    if( not fusible or not assignSlots(loop) ) continue;
+
+    for( unsigned int index : members ) absorbed[index] = true;
+    for( unsigned int index : dropped ) absorbed[index] = true;
+    absorbed[last] = false; // replaced by the fused loop
+    loops[last] = loop;
+  }
+}
+
+/*
+  Gives every step a value slot , reusing slots of values past their last use.
+  The slot of the first operand is released before the result is placed , so
+  a step may overwrite it , while the second operand stays intact.
+  Returns false if more than MAX_SLOTS values would be live at once.
+*/
+bool mm_fusion::assignSlots(FusedLoop & loop) {
+  std::vector<unsigned int> lastUse( loop.steps.size() , 0 );
+  for(unsigned int n = 0; n < loop.steps.size() ; n++ ) {
+    for( const std::string * id : { &loop.steps[n].x , &loop.steps[n].y } )
+      if( not id->empty() and (*id)[0] == '%' ) lastUse[ atoi( id->c_str() + 1 ) ] = n;
+  }
+  lastUse.back() = loop.steps.size(); // stored at the end
+
+  std::vector<bool> busy( MAX_SLOTS , false );
+  auto release = [&](const std::string & id , unsigned int n) {
+    if( id.empty() or id[0] != '%' ) return;
+    unsigned int step = atoi( id.c_str() + 1 );
+    if( lastUse[step] == n ) busy[ loop.steps[step].slot ] = false;
+  };
+  for(unsigned int n = 0; n < loop.steps.size() ; n++ ) {
+    FusedStep & step = loop.steps[n];
+    release( step.x , n );
+    unsigned int slot = 0;
+    while( slot < MAX_SLOTS and busy[slot] ) slot++;
+    if( slot == MAX_SLOTS ) return false;
+    busy[slot] = true;
+    step.slot = slot;
+    if( step.y != step.x ) release( step.y , n );
+  }
+  return true;
+}
@@ -0,0 +1,76 @@
+#ifndef MM_FUSION_H
+#define MM_FUSION_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include "translator.hh"
+
+/* One element-wise operation of a fused loop.
+   Operands are symbol ids , or "%n" for the result of step n of the same loop.
+   The result is held in value slot `slot' until its last use. */
+class FusedStep {
+public:
+  OpCode opCode;
+  std::string x , y;
+  unsigned int slot;
+
+  FusedStep(const OpCode &code,const std::string &_x,const std::string &_y="") :
+    opCode(code),x(_x),y(_y),slot(0) { }
+};
+
+/* A chain of element-wise matrix quads evaluated in a single pass.
+   Every element of every matrix operand is read once and the result
+   of the last step is written to z once. */
+class FusedLoop {
+public:
+  std::string z;                      // destination matrix
+  std::vector<std::string> matrices;  // distinct matrix operands read from memory
+  std::vector<std::string> scalars;   // distinct scalar operands
+  std::vector<FusedStep> steps;
+};
+
+/**
+   Loop fusion over the quad array. Finds chains of element-wise matrix quads
+   (+ , - , unary - , scaling) inside a basic block whose intermediate results
+   are temporaries used nowhere else , and replaces each chain by a FusedLoop.
+   Quad addresses are left untouched : absorbed quads are only flagged , and
+   the fused loop takes the place of the last quad of its chain.
+*/
+class mm_fusion {
+public:
+
+  mm_fusion(mm_translator &);
+  virtual ~mm_fusion();
+
+  /* Reference to machine independant code and data. */
+  mm_translator & mic;
+
+  /* Fused loops , keyed by the address of the last quad of their chain. */
+  std::map< unsigned int , FusedLoop > loops;
+
+  /* Flags quads absorbed into some fused loop. */
+  std::vector< bool > absorbed;
+
+  /* Fuse chains in every function of the quad array. */
+  void fuseElementwiseChains();
+
+  /* Limits imposed by the registers available to a fused loop. */
+  static const unsigned int MAX_MATRICES = 6 , MAX_SCALARS = 6 , MAX_SLOTS = 8;
+
+private:
+  void fuseFunction(unsigned int,unsigned int);
+  void fuseRegion(unsigned int,unsigned int,unsigned int,unsigned int);
+  bool assignSlots(FusedLoop &);
+
+  // returns wether quad is an element-wise matrix operation
+  bool isElementwise(const Taco &);
+  // returns wether quad writes the header of a static matrix temporary
+  bool isHeaderWrite(const Taco &);
+  // returns wether id names a matrix symbol
+  bool isMatrix(const std::string &);
+  // returns wether id names a compiler generated temporary
+  bool isTemporary(const std::string &);
+};
+
+#endif /* ! MM_FUSION_H */
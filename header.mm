@@ -20,4 +20,11 @@ int readInt(int *addr);
 
 int readDouble(double *addr);
 
+/* matrix files hold a matrix as laid out in memory. loadMat
+   maps the file , aborting if it is not a matrix file , and
+   saveMat exits with zero status code iff writing was successful */
+Matrix loadMat(char *file);
+
+int saveMat(Matrix m, char *file);
+
 /*******************************/
@@ -1,6 +1,15 @@
 /* C implementation of the miniMatlab standard library */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+#include <immintrin.h>
 
 int printStr(char *string)
 { return printf("%s",string); }
@@ -23,39 +32,1245 @@ int rows(void *ptr)
 int cols(void *ptr)
 { return ((int*)ptr)[1]; }
 
+/* A matrix is a header of MM_HEADER bytes , holding its rows , columns ,
+   leading dimension and the address of its first element at MM_DATA. Row i
+   starts i * leading dimension elements after the first. The elements of a
+   matrix follow its header , but for a slice , which views those of another. */
+#define MM_HEADER 64
+#define MM_DATA 16
+
+static long mmLd(void *ptr)
+{ return ((int*)ptr)[2]; }
+
+static double *mmData(void *ptr)
+{ return *(double**)((char*)ptr + MM_DATA); }
+
 int printMat(void *ptr) {
   int ret = 0 , r = rows(ptr) , c = cols(ptr) , i , j;
-  double *mat = (double*)ptr; ++mat;
+  double *mat = mmData(ptr);
+  long ld = mmLd(ptr);
   for( i = 0 ; i < r ; ++i ) {
-    for( j = 0 ;  j < c ; ++j , ++mat )
-      ret += printf("%10.4lf ",*mat);
+    for( j = 0 ;  j < c ; ++j )
+      ret += printf("%10.4lf ",mat[i*ld + j]);
     ret += printf("\n");
   }
   return ret;
 }
 
+/*
+  Matrix allocation.
+
+  Generated code takes matrix storage from mm_alloc and gives it back to
+  mm_free ( through mm_release , below ) , rather than calling calloc and
+  free for every temporary. Each
+  block is preceded by a header holding its capacity , padded so that the
+  storage handed out starts on a cache line. Blocks of up to
+  2^MM_SMALL_MAX bytes are rounded up to a power of two , and once freed are
+  kept on a free list per size class ; the lists belong to the freeing thread ,
+  so neither side takes a lock. Larger blocks go to a cache of the most
+  recently freed ones , shared by all threads , which hands a block out again
+  to any request it fits without wasting more than half of it. A recycled
+  block is cleared before it is returned , as calloc would , except by
+  mm_resize , which serves temporaries that are written in full right away.
+*/
+
+#define MM_SMALL_MIN 6   /* log2 of the smallest size class , in bytes */
+#define MM_SMALL_MAX 20  /* log2 of the largest size class */
+#define MM_POOL_DEPTH 32 /* free blocks kept per size class and thread */
+#define MM_BIG_CACHE 8   /* large blocks kept across threads */
+
+typedef struct mmBlock {
+  size_t bytes ;         /* capacity , header excluded */
+  struct mmBlock *next ; /* next free block of the same class */
+  size_t mapped ;        /* bytes mapped for a block loaded from a file ( see loadMat ) , else 0 */
+} __attribute__((aligned(64))) mmBlock ;
+
+static __thread struct {
+  mmBlock *head ;
+  int count ;
+} mmFreeList[MM_SMALL_MAX+1] ;
+
+static struct {
+  pthread_mutex_t lock ;
+  mmBlock *blocks[MM_BIG_CACHE] ;
+  unsigned long used[MM_BIG_CACHE] , clock ; /* time each block was freed */
+} mmBigCache = { PTHREAD_MUTEX_INITIALIZER } ;
+
+static size_t mmPageSize(void)
+{ return (size_t)sysconf(_SC_PAGESIZE); }
+
+/* Size class of a small block : log2 of its capacity. */
+static int mmSizeClass(size_t bytes) {
+  int c = MM_SMALL_MIN ;
+  while( ( (size_t)1 << c ) < bytes ) c++;
+  return c;
+}
+
+static mmBlock *mmNewBlock(size_t bytes) {
+  mmBlock *block ;
+  if( posix_memalign((void**)&block,sizeof(mmBlock),sizeof(mmBlock) + bytes) ) abort();
+  memset(block,0,sizeof(mmBlock) + bytes);
+  block->bytes = bytes;
+  return block;
+}
+
+/* A block of at least bytes , recycled if possible. A recycled block is
+   cleared if asked to , a new one always is. */
+static mmBlock *mmGetBlock(size_t bytes,int clear) {
+  mmBlock *block = NULL ;
+  int c , i , best = -1 ;
+
+  if( bytes <= (size_t)1 << MM_SMALL_MAX ) {
+    c = mmSizeClass(bytes);
+    if( ( block = mmFreeList[c].head ) == NULL )
+      return mmNewBlock((size_t)1 << c);
+    mmFreeList[c].head = block->next;
+    mmFreeList[c].count--;
+  } else {
+    pthread_mutex_lock(&mmBigCache.lock);
+    for( i = 0 ; i < MM_BIG_CACHE ; i++ ) {
+      mmBlock *cached = mmBigCache.blocks[i] ;
+      if( cached != NULL && cached->bytes >= bytes && cached->bytes / 2 <= bytes
+	  && ( best < 0 || cached->bytes < mmBigCache.blocks[best]->bytes ) )
+	best = i;
+    }
+    if( best >= 0 ) {
+      block = mmBigCache.blocks[best];
+      mmBigCache.blocks[best] = NULL;
+    }
+    pthread_mutex_unlock(&mmBigCache.lock);
+    if( block == NULL )
+      return mmNewBlock(bytes);
+  }
+  if( clear ) memset(block + 1,0,bytes);
+  return block;
+}
+
+/* Zeroed storage for count elements of size bytes each , like calloc. */
+void *mm_alloc(size_t count,size_t size) {
+  return mmGetBlock(count * size,1) + 1;
+}
+
+void mm_free(void *ptr) {
+  mmBlock *block , *evicted ;
+  int c , i , slot = 0 ;
+
+  if( ptr == NULL ) return;
+  block = (mmBlock*)ptr - 1;
+  if( block->mapped ) {
+    munmap((char*)ptr - mmPageSize(),block->mapped);
+    return;
+  }
+
+  if( block->bytes <= (size_t)1 << MM_SMALL_MAX ) {
+    c = mmSizeClass(block->bytes);
+    if( mmFreeList[c].count == MM_POOL_DEPTH ) {
+      free(block);
+      return;
+    }
+    block->next = mmFreeList[c].head;
+    mmFreeList[c].head = block;
+    mmFreeList[c].count++;
+    return;
+  }
+
+  // Take an empty slot , or else evict the block freed longest ago.
+  pthread_mutex_lock(&mmBigCache.lock);
+  for( i = 0 ; i < MM_BIG_CACHE ; i++ ) {
+    if( mmBigCache.blocks[i] == NULL ) { slot = i; break; }
+    if( mmBigCache.used[i] < mmBigCache.used[slot] ) slot = i;
+  }
+  evicted = mmBigCache.blocks[slot];
+  mmBigCache.blocks[slot] = block;
+  mmBigCache.used[slot] = ++mmBigCache.clock;
+  pthread_mutex_unlock(&mmBigCache.lock);
+  free(evicted);
+}
+
+/*
+  Shared elements.
+
+  Assigning a dynamic matrix to another , or returning one , lets both use
+  the same elements instead of copying them. The header at MM_STORE is that
+  of the block holding the elements a matrix uses , its own or another's , and
+  each block counts at MM_REFS the matrices using it , itself included for as
+  long as it is alive. A temporary assigned or returned hands its use over
+  instead , by mm_move and mm_take. Elements are copied when first written
+  while their count is above 1 , by mm_unshare. A count of 0 marks elements
+  that are never shared : those of static matrices , of temporaries in the
+  frame and of slices. Counts change atomically , as the bodies of a parallel loop may
+  share the matrices of their function.
+*/
+
+#define MM_STORE 24
+#define MM_REFS 32
+
+static char *mmStore(void *ptr)
+{ return *(char**)((char*)ptr + MM_STORE); }
+
+static int *mmRefs(void *ptr)
+{ return (int*)((char*)ptr + MM_REFS); }
+
+/* Points the header at ptr to elements held by store , row after row. */
+static void mmSetStore(void *ptr,void *store) {
+  ((int*)ptr)[2] = cols(ptr);
+  *(double**)((char*)ptr + MM_DATA) = (double*)((char*)store + MM_HEADER);
+  *(void**)((char*)ptr + MM_STORE) = store;
+}
+
+/* Drops a use of the elements of the block at ptr , freeing it after the last. */
+static void mmDrop(void *ptr) {
+  int *refs = mmRefs(ptr);
+  if( *refs == 0 || __atomic_sub_fetch(refs,1,__ATOMIC_ACQ_REL) == 0 )
+    mm_free(ptr);
+}
+
+/* Gives back the storage of a dynamic matrix. */
+void mm_release(void *ptr) {
+  if( ptr == NULL ) return;
+  if( mmStore(ptr) != (char*)ptr ) mmDrop(mmStore(ptr));
+  mmDrop(ptr);
+}
+
+/* Storage for a matrix temporary , whose contents are about to be overwritten.
+   The block at ptr ( if any ) is kept when large enough and not in use by
+   other matrices , and swapped for a new one otherwise , so a temporary
+   reallocated on every iteration of a loop stays in place. */
+void *mm_resize(void *ptr,size_t count,size_t size) {
+  if( ptr != NULL ) {
+    if( mmStore(ptr) != (char*)ptr ) mmDrop(mmStore(ptr));
+    if( *mmRefs(ptr) > 1 ) mmDrop(ptr);
+    else if( ( (mmBlock*)ptr - 1 )->bytes >= count * size ) return ptr;
+    else mm_free(ptr);
+  }
+  return mmGetBlock(count * size,0) + 1;
+}
+
+static void mmUnshare(void *mat,int keep);
+
+/* Rows [r0,r1) and columns [c0,c1) of mat , sharing its elements. The
+   header of view , the slice taken by the same expression the last time it
+   was evaluated , is rebuilt in place if there is one. Writes through a
+   slice do not unshare , so mat gets elements of its own first. */
+void *mm_slice(void *mat,int r0,int r1,int c0,int c1,void *view) {
+  void *ret = view;
+  if( r0 < 0 || r0 > r1 || r1 > rows(mat) || c0 < 0 || c0 > c1 || c1 > cols(mat) ) abort();
+  if( *mmRefs(mmStore(mat)) > 1 ) mmUnshare(mat,1);
+  if( ret == NULL ) ret = mmGetBlock(MM_HEADER,0) + 1;
+  ((int*)ret)[0] = r1 - r0 , ((int*)ret)[1] = c1 - c0 , ((int*)ret)[2] = ((int*)mat)[2];
+  *(double**)((char*)ret + MM_DATA) = mmData(mat) + r0 * mmLd(mat) + c0;
+  *(void**)((char*)ret + MM_STORE) = ret , *mmRefs(ret) = 0;
+  return ret;
+}
+
+/* dst = src , for matrices of the same dimensions. */
+void mm_copy(void *dst,void *src) {
+  int r = rows(src) , c = cols(src) , i;
+  long ldd = mmLd(dst) , lds = mmLd(src);
+  double *d = mmData(dst) , *s = mmData(src);
+  if( ldd == c && lds == c )
+    memmove(d,s,sizeof(double)*(size_t)r*c);
+  else
+    for( i = 0 ; i < r ; i++ )
+      memmove(d + i*ldd,s + i*lds,sizeof(double)*(size_t)c);
+}
+
+/* A copy of mat in storage of its own , with contiguous rows. */
+void *mm_clone(void *mat) {
+  int r = rows(mat) , c = cols(mat);
+  void *ret = mmGetBlock(MM_HEADER + sizeof(double)*(size_t)r*c,0) + 1;
+  ((int*)ret)[0] = r , ((int*)ret)[1] = c;
+  mmSetStore(ret,ret) , *mmRefs(ret) = 1;
+  mm_copy(ret,mat);
+  return ret;
+}
+
+/* A matrix with the elements of mat , for a function to return : it shares
+   them when they are counted , and has a copy otherwise. */
+void *mm_share(void *mat) {
+  char *store = mmStore(mat);
+  void *ret;
+  if( *mmRefs(store) == 0 ) return mm_clone(mat);
+  ret = mmGetBlock(MM_HEADER,0) + 1;
+  ((int*)ret)[0] = rows(mat) , ((int*)ret)[1] = cols(mat);
+  __atomic_add_fetch(mmRefs(store),1,__ATOMIC_RELAXED);
+  mmSetStore(ret,store) , *mmRefs(ret) = 1;
+  return ret;
+}
+
+/* Gives mat elements of its own if others use its current ones , copying
+   them over if keep is set. A header holding no elements of its own , or
+   whose own are used by others , moves to a new block. */
+static void mmUnshare(void *mat,int keep) {
+  char *store = mmStore(mat);
+  int r = rows(mat) , c = cols(mat) , i;
+  size_t bytes = MM_HEADER + sizeof(double)*(size_t)r*c;
+  long ld = mmLd(mat);
+  double *src = mmData(mat) , *dst;
+  void *own = mat;
+  if( *mmRefs(store) <= 1 ) return;
+  if( store == (char*)mat || *mmRefs(mat) > 1 || ( (mmBlock*)mat - 1 )->bytes < bytes ) {
+    own = mmGetBlock(bytes,0) + 1;
+    *mmRefs(own) = 1;
+  }
+  dst = (double*)((char*)own + MM_HEADER);
+  if( keep ) {
+    if( ld == c ) memcpy(dst,src,sizeof(double)*(size_t)r*c);
+    else for( i = 0 ; i < r ; i++ ) memcpy(dst + (size_t)i*c,src + i*ld,sizeof(double)*(size_t)c);
+  }
+  mmSetStore(mat,own);
+  if( store != (char*)mat ) mmDrop(store);
+}
+
+/* Before writing some elements of mat. */
+void mm_unshare(void *mat)
+{ mmUnshare(mat,1); }
+
+/* Before overwriting all elements of mat. */
+void mm_detach(void *mat)
+{ mmUnshare(mat,0); }
+
+/* mm_unshare for element stores in generated code : takes mat in %rdi like
+   it , but preserves every other register , vector registers included. */
+__asm__(
+  "\t.pushsection\t.text\n"
+  "\t.globl\tmm_unshare_regs\n"
+  "\t.type\tmm_unshare_regs, @function\n"
+  "mm_unshare_regs:\n"
+  "\tpushq\t%rbp\n\tmovq\t%rsp, %rbp\n"
+  "\tpushq\t%rax\n\tpushq\t%rcx\n\tpushq\t%rdx\n\tpushq\t%rsi\n\tpushq\t%rdi\n"
+  "\tpushq\t%r8\n\tpushq\t%r9\n\tpushq\t%r10\n\tpushq\t%r11\n"
+  "\tandq\t$-16, %rsp\n\tsubq\t$256, %rsp\n"
+  "\tmovdqu\t%xmm0, (%rsp)\n\tmovdqu\t%xmm1, 16(%rsp)\n\tmovdqu\t%xmm2, 32(%rsp)\n\tmovdqu\t%xmm3, 48(%rsp)\n"
+  "\tmovdqu\t%xmm4, 64(%rsp)\n\tmovdqu\t%xmm5, 80(%rsp)\n\tmovdqu\t%xmm6, 96(%rsp)\n\tmovdqu\t%xmm7, 112(%rsp)\n"
+  "\tmovdqu\t%xmm8, 128(%rsp)\n\tmovdqu\t%xmm9, 144(%rsp)\n\tmovdqu\t%xmm10, 160(%rsp)\n\tmovdqu\t%xmm11, 176(%rsp)\n"
+  "\tmovdqu\t%xmm12, 192(%rsp)\n\tmovdqu\t%xmm13, 208(%rsp)\n\tmovdqu\t%xmm14, 224(%rsp)\n\tmovdqu\t%xmm15, 240(%rsp)\n"
+  "\tcall\tmm_unshare\n"
+  "\tmovdqu\t(%rsp), %xmm0\n\tmovdqu\t16(%rsp), %xmm1\n\tmovdqu\t32(%rsp), %xmm2\n\tmovdqu\t48(%rsp), %xmm3\n"
+  "\tmovdqu\t64(%rsp), %xmm4\n\tmovdqu\t80(%rsp), %xmm5\n\tmovdqu\t96(%rsp), %xmm6\n\tmovdqu\t112(%rsp), %xmm7\n"
+  "\tmovdqu\t128(%rsp), %xmm8\n\tmovdqu\t144(%rsp), %xmm9\n\tmovdqu\t160(%rsp), %xmm10\n\tmovdqu\t176(%rsp), %xmm11\n"
+  "\tmovdqu\t192(%rsp), %xmm12\n\tmovdqu\t208(%rsp), %xmm13\n\tmovdqu\t224(%rsp), %xmm14\n\tmovdqu\t240(%rsp), %xmm15\n"
+  "\tleaq\t-72(%rbp), %rsp\n"
+  "\tpopq\t%r11\n\tpopq\t%r10\n\tpopq\t%r9\n\tpopq\t%r8\n"
+  "\tpopq\t%rdi\n\tpopq\t%rsi\n\tpopq\t%rdx\n\tpopq\t%rcx\n\tpopq\t%rax\n"
+  "\tpopq\t%rbp\n\tret\n"
+  "\t.size\tmm_unshare_regs, .-mm_unshare_regs\n"
+  "\t.popsection\n"
+);
+
+/* dst = src , for dynamic matrices of the same dimensions , dst getting a
+   copy of the elements of src in elements of its own. */
+void mm_assign_copy(void *dst,void *src) {
+  mm_detach(dst);
+  mm_copy(dst,src);
+}
+
+/* dst = src , for dynamic matrices of the same dimensions : dst shares the
+   elements of src when both are counted , and gets a copy of them otherwise. */
+void mm_assign(void *dst,void *src) {
+  char *store = mmStore(src);
+  if( dst == src ) return;
+  if( *mmRefs(store) == 0 || *mmRefs(mmStore(dst)) == 0 ) {
+    mm_assign_copy(dst,src);
+    return;
+  }
+  if( store != (char*)dst ) __atomic_add_fetch(mmRefs(store),1,__ATOMIC_RELAXED);
+  if( mmStore(dst) != (char*)dst ) mmDrop(mmStore(dst));
+  mmSetStore(dst,store);
+}
+
+/* mm_assign for a temporary src that dies with the assignment : dst takes
+   over the use src makes of its elements , and the header of src goes unless
+   it holds them. Returns what is left of src to deallocate , NULL once taken
+   over. Elements that are not counted are copied , leaving src as it was. */
+void *mm_move(void *dst,void *src) {
+  char *store = mmStore(src);
+  if( *mmRefs(store) == 0 || *mmRefs(mmStore(dst)) == 0 ) {
+    mm_assign(dst,src);
+    return src;
+  }
+  if( mmStore(dst) != (char*)dst ) mmDrop(mmStore(dst));
+  mmSetStore(dst,store);
+  if( store != (char*)src ) mmDrop(src);
+  if( store == (char*)dst ) mmDrop(dst); // counted already , as dst is alive
+  return NULL;
+}
+
+/* A dynamic matrix of the returning function , dying with it , for it to
+   return : mat itself when its elements are counted , and a copy otherwise. */
+void *mm_take(void *mat) {
+  if( *mmRefs(mmStore(mat)) == 0 ) return mm_clone(mat);
+  return mat;
+}
+
+/* Storage for a matrix temporary that has capacity bytes of scratch storage
+   at buf , in the frame of its function : the scratch storage when the matrix
+   fits , else a block as from mm_resize. */
+void *mm_scratch(void *ptr,size_t count,size_t size,void *buf,size_t capacity) {
+  if( count * size <= capacity ) {
+    if( ptr != buf ) mm_release(ptr);
+    return buf;
+  }
+  return mm_resize(ptr == buf ? NULL : ptr,count,size);
+}
+
+/*
+  Matrix files.
+
+  A matrix file holds a matrix as it is laid out in memory : a header of
+  MM_HEADER bytes , with the rows , columns and leading dimension ( equal to
+  the columns ) as ints and the rest zero , followed by the elements row by
+  row. loadMat maps the file privately instead of reading it , a page after
+  the start of an anonymous mapping whose first page ends with the mmBlock
+  of the matrix , so the file header becomes the matrix header , pages are
+  read in when first touched , and writes stay in memory. mm_free unmaps
+  the whole once the matrix is no longer used.
+*/
+
+/* The matrix in file , aborting if it cannot be read as one. */
+void *loadMat(char *file) {
+  size_t page = mmPageSize() , bytes;
+  struct stat st;
+  char *base , *mat;
+  mmBlock *block;
+  int fd = open(file,O_RDONLY) , r , c;
+  if( fd < 0 || fstat(fd,&st) || st.st_size < MM_HEADER
+      || pread(fd,&r,sizeof(int),0) != sizeof(int) || pread(fd,&c,sizeof(int),sizeof(int)) != sizeof(int)
+      || r < 0 || c < 0 || (size_t)st.st_size != MM_HEADER + sizeof(double)*(size_t)r*c )
+    abort();
+  bytes = st.st_size;
+  base = mmap(NULL,page + bytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+  if( base == MAP_FAILED ) abort();
+  mat = base + page;
+  if( mmap(mat,bytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_FIXED,fd,0) == MAP_FAILED ) abort();
+  close(fd);
+  block = (mmBlock*)mat - 1;
+  block->bytes = bytes , block->mapped = page + bytes;
+  mmSetStore(mat,mat) , *mmRefs(mat) = 1;
+  return mat;
+}
+
+/* Writes mat to file , returning zero iff it was written in full. */
+int saveMat(void *mat,char *file) {
+  char header[MM_HEADER] = { 0 };
+  int r = rows(mat) , c = cols(mat) , i , failed;
+  long ld = mmLd(mat);
+  double *data = mmData(mat);
+  FILE *out = fopen(file,"wb");
+  if( out == NULL ) return 1;
+  ((int*)header)[0] = r , ((int*)header)[1] = c , ((int*)header)[2] = c;
+  failed = fwrite(header,MM_HEADER,1,out) != 1;
+  if( ld == c ) {
+    if( !failed && r*c > 0 ) failed = fwrite(data,sizeof(double)*(size_t)r*c,1,out) != 1;
+  } else {
+    for( i = 0 ; i < r && !failed && c > 0 ; i++ )
+      failed = fwrite(data + i*ld,sizeof(double)*(size_t)c,1,out) != 1;
+  }
+  return fclose(out) != 0 || failed;
+}
+
+/*
+  Worker pool.
+
+  A fixed set of threads is started the first time any parallel kernel runs
+  and then sleeps between jobs. A job is a function applied to task indices
+  0 .. tasks-1 ; workers and the calling thread claim indices until all are
+  done. The pool size is read from MM_NUM_THREADS , defaulting to the number
+  of online processors. Jobs issued from inside a task , or while another job
+  is running , are executed serially by the caller. Idle workers also steal
+  spawned calls ( see below ).
+*/
+
+static struct {
+  int threads ; /* workers + the calling thread */
+  int busy ;
+  pthread_mutex_t lock ;
+  pthread_cond_t start , done ;
+  void (*task)(void*,int) ;
+  void *arg ;
+  int tasks , next , pending ;
+  unsigned long generation ;
+} mmPool = { 1 , 0 , PTHREAD_MUTEX_INITIALIZER , PTHREAD_COND_INITIALIZER , PTHREAD_COND_INITIALIZER } ;
+
+static pthread_once_t mmPoolOnce = PTHREAD_ONCE_INIT ;
+static __thread int mmInTask = 0 ;
+
+static atomic_long mmQueued ;  /* spawned calls waiting in deques */
+static atomic_int mmSleeping ; /* workers waiting for work */
+static void mmHelp(void);
+
+/* Chase-Lev deque of spawned calls. Its owner pushes and takes at the bottom ,
+   other threads steal from the top. */
+#define MM_DEQUE_SIZE 1024 /* power of two */
+
+typedef struct mmTask mmTask ;
+
+typedef struct {
+  atomic_long top , bottom ;
+  _Atomic(mmTask*) tasks[MM_DEQUE_SIZE] ;
+} mmDeque ;
+
+static mmDeque *mmDeques ; /* one per thread of the pool */
+
+/* Claim and run tasks of the current job. Called with the pool lock held. */
+static void mmPoolDrain(void) {
+  while( mmPool.next < mmPool.tasks ) {
+    int index = mmPool.next++ ;
+    pthread_mutex_unlock(&mmPool.lock);
+    mmInTask = 1;
+    mmPool.task(mmPool.arg,index);
+    mmInTask = 0;
+    pthread_mutex_lock(&mmPool.lock);
+    if( --mmPool.pending == 0 ) pthread_cond_broadcast(&mmPool.done);
+  }
+}
+
+static __thread int mmWorker = 0 ; /* index of the thread in the pool , 0 for the caller */
+
+static void *mmPoolWorker(void *index) {
+  unsigned long seen = 0 ;
+  mmWorker = (int)(long)index;
+  pthread_mutex_lock(&mmPool.lock);
+  for( ; ; ) {
+    if( mmPool.generation != seen ) {
+      seen = mmPool.generation;
+      mmPoolDrain();
+    } else if( atomic_load(&mmQueued) > 0 ) {
+      pthread_mutex_unlock(&mmPool.lock);
+      mmHelp();
+      pthread_mutex_lock(&mmPool.lock);
+    } else {
+      /* A spawn either sees this worker sleeping , or is seen queued. */
+      atomic_fetch_add(&mmSleeping,1);
+      if( atomic_load(&mmQueued) == 0 )
+	pthread_cond_wait(&mmPool.start,&mmPool.lock);
+      atomic_fetch_sub(&mmSleeping,1);
+    }
+  }
+  return NULL;
+}
+
+static void mmPoolInit(void) {
+  char *env = getenv("MM_NUM_THREADS");
+  long threads = env ? strtol(env,NULL,10) : sysconf(_SC_NPROCESSORS_ONLN);
+  pthread_t worker ;
+  int i;
+  if( threads < 1 ) threads = 1;
+  if( threads > 1024 ) threads = 1024;
+  mmDeques = (mmDeque*)calloc(threads,sizeof(mmDeque));
+  if( mmDeques == NULL ) threads = 1;
+  mmPool.threads = 1;
+  for( i = 1 ; i < threads ; i++ ) {
+    if( pthread_create(&worker,NULL,mmPoolWorker,(void*)(long)i) != 0 ) break;
+    pthread_detach(worker);
+    mmPool.threads++;
+  }
+}
+
+/* Number of threads parallel kernels may use. */
+static int mmThreads(void) {
+  pthread_once(&mmPoolOnce,mmPoolInit);
+  return mmPool.threads;
+}
+
+/* Run task(arg,0) ... task(arg,tasks-1) across the pool and wait for all of them. */
+static void mmParallel(void (*task)(void*,int),void *arg,int tasks) {
+  int index;
+  if( tasks > 1 && mmThreads() > 1 && !mmInTask ) {
+    pthread_mutex_lock(&mmPool.lock);
+    if( !mmPool.busy ) {
+      mmPool.busy = 1;
+      mmPool.task = task , mmPool.arg = arg;
+      mmPool.tasks = mmPool.pending = tasks , mmPool.next = 0;
+      mmPool.generation++;
+      pthread_cond_broadcast(&mmPool.start);
+      mmPoolDrain();
+      while( mmPool.pending > 0 )
+	pthread_cond_wait(&mmPool.done,&mmPool.lock);
+      mmPool.busy = 0;
+      pthread_mutex_unlock(&mmPool.lock);
+      return;
+    }
+    pthread_mutex_unlock(&mmPool.lock);
+  }
+  for( index = 0 ; index < tasks ; index++ )
+    task(arg,index);
+}
+
+/*
+  Parallel loops.
+
+  The compiler outlines the body of a parfor into a function running the
+  iterations [from,to) , which also gets the frame of the function holding
+  the loop. The index range is cut into chunks , several per thread so that
+  uneven iterations even out , and threads claim chunks as they finish the
+  previous ones.
+*/
+
+#define PARFOR_CHUNKS 8 /* chunks per thread */
+
+typedef struct {
+  void (*body)(void*,int,int) ;
+  void *frame ;
+  int lo , hi , chunk ;
+} parForJob ;
+
+/* Task : one chunk of iterations. */
+static void parForTask(void *arg,int index) {
+  parForJob *job = (parForJob*)arg;
+  long from = job->lo + (long)index * job->chunk , to = from + job->chunk ;
+  if( to > job->hi ) to = job->hi;
+  job->body(job->frame,(int)from,(int)to);
+}
+
+void parFor(void (*body)(void*,int,int),void *frame,int lo,int hi) {
+  long n = (long)hi - lo , chunk ;
+  parForJob job = { body , frame , lo , hi , 1 } ;
+  if( n <= 0 ) return;
+  chunk = n / ( (long)PARFOR_CHUNKS * mmThreads() );
+  if( chunk > 1 ) job.chunk = (int)chunk;
+  mmParallel(parForTask,&job,(int)( ( n + job.chunk - 1 ) / job.chunk ));
+}
+
+/*
+  Task parallelism.
+
+  spawn f(args) hands the call over to the scheduler and goes on , sync waits
+  for the calls spawned so far by the running task ( or outside any ). Calls
+  are pushed on the deque of the spawning thread. Workers with nothing else to
+  do , and threads waiting in sync , take the newest call of their own deque
+  or steal the oldest of another's. Spawned calls get their arguments back in
+  the registers they were passed in , so the callee need not be known here.
+*/
+
+typedef void (*mmTaskFunction)(long,long,long,long,long,long,
+			       double,double,double,double,double,double,double,double) ;
+
+struct mmTask {
+  mmTaskFunction function ;
+  long args[6] ;
+  double fargs[8] ;
+  void *views[6] ;      /* headers of the slices passed , released after the call */
+  int nViews ;
+  atomic_long *parent ; /* spawns pending in the spawning task */
+} ;
+
+static __thread atomic_long mmRootPending ;
+static __thread atomic_long *mmPending = NULL ; /* spawns pending in the running task */
+static __thread struct {
+  void *views[6] ;
+  int count ;
+} mmPinned ; /* slices passed to the next spawned call */
+
+/* Hands the header of a slice passed to the next spawned call over to it ,
+   as the expression that took the slice may rebuild it in the meantime. */
+void mm_pin(void *view) {
+  mmPinned.views[mmPinned.count++] = view;
+}
+
+static void mmCall(mmTask *task) {
+  task->function(task->args[0],task->args[1],task->args[2],task->args[3],task->args[4],task->args[5],
+		 task->fargs[0],task->fargs[1],task->fargs[2],task->fargs[3],
+		 task->fargs[4],task->fargs[5],task->fargs[6],task->fargs[7]);
+}
+
+/* Once the call and those it spawned are done. */
+static void mmFinish(mmTask *task) {
+  int i;
+  for( i = 0 ; i < task->nViews ; i++ ) mm_release(task->views[i]);
+  free(task);
+}
+
+/* Owner side : push returns 0 if the deque is full. */
+static int mmPush(mmDeque *deque,mmTask *task) {
+  long b = atomic_load_explicit(&deque->bottom,memory_order_relaxed);
+  long t = atomic_load_explicit(&deque->top,memory_order_acquire);
+  if( b - t >= MM_DEQUE_SIZE ) return 0;
+  atomic_store_explicit(&deque->tasks[b & (MM_DEQUE_SIZE-1)],task,memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&deque->bottom,b+1,memory_order_relaxed);
+  return 1;
+}
+
+static mmTask *mmTake(mmDeque *deque) {
+  long b = atomic_load_explicit(&deque->bottom,memory_order_relaxed) - 1 , t ;
+  mmTask *task = NULL ;
+  atomic_store_explicit(&deque->bottom,b,memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  t = atomic_load_explicit(&deque->top,memory_order_relaxed);
+  if( t <= b ) {
+    task = atomic_load_explicit(&deque->tasks[b & (MM_DEQUE_SIZE-1)],memory_order_relaxed);
+    if( t == b ) { /* last one : race thieves for it */
+      if( !atomic_compare_exchange_strong(&deque->top,&t,t+1) ) task = NULL;
+      atomic_store_explicit(&deque->bottom,b+1,memory_order_relaxed);
+    }
+  } else {
+    atomic_store_explicit(&deque->bottom,b+1,memory_order_relaxed);
+  }
+  return task;
+}
+
+/* Thief side : NULL if empty , or if another thread got there first. */
+static mmTask *mmSteal(mmDeque *deque) {
+  long t = atomic_load_explicit(&deque->top,memory_order_acquire) , b ;
+  mmTask *task ;
+  atomic_thread_fence(memory_order_seq_cst);
+  b = atomic_load_explicit(&deque->bottom,memory_order_acquire);
+  if( t >= b ) return NULL;
+  task = atomic_load_explicit(&deque->tasks[t & (MM_DEQUE_SIZE-1)],memory_order_relaxed);
+  if( !atomic_compare_exchange_strong(&deque->top,&t,t+1) ) return NULL;
+  return task;
+}
+
+static mmTask *mmFindTask(void) {
+  mmTask *task = mmTake(&mmDeques[mmWorker]);
+  int victim ;
+  for( victim = 1 ; task == NULL && victim < mmPool.threads ; victim++ )
+    task = mmSteal(&mmDeques[(mmWorker + victim) % mmPool.threads]);
+  if( task != NULL ) atomic_fetch_sub(&mmQueued,1);
+  return task;
+}
+
+int mmSync(void);
+
+/* Run a spawned call , and wait for the calls it spawned in turn. */
+static void mmRun(mmTask *task) {
+  atomic_long pending , *outer = mmPending ;
+  atomic_init(&pending,0);
+  mmPending = &pending;
+  mmCall(task);
+  mmSync();
+  mmPending = outer;
+  atomic_fetch_sub(task->parent,1);
+  mmFinish(task);
+}
+
+/* Run spawned calls until none is left waiting. */
+static void mmHelp(void) {
+  mmTask *task ;
+  while( atomic_load(&mmQueued) > 0 )
+    if( ( task = mmFindTask() ) != NULL ) mmRun(task);
+}
+
+void mmSpawn(long a0,long a1,long a2,long a3,long a4,long a5,
+	     double d0,double d1,double d2,double d3,double d4,double d5,double d6,double d7,
+	     mmTaskFunction function) {
+  mmTask *task = (mmTask*)malloc(sizeof(mmTask)) ;
+  if( task == NULL ) abort();
+  task->function = function;
+  task->args[0] = a0 , task->args[1] = a1 , task->args[2] = a2;
+  task->args[3] = a3 , task->args[4] = a4 , task->args[5] = a5;
+  task->fargs[0] = d0 , task->fargs[1] = d1 , task->fargs[2] = d2 , task->fargs[3] = d3;
+  task->fargs[4] = d4 , task->fargs[5] = d5 , task->fargs[6] = d6 , task->fargs[7] = d7;
+  task->parent = mmPending ? mmPending : &mmRootPending;
+  memcpy(task->views,mmPinned.views,sizeof(task->views));
+  task->nViews = mmPinned.count , mmPinned.count = 0;
+  if( mmThreads() == 1 ) {
+    mmCall(task); /* nobody to share it with */
+    mmFinish(task);
+    return;
+  }
+  atomic_fetch_add(task->parent,1);
+  atomic_fetch_add(&mmQueued,1);
+  if( !mmPush(&mmDeques[mmWorker],task) ) { /* full */
+    atomic_fetch_sub(&mmQueued,1);
+    mmRun(task);
+    return;
+  }
+  if( atomic_load(&mmSleeping) > 0 ) {
+    pthread_mutex_lock(&mmPool.lock);
+    pthread_cond_signal(&mmPool.start);
+    pthread_mutex_unlock(&mmPool.lock);
+  }
+}
+
+int mmSync(void) {
+  atomic_long *pending = mmPending ? mmPending : &mmRootPending ;
+  mmTask *task ;
+  while( atomic_load(pending) > 0 ) {
+    if( ( task = mmFindTask() ) != NULL ) mmRun(task);
+    else sched_yield();
+  }
+  return 0;
+}
+
+/*
+  Matrix multiplication.
+
+  Operands are multiplied block by block. A KC x NC panel of the right
+  operand and an MC x KC block of the left operand are first packed into
+  contiguous buffers , laid out as slivers of NR columns / MR rows. A
+  micro-kernel then computes each MR x NR tile of the result entirely in
+  registers , streaming through the two slivers with unit stride.
+  The micro-kernel (and with it MR and NR) is picked once at startup
+  depending on the instruction sets the processor reports.
+*/
+
+#define GEMM_KC 256
+#define GEMM_MC 96   /* multiple of every MR */
+#define GEMM_NC 2048 /* multiple of every NR */
+#define GEMM_MAX_MR 8
+#define GEMM_MAX_NR 8
+#define GEMM_SMALL ( 32 * 32 * 32 ) /* products below this many flops skip packing */
+#define GEMM_SERIAL ( 128 * 128 * 128 ) /* products below this many flops stay on one thread */
+
+/* C[MR][NR] += A[kc][MR] * B[kc][NR] on packed slivers. C has row stride ldc. */
+typedef void (*gemmKernel)(int,const double*,const double*,double*,long);
+
+static struct {
+  int mr , nr ;
+  gemmKernel kernel ;
+} gemmArch ;
+
+/* 4 x 4 tile with SSE2 , always available on x86_64 */
+static void gemmKernelSSE2(int kc,const double *a,const double *b,double *c,long ldc) {
+  __m128d c00 = _mm_setzero_pd() , c01 = _mm_setzero_pd() ,
+    c10 = _mm_setzero_pd() , c11 = _mm_setzero_pd() ,
+    c20 = _mm_setzero_pd() , c21 = _mm_setzero_pd() ,
+    c30 = _mm_setzero_pd() , c31 = _mm_setzero_pd() ;
+  int p;
+  for( p = 0 ; p < kc ; p++ , a += 4 , b += 4 ) {
+    __m128d b0 = _mm_load_pd(b) , b1 = _mm_load_pd(b+2) , ai ;
+    ai = _mm_set1_pd(a[0]);
+    c00 = _mm_add_pd(c00,_mm_mul_pd(ai,b0)); c01 = _mm_add_pd(c01,_mm_mul_pd(ai,b1));
+    ai = _mm_set1_pd(a[1]);
+    c10 = _mm_add_pd(c10,_mm_mul_pd(ai,b0)); c11 = _mm_add_pd(c11,_mm_mul_pd(ai,b1));
+    ai = _mm_set1_pd(a[2]);
+    c20 = _mm_add_pd(c20,_mm_mul_pd(ai,b0)); c21 = _mm_add_pd(c21,_mm_mul_pd(ai,b1));
+    ai = _mm_set1_pd(a[3]);
+    c30 = _mm_add_pd(c30,_mm_mul_pd(ai,b0)); c31 = _mm_add_pd(c31,_mm_mul_pd(ai,b1));
+  }
+#define GEMM_STORE2(row,lo,hi)						\
+  _mm_storeu_pd(c+(row)*ldc , _mm_add_pd(_mm_loadu_pd(c+(row)*ldc),lo));	\
+  _mm_storeu_pd(c+(row)*ldc+2 , _mm_add_pd(_mm_loadu_pd(c+(row)*ldc+2),hi));
+  GEMM_STORE2(0,c00,c01) GEMM_STORE2(1,c10,c11)
+  GEMM_STORE2(2,c20,c21) GEMM_STORE2(3,c30,c31)
+#undef GEMM_STORE2
+}
+
+/* 6 x 8 tile with AVX2 + FMA : 12 accumulators out of 16 ymm registers */
+__attribute__((target("avx2,fma")))
+static void gemmKernelAVX2(int kc,const double *a,const double *b,double *c,long ldc) {
+  __m256d c00 = _mm256_setzero_pd() , c01 = _mm256_setzero_pd() ,
+    c10 = _mm256_setzero_pd() , c11 = _mm256_setzero_pd() ,
+    c20 = _mm256_setzero_pd() , c21 = _mm256_setzero_pd() ,
+    c30 = _mm256_setzero_pd() , c31 = _mm256_setzero_pd() ,
+    c40 = _mm256_setzero_pd() , c41 = _mm256_setzero_pd() ,
+    c50 = _mm256_setzero_pd() , c51 = _mm256_setzero_pd() ;
+  int p;
+  for( p = 0 ; p < kc ; p++ , a += 6 , b += 8 ) {
+    __m256d b0 = _mm256_load_pd(b) , b1 = _mm256_load_pd(b+4) , ai ;
+    ai = _mm256_broadcast_sd(a+0);
+    c00 = _mm256_fmadd_pd(ai,b0,c00); c01 = _mm256_fmadd_pd(ai,b1,c01);
+    ai = _mm256_broadcast_sd(a+1);
+    c10 = _mm256_fmadd_pd(ai,b0,c10); c11 = _mm256_fmadd_pd(ai,b1,c11);
+    ai = _mm256_broadcast_sd(a+2);
+    c20 = _mm256_fmadd_pd(ai,b0,c20); c21 = _mm256_fmadd_pd(ai,b1,c21);
+    ai = _mm256_broadcast_sd(a+3);
+    c30 = _mm256_fmadd_pd(ai,b0,c30); c31 = _mm256_fmadd_pd(ai,b1,c31);
+    ai = _mm256_broadcast_sd(a+4);
+    c40 = _mm256_fmadd_pd(ai,b0,c40); c41 = _mm256_fmadd_pd(ai,b1,c41);
+    ai = _mm256_broadcast_sd(a+5);
+    c50 = _mm256_fmadd_pd(ai,b0,c50); c51 = _mm256_fmadd_pd(ai,b1,c51);
+  }
+#define GEMM_STORE4(row,lo,hi)						\
+  _mm256_storeu_pd(c+(row)*ldc , _mm256_add_pd(_mm256_loadu_pd(c+(row)*ldc),lo)); \
+  _mm256_storeu_pd(c+(row)*ldc+4 , _mm256_add_pd(_mm256_loadu_pd(c+(row)*ldc+4),hi));
+  GEMM_STORE4(0,c00,c01) GEMM_STORE4(1,c10,c11) GEMM_STORE4(2,c20,c21)
+  GEMM_STORE4(3,c30,c31) GEMM_STORE4(4,c40,c41) GEMM_STORE4(5,c50,c51)
+#undef GEMM_STORE4
+}
+
+/* 8 x 8 tile with AVX-512 : one zmm accumulator per row */
+__attribute__((target("avx512f")))
+static void gemmKernelAVX512(int kc,const double *a,const double *b,double *c,long ldc) {
+  __m512d c0 = _mm512_setzero_pd() , c1 = _mm512_setzero_pd() ,
+    c2 = _mm512_setzero_pd() , c3 = _mm512_setzero_pd() ,
+    c4 = _mm512_setzero_pd() , c5 = _mm512_setzero_pd() ,
+    c6 = _mm512_setzero_pd() , c7 = _mm512_setzero_pd() ;
+  int p;
+  for( p = 0 ; p < kc ; p++ , a += 8 , b += 8 ) {
+    __m512d b0 = _mm512_load_pd(b);
+    c0 = _mm512_fmadd_pd(_mm512_set1_pd(a[0]),b0,c0);
+    c1 = _mm512_fmadd_pd(_mm512_set1_pd(a[1]),b0,c1);
+    c2 = _mm512_fmadd_pd(_mm512_set1_pd(a[2]),b0,c2);
+    c3 = _mm512_fmadd_pd(_mm512_set1_pd(a[3]),b0,c3);
+    c4 = _mm512_fmadd_pd(_mm512_set1_pd(a[4]),b0,c4);
+    c5 = _mm512_fmadd_pd(_mm512_set1_pd(a[5]),b0,c5);
+    c6 = _mm512_fmadd_pd(_mm512_set1_pd(a[6]),b0,c6);
+    c7 = _mm512_fmadd_pd(_mm512_set1_pd(a[7]),b0,c7);
+  }
+#define GEMM_STORE8(row,acc)						\
+  _mm512_storeu_pd(c+(row)*ldc , _mm512_add_pd(_mm512_loadu_pd(c+(row)*ldc),acc));
+  GEMM_STORE8(0,c0) GEMM_STORE8(1,c1) GEMM_STORE8(2,c2) GEMM_STORE8(3,c3)
+  GEMM_STORE8(4,c4) GEMM_STORE8(5,c5) GEMM_STORE8(6,c6) GEMM_STORE8(7,c7)
+#undef GEMM_STORE8
+}
+
+/* Select the widest micro-kernel the processor supports. */
+__attribute__((constructor))
+static void gemmInit(void) {
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports("avx512f") ) {
+    gemmArch.mr = 8 , gemmArch.nr = 8 , gemmArch.kernel = gemmKernelAVX512;
+  } else if( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ) {
+    gemmArch.mr = 6 , gemmArch.nr = 8 , gemmArch.kernel = gemmKernelAVX2;
+  } else {
+    gemmArch.mr = 4 , gemmArch.nr = 4 , gemmArch.kernel = gemmKernelSSE2;
+  }
+}
+
+/* Pack an mc x kc block of A into slivers of mr rows , zero padded. */
+static void gemmPackA(int mc,int kc,const double *A,long rsa,long csa,double *buf) {
+  int mr = gemmArch.mr , i , p , r;
+  for( i = 0 ; i < mc ; i += mr )
+    for( p = 0 ; p < kc ; p++ )
+      for( r = 0 ; r < mr ; r++ )
+	*buf++ = ( i + r < mc ) ? A[(i+r)*rsa + p*csa] : 0.0;
+}
+
+/* Pack a kc x nc panel of B into slivers of nr columns , zero padded. */
+static void gemmPackB(int kc,int nc,const double *B,long rsb,long csb,double *buf) {
+  int nr = gemmArch.nr , j , p , r;
+  for( j = 0 ; j < nc ; j += nr )
+    for( p = 0 ; p < kc ; p++ )
+      for( r = 0 ; r < nr ; r++ )
+	*buf++ = ( j + r < nc ) ? B[p*rsb + (j+r)*csb] : 0.0;
+}
+
+/*
+  C += A * B , where A is m x k , B is k x n and C is m x n with row stride ldc.
+  Element (i,p) of A is A[i*rsa + p*csa] and element (p,j) of B is B[p*rsb + j*csb] ,
+  so transposed operands are read in place by swapping their strides.
+  Only elements (i,j) with j <= i + diag are needed : tiles lying wholly
+  beyond that diagonal are skipped ( diag >= n computes the full product ).
+*/
+static void gemm(int m,int n,int k,
+		 const double *A,long rsa,long csa,
+		 const double *B,long rsb,long csb,
+		 double *C,long ldc,int diag) {
+  int mr = gemmArch.mr , nr = gemmArch.nr ;
+  int jc , pc , ic , jr , ir ;
+  double *packA , *packB , tile[GEMM_MAX_MR*GEMM_MAX_NR] ;
+  int ncMax = n < GEMM_NC ? n : GEMM_NC ;
+  ncMax = ( ncMax + nr - 1 ) / nr * nr ;
+
+  if( posix_memalign((void**)&packA,64,sizeof(double)*GEMM_MC*GEMM_KC) ) abort();
+  if( posix_memalign((void**)&packB,64,sizeof(double)*GEMM_KC*ncMax) ) abort();
+
+  for( jc = 0 ; jc < n ; jc += GEMM_NC ) {
+    int nc = n - jc < GEMM_NC ? n - jc : GEMM_NC ;
+    for( pc = 0 ; pc < k ; pc += GEMM_KC ) {
+      int kc = k - pc < GEMM_KC ? k - pc : GEMM_KC ;
+      gemmPackB(kc,nc,B + pc*rsb + jc*csb,rsb,csb,packB);
+      for( ic = 0 ; ic < m ; ic += GEMM_MC ) {
+	int mc = m - ic < GEMM_MC ? m - ic : GEMM_MC ;
+	if( jc > ic + mc - 1 + diag ) continue;
+	gemmPackA(mc,kc,A + ic*rsa + pc*csa,rsa,csa,packA);
+	for( jr = 0 ; jr < nc ; jr += nr ) {
+	  for( ir = 0 ; ir < mc ; ir += mr ) {
+	    const double *a = packA + (long)ir*kc , *b = packB + (long)jr*kc ;
+	    double *c = C + (ic+ir)*ldc + jc + jr ;
+	    if( jc + jr > ic + ir + mr - 1 + diag ) continue;
+	    if( ir + mr <= mc && jr + nr <= nc ) {
+	      gemmArch.kernel(kc,a,b,c,ldc);
+	    } else { // partial tile at the edge : compute aside , add the valid part
+	      int i , j , mEdge = mc - ir < mr ? mc - ir : mr , nEdge = nc - jr < nr ? nc - jr : nr ;
+	      memset(tile,0,sizeof(tile));
+	      gemmArch.kernel(kc,a,b,tile,nr);
+	      for( i = 0 ; i < mEdge ; i++ )
+		for( j = 0 ; j < nEdge ; j++ )
+		  c[i*ldc + j] += tile[i*nr + j];
+	    }
+	  }
+	}
+      }
+    }
+  }
+  free(packA); free(packB);
+}
+
+/* Unpacked product for small operands , in i-k-j order so that
+   the innermost loop runs along rows of both B and C. */
+static void gemmSmall(int m,int n,int k,
+		      const double *A,long rsa,long csa,
+		      const double *B,long rsb,long csb,
+		      double *C,long ldc) {
+  int i , j , p;
+  for( i = 0 ; i < m ; i++ )
+    for( p = 0 ; p < k ; p++ ) {
+      double a = A[i*rsa + p*csa];
+      const double *b = B + p*rsb;
+      double *c = C + i*ldc;
+      for( j = 0 ; j < n ; j++ )
+	c[j] += a * b[j*csb];
+    }
+}
+
+/* Operands of a product split over the worker pool. */
+typedef struct {
+  int m , n , k , rowBlock , colBlock , colParts ;
+  const double *A , *B ;
+  long rsa , csa , rsb , csb ;
+  double *C ;
+  long ldc ;
+} gemmJob ;
+
+/* Task : one rowBlock x colBlock block of the result. */
+static void gemmTask(void *arg,int index) {
+  gemmJob *job = (gemmJob*)arg;
+  int i = index / job->colParts * job->rowBlock , j = index % job->colParts * job->colBlock ;
+  int m = job->m - i < job->rowBlock ? job->m - i : job->rowBlock ;
+  int n = job->n - j < job->colBlock ? job->n - j : job->colBlock ;
+  if( m <= 0 || n <= 0 ) return;
+  gemm(m,n,job->k,
+       job->A + i*job->rsa,job->rsa,job->csa,
+       job->B + j*job->csb,job->rsb,job->csb,
+       job->C + i*job->ldc + j,job->ldc,n);
+}
+
+/* C += A * B , partitioned into a grid of result blocks , one per thread. */
+static void gemmParallel(int m,int n,int k,
+			 const double *A,long rsa,long csa,
+			 const double *B,long rsb,long csb,
+			 double *C,long ldc) {
+  int threads = mmThreads() , rowParts , colParts ;
+  gemmJob job = { m , n , k , 0 , 0 , 0 , A , B , rsa , csa , rsb , csb , C , ldc } ;
+
+  if( (long)m * n * k < GEMM_SERIAL || threads == 1 ) {
+    gemm(m,n,k,A,rsa,csa,B,rsb,csb,C,ldc,n);
+    return;
+  }
+  /* Prefer splitting rows : every block then reuses whole rows of B.
+     Columns are split only when there are too few row slivers to go around. */
+  rowParts = ( m + gemmArch.mr - 1 ) / gemmArch.mr ;
+  if( rowParts > threads ) rowParts = threads;
+  colParts = ( threads + rowParts - 1 ) / rowParts ;
+  job.rowBlock = ( ( m + rowParts - 1 ) / rowParts + gemmArch.mr - 1 ) / gemmArch.mr * gemmArch.mr ;
+  job.colBlock = ( ( n + colParts - 1 ) / colParts + gemmArch.nr - 1 ) / gemmArch.nr * gemmArch.nr ;
+  job.colParts = colParts;
+  mmParallel(gemmTask,&job,rowParts * colParts);
+}
+
+/* Z = A * B for u x v A and v x w B , both given by strides , Z with row stride ldz. */
+static void matProduct(double *z,long ldz,int u,int v,int w,
+		       const double *A,long rsa,long csa,
+		       const double *B,long rsb,long csb) {
+  int i;
+  for( i = 0 ; i < u ; i++ )
+    memset(z + i*ldz,0,sizeof(double)*(size_t)w);
+  if( (long)u * v * w < GEMM_SMALL )
+    gemmSmall(u,w,v,A,rsa,csa,B,rsb,csb,z,ldz);
+  else
+    gemmParallel(u,w,v,A,rsa,csa,B,rsb,csb,z,ldz);
+}
+
 void matMult(void *ret,void *lx,void *rx) {
   int u = rows(lx) , v = cols(lx) , w = cols(rx);
-  
+
   if( v != rows(rx) ) abort();
   if( rows(ret) != u || cols(ret) != w ) abort();
-  
-  double *z = (double*)ret; z++;
-  double *x = (double*)lx; x++;
-  double *y = (double*)rx; y++;
-    
-  int i , j , k;
-  for( i = 0 ; i < u ; i++ ) {
-    for( j = 0 ; j < w ; j++ ) {
-      double *xp = x + i * v , *yp = y + j;
-      double val = 0.0;
-      for( k = 0 ; k < v ; k++ ) {
-	// fprintf(stderr,"%lf,%lf\n",*xp,*yp);
-	val += (*xp) * (*yp);
-	xp++; yp += w;
-      }
-      *z = val;
-      z++;
+
+  matProduct(mmData(ret),mmLd(ret),u,v,w,mmData(lx),mmLd(lx),1,mmData(rx),mmLd(rx),1);
+}
+
+/* ret = lx * rx.' , reading rows of rx as columns */
+void matMultNT(void *ret,void *lx,void *rx) {
+  int u = rows(lx) , v = cols(lx) , w = rows(rx);
+
+  if( v != cols(rx) ) abort();
+  if( rows(ret) != u || cols(ret) != w ) abort();
+
+  matProduct(mmData(ret),mmLd(ret),u,v,w,mmData(lx),mmLd(lx),1,mmData(rx),1,mmLd(rx));
+}
+
+/* ret = lx.' * rx , reading columns of lx as rows */
+void matMultTN(void *ret,void *lx,void *rx) {
+  int u = cols(lx) , v = rows(lx) , w = cols(rx);
+
+  if( v != rows(rx) ) abort();
+  if( rows(ret) != u || cols(ret) != w ) abort();
+
+  matProduct(mmData(ret),mmLd(ret),u,v,w,mmData(lx),1,mmLd(lx),mmData(rx),mmLd(rx),1);
+}
+
+/*
+  Symmetric products X * X.' and X.' * X.
+
+  Only the lower triangle is computed , which halves the work of a general
+  product : the packed kernel skips every tile above the diagonal. Across
+  the worker pool , rows are split into bands of equal triangular area.
+  The upper triangle is finally mirrored from the lower one.
+*/
+
+/* Operands of a symmetric product. Element (i,p) of X is A[i*rsa + p*csa]. */
+typedef struct {
+  int u , v , bands ;
+  const double *A ;
+  long rsa , csa ;
+  double *C ;
+  long ldc ;
+} syrkJob ;
+
+/* First row of band b out of bands : band areas of the triangle are equal. */
+static int syrkRow(int u,int b,int bands) {
+  long area = (long)u * u * b / bands ;
+  int row = 0;
+  while( (long)row * row < area ) row++;
+  return b == bands ? u : ( row + GEMM_MC - 1 ) / GEMM_MC * GEMM_MC ;
+}
+
+/* Task : one band of rows of the lower triangle. */
+static void syrkTask(void *arg,int index) {
+  syrkJob *job = (syrkJob*)arg;
+  int i = syrkRow(job->u,index,job->bands) , e = syrkRow(job->u,index+1,job->bands) ;
+  if( e > job->u ) e = job->u;
+  if( i >= e ) return;
+  gemm(e-i,e,job->v,job->A + i*job->rsa,job->rsa,job->csa,
+       job->A,job->csa,job->rsa,job->C + (long)i*job->ldc,job->ldc,i);
+}
+
+/* C = X * X.' for u x v X , C being u x u with row stride ldc. */
+static void syrk(double *C,long ldc,int u,int v,const double *A,long rsa,long csa) {
+  syrkJob job = { u , v , 1 , A , rsa , csa , C , ldc } ;
+  int threads = mmThreads() , i , j ;
+
+  for( i = 0 ; i < u ; i++ )
+    memset(C + i*ldc,0,sizeof(double)*(size_t)u);
+  if( (long)u * u * v < GEMM_SMALL ) {
+    gemmSmall(u,u,v,A,rsa,csa,A,csa,rsa,C,ldc);
+    return;
+  }
+  if( (long)u * u * v >= 2 * GEMM_SERIAL && threads > 1 ) job.bands = threads;
+  mmParallel(syrkTask,&job,job.bands);
+
+  for( i = 0 ; i < u ; i++ )
+    for( j = i + 1 ; j < u ; j++ )
+      C[i*ldc + j] = C[j*ldc + i];
+}
+
+/* ret = mat * mat.' */
+void matSyrk(void *ret,void *mat) {
+  int u = rows(mat) , v = cols(mat);
+
+  if( rows(ret) != u || cols(ret) != u ) abort();
+
+  syrk(mmData(ret),mmLd(ret),u,v,mmData(mat),mmLd(mat),1);
+}
+
+/* ret = mat.' * mat */
+void matSyrkT(void *ret,void *mat) {
+  int u = cols(mat) , v = rows(mat);
+
+  if( rows(ret) != u || cols(ret) != u ) abort();
+
+  syrk(mmData(ret),mmLd(ret),u,v,mmData(mat),1,mmLd(mat));
+}
+
+/*
+  Matrix transposition.
+
+  The index space is halved recursively along its longer side until a block
+  of at most TRANSPOSE_BLOCK x TRANSPOSE_BLOCK remains , so the rows read and
+  the columns written stay cache resident whatever the cache sizes are.
+  Blocks are then transposed 4 x 4 in registers. Large matrices are split
+  into bands of rows , one per worker.
+*/
+
+#define TRANSPOSE_BLOCK 32
+#define TRANSPOSE_SERIAL ( 256 * 256 ) /* transposes below this many elements stay on one thread */
+
+/* B[j][i] = A[i][j] for a 4 x 4 block. A has row stride lda , B has row stride ldb. */
+typedef void (*transposeKernel)(const double*,long,double*,long);
+
+static transposeKernel transposeArch ;
+
+/* Four 2 x 2 swaps with SSE2 */
+static void transposeKernelSSE2(const double *a,long lda,double *b,long ldb) {
+  int i , j;
+  for( i = 0 ; i < 4 ; i += 2 )
+    for( j = 0 ; j < 4 ; j += 2 ) {
+      __m128d r0 = _mm_loadu_pd(a + i*lda + j) , r1 = _mm_loadu_pd(a + (i+1)*lda + j) ;
+      _mm_storeu_pd(b + j*ldb + i , _mm_unpacklo_pd(r0,r1));
+      _mm_storeu_pd(b + (j+1)*ldb + i , _mm_unpackhi_pd(r0,r1));
     }
+}
+
+/* Whole rows in ymm registers : interleave pairs of rows , then swap 128-bit halves */
+__attribute__((target("avx")))
+static void transposeKernelAVX(const double *a,long lda,double *b,long ldb) {
+  __m256d r0 = _mm256_loadu_pd(a) , r1 = _mm256_loadu_pd(a + lda) ,
+    r2 = _mm256_loadu_pd(a + 2*lda) , r3 = _mm256_loadu_pd(a + 3*lda) ;
+  __m256d t0 = _mm256_unpacklo_pd(r0,r1) , t1 = _mm256_unpackhi_pd(r0,r1) ,
+    t2 = _mm256_unpacklo_pd(r2,r3) , t3 = _mm256_unpackhi_pd(r2,r3) ;
+  _mm256_storeu_pd(b , _mm256_permute2f128_pd(t0,t2,0x20));
+  _mm256_storeu_pd(b + ldb , _mm256_permute2f128_pd(t1,t3,0x20));
+  _mm256_storeu_pd(b + 2*ldb , _mm256_permute2f128_pd(t0,t2,0x31));
+  _mm256_storeu_pd(b + 3*ldb , _mm256_permute2f128_pd(t1,t3,0x31));
+}
+
+__attribute__((constructor))
+static void transposeInit(void) {
+  __builtin_cpu_init();
+  transposeArch = __builtin_cpu_supports("avx") ? transposeKernelAVX : transposeKernelSSE2;
+}
+
+/* B = A' for an m x n block of A. */
+static void transposeBlock(int m,int n,const double *A,long lda,double *B,long ldb) {
+  int i , j , r;
+  if( m <= TRANSPOSE_BLOCK && n <= TRANSPOSE_BLOCK ) {
+    for( i = 0 ; i + 4 <= m ; i += 4 ) {
+      for( j = 0 ; j + 4 <= n ; j += 4 )
+	transposeArch(A + i*lda + j,lda,B + j*ldb + i,ldb);
+      for( ; j < n ; j++ )
+	for( r = i ; r < i + 4 ; r++ )
+	  B[j*ldb + r] = A[r*lda + j];
+    }
+    for( ; i < m ; i++ )
+      for( j = 0 ; j < n ; j++ )
+	B[j*ldb + i] = A[i*lda + j];
+  } else if( m >= n ) { // halves stay multiples of 4 so that blocks remain aligned to the kernel
+    int h = ( m / 2 + 3 ) & ~3 ;
+    transposeBlock(h,n,A,lda,B,ldb);
+    transposeBlock(m - h,n,A + h*lda,lda,B + h,ldb);
+  } else {
+    int h = ( n / 2 + 3 ) & ~3 ;
+    transposeBlock(m,h,A,lda,B,ldb);
+    transposeBlock(m,n - h,A + h,lda,B + h*ldb,ldb);
+  }
+}
+
+/* Operands of a transpose split over the worker pool. */
+typedef struct {
+  int m , n , band ;
+  const double *A ;
+  long lda ;
+  double *B ;
+  long ldb ;
+} transposeJob ;
+
+/* Task : one band of rows of A , i.e. of columns of B. */
+static void transposeTask(void *arg,int index) {
+  transposeJob *job = (transposeJob*)arg;
+  int i = index * job->band , m = job->m - i < job->band ? job->m - i : job->band ;
+  if( m > 0 )
+    transposeBlock(m,job->n,job->A + i*job->lda,job->lda,job->B + i,job->ldb);
+}
+
+void matTranspose(void *ret,void *mat) {
+  int m = rows(mat) , n = cols(mat) , threads ;
+
+  if( rows(ret) != n || cols(ret) != m ) abort();
+
+  double *z = mmData(ret) , *x = mmData(mat) ;
+  long ldz = mmLd(ret) , ldx = mmLd(mat) ;
+
+  threads = (long)m * n < TRANSPOSE_SERIAL ? 1 : mmThreads() ;
+  if( threads == 1 ) {
+    transposeBlock(m,n,x,ldx,z,ldz);
+  } else {
+    transposeJob job = { m , n , 0 , x , ldx , z , ldz } ;
+    job.band = ( ( m + threads - 1 ) / threads + 3 ) & ~3 ;
+    mmParallel(transposeTask,&job,( m + job.band - 1 ) / job.band);
   }
 }
@@ -0,0 +1,1661 @@
+#include "optimizer.hh"
+#include <set>
+#include <cmath>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <functional>
+
+mm_optimizer::mm_optimizer(mm_translator & translator) :
+  mic(translator) , rootId(0) { }
+
+mm_optimizer::~mm_optimizer() { }
+
+void mm_optimizer::optimize() {
+  std::vector<Taco> & QA = mic.quadArray;
+  removed.assign( QA.size() , false );
+  inserted.assign( QA.size() , std::vector<Taco>() );
+  for( const Taco & quad : QA )
+    if( quad.opCode == OP_FUNC_START ) functions.insert( quad.z );
+  for(unsigned int addr = 0; addr < QA.size() ; ) {
+    if( QA[addr].opCode != OP_FUNC_START ) { addr++ ; continue; }
+    unsigned int from = addr , to = addr;
+    for( ; to < QA.size() and QA[to].opCode != OP_FUNC_END ; to++ ) ;
+    rootId = mic.getSymbol( mic.lookup( "::" + QA[from].z ) ).child;
+    constants.clear();
+    collectScalars( from , to );
+
+    // Every pass may open opportunities for the others.
+    for( bool changed = true ; changed ; ) {
+      changed = false;
+      if( propagateConditionalConstants( from , to ) ) changed = true;
+      compact( from , to );
+      if( propagateConstants( from , to ) ) changed = true;
+      compact( from , to );
+      if( eliminateDeadCode( from , to ) ) changed = true;
+      compact( from , to );
+      if( numberValues( from , to ) ) changed = true;
+      compact( from , to );
+      if( hoistInvariants( from , to ) ) changed = true;
+      compact( from , to );
+      if( reduceStrength( from , to ) ) changed = true;
+      compact( from , to );
+      if( simplifyJumps( from , to ) ) changed = true;
+      compact( from , to );
+      if( removeUnreachableCode( from , to ) ) changed = true;
+      compact( from , to );
+    }
+    placeTemporaries( from , to );
+    compact( from , to );
+    assignBuffers( from , to );
+    compact( from , to );
+    addr = to + 1;
+  }
+}
+
+void mm_optimizer::collectScalars(unsigned int from , unsigned int to) {
+  scalars.clear() ; matrices.clear();
+  dft( rootId );
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    const Taco & quad = mic.quadArray[addr];
+    if( quad.opCode == OP_REFER ) {
+      scalars.erase( quad.x );
+      matrices.erase( quad.x );
+    } else if( quad.opCode == OP_PARFOR ) { // reached through the frame by the outlined body
+      for( const std::string & id : mic.captures[quad.z] ) {
+	scalars.erase( id );
+	matrices.erase( id );
+      }
+    }
+  }
+}
+
+/* Perform a depth first traversal of the function's tables. */
+void mm_optimizer::dft(unsigned int tableId) {
+  std::vector< Symbol > & table = mic.tables[tableId].table;
+  for(unsigned int idx = 0; idx < table.size() ; idx++ ) {
+    Symbol & symbol = table[idx];
+    if( symbol.child != 0 ) {
+      dft( symbol.child );
+    } else if( symbol.symType == SymbolType::LOCAL or symbol.symType == SymbolType::TEMP
+	       or symbol.symType == SymbolType::PARAM ) {
+      if( symbol.type.isScalarType() or symbol.type.isPointer() )
+	scalars[symbol.id] = symbol.type;
+      else if( symbol.type == MM_MATRIX_TYPE )
+	matrices.insert( symbol.id );
+    }
+  }
+}
+
+bool mm_optimizer::definesResult(const Taco & quad) {
+  if( quad.isJump() ) return false;
+  switch( quad.opCode ) {
+  case OP_PARAM : case OP_SPAWN : case OP_RETURN : case OP_FUNC_START : case OP_FUNC_END :
+  case OP_L_DEREF : case OP_LXC : case OP_DEALLOC : case OP_DECLARE :
+    return false;
+  default :
+    return true;
+  }
+}
+
+DataType mm_optimizer::typeOf(const std::string & id) {
+  auto it = scalars.find( id );
+  if( it != scalars.end() ) return it->second;
+  try {
+    return mic.getSymbol( mic.lookup( id ) ).type;
+  } catch( int ) {
+    return MM_INT_TYPE; // literal
+  }
+}
+
+bool mm_optimizer::constantOf(const std::string & id , const DataType & type ,
+			      const std::map<std::string,Symbol> & known , Symbol & result) {
+  if( id.empty() ) return false;
+  auto it = known.find( id );
+  if( it != known.end() ) {
+    result = it->second;
+    return true;
+  }
+  if( isdigit( id[0] ) ) { // literal , read as a value of the quad's type
+    int value = atoi( id.c_str() );
+    result.type = type;
+    if( type == MM_DOUBLE_TYPE ) result.value.doubleVal = value;
+    else if( type == MM_INT_TYPE ) result.value.intVal = value;
+    else return false;
+    return true;
+  }
+  try {
+    Symbol & symbol = mic.getSymbol( mic.lookup( id ) );
+    if( symbol.symType == SymbolType::CONST and symbol.isInitialized and symbol.type.isScalarType() ) {
+      result = symbol;
+      return true;
+    }
+  } catch( int ) { }
+  return false;
+}
+
+std::string mm_optimizer::constantSymbol(const Symbol & constant) {
+  long long bits = 0;
+  if( constant.type == MM_DOUBLE_TYPE ) memcpy( &bits , &constant.value.doubleVal , sizeof(double) );
+  else if( constant.type == MM_INT_TYPE ) bits = constant.value.intVal;
+  else bits = constant.value.charVal;
+  auto key = std::make_pair( constant.type.cols , bits );
+  auto it = constants.find( key );
+  if( it != constants.end() ) return it->second;
+
+  DataType type = constant.type;
+  Symbol & symbol = mic.getSymbol( mic.genTemp( rootId , type ) );
+  symbol.symType = SymbolType::CONST;
+  symbol.isInitialized = symbol.isConstant = true;
+  symbol.value = constant.value;
+  return constants[key] = symbol.id;
+}
+
+/* Evaluates z = x op y ( or z = op x ) the way the generated code would.
+   Returns false if the operation is not folded. */
+static bool fold(OpCode opCode , const Symbol & x , const Symbol & y , const DataType & type , Symbol & z) {
+  z.type = type;
+  if( x.type != type ) return false;
+  if( opCode != OP_UMINUS and y.type != type ) return false;
+  if( type == MM_INT_TYPE ) {
+    unsigned int a = x.value.intVal , b = y.value.intVal; // wrap around on overflow
+    switch( opCode ) {
+    case OP_PLUS : z.value.intVal = a + b ; return true;
+    case OP_MINUS : z.value.intVal = a - b ; return true;
+    case OP_MULT : z.value.intVal = a * b ; return true;
+    case OP_UMINUS : z.value.intVal = -a ; return true;
+    case OP_DIV : case OP_MOD :
+      if( y.value.intVal == 0 or ( x.value.intVal == INT_MIN and y.value.intVal == -1 ) )
+	return false; // leave the fault to run time
+      z.value.intVal = ( opCode == OP_DIV ? x.value.intVal / y.value.intVal : x.value.intVal % y.value.intVal );
+      return true;
+    default : return false;
+    }
+  } else if( type == MM_DOUBLE_TYPE ) {
+    double a = x.value.doubleVal , b = y.value.doubleVal;
+    switch( opCode ) {
+    case OP_PLUS : z.value.doubleVal = a + b ; return true;
+    case OP_MINUS : z.value.doubleVal = a - b ; return true;
+    case OP_MULT : z.value.doubleVal = a * b ; return true;
+    case OP_DIV : z.value.doubleVal = a / b ; return true;
+    case OP_UMINUS : z.value.doubleVal = -a ; return true;
+    default : return false;
+    }
+  }
+  return false;
+}
+
+/* Evaluates a conversion. Chars are zero extended and doubles truncated. */
+static bool convert(OpCode opCode , const Symbol & x , Symbol & z) {
+  long long value;
+  if( x.type == MM_CHAR_TYPE ) value = (unsigned char) x.value.charVal;
+  else if( x.type == MM_INT_TYPE ) value = x.value.intVal;
+  else if( x.type == MM_DOUBLE_TYPE ) {
+    double d = x.value.doubleVal;
+    if( opCode == OP_CONV_TO_DOUBLE ) return false;
+    if( not ( d > INT_MIN - 1.0 and d < INT_MAX + 1.0 ) ) return false; // out of range or NaN
+    value = (int) d;
+  } else return false;
+
+  switch( opCode ) {
+  case OP_CONV_TO_CHAR : z.type = MM_CHAR_TYPE ; z.value.charVal = (char) value ; return true;
+  case OP_CONV_TO_INT : z.type = MM_INT_TYPE ; z.value.intVal = (int) value ; return true;
+  case OP_CONV_TO_DOUBLE : z.type = MM_DOUBLE_TYPE ; z.value.doubleVal = value ; return true;
+  default : return false;
+  }
+}
+
+/* Evaluates the condition of a relational jump. */
+static bool compare(OpCode opCode , const Symbol & x , const Symbol & y , bool & taken) {
+  if( x.type != y.type ) return false;
+  double a , b;
+  if( x.type == MM_CHAR_TYPE ) a = (signed char) x.value.charVal , b = (signed char) y.value.charVal;
+  else if( x.type == MM_INT_TYPE ) a = x.value.intVal , b = y.value.intVal;
+  else if( x.type == MM_DOUBLE_TYPE ) a = x.value.doubleVal , b = y.value.doubleVal;
+  else return false;
+  if( std::isnan(a) or std::isnan(b) ) return false;
+  switch( opCode ) {
+  case OP_LT : taken = a < b ; return true;
+  case OP_LTE : taken = a <= b ; return true;
+  case OP_GT : taken = a > b ; return true;
+  case OP_GTE : taken = a >= b ; return true;
+  case OP_EQ : taken = a == b ; return true;
+  case OP_NEQ : taken = a != b ; return true;
+  default : return false;
+  }
+}
+
+/* Wether an operand is the offset of a matrix dimension in its header :
+   rows , columns or the leading dimension , which equals the columns. */
+static bool isHeaderOffset(const std::string & id) {
+  return id == "0" or id == "4" or id == std::to_string( MATRIX_LD );
+}
+
+/* Wether the quad at addr reads a dimension of a matrix , and its offset in
+   the header : z = m[0] , z = m[4] , or calls to rows and cols from the
+   standard library , which read nothing else and write nothing. */
+bool mm_optimizer::readsDimension(unsigned int addr , std::string & matrix , std::string & offset) {
+  const Taco & quad = mic.quadArray[addr];
+  if( quad.opCode == OP_RXC and isHeaderOffset( quad.y ) ) {
+    matrix = quad.x ; offset = quad.y;
+    return true;
+  }
+  if( quad.opCode == OP_CALL and ( quad.x == "rows" or quad.x == "cols" ) and quad.y == "1"
+      and functions.count( quad.x ) == 0 and mic.quadArray[addr-1].opCode == OP_PARAM ) {
+    matrix = mic.quadArray[addr-1].z ; offset = ( quad.x == "rows" ? "0" : "4" );
+    return typeOf( matrix ).isMatrix();
+  }
+  return false;
+}
+
+mm_ssa mm_optimizer::buildSSA(unsigned int from , unsigned int to , std::vector<std::string> & variables) {
+  std::vector<Taco> & QA = mic.quadArray;
+  std::map<std::string,unsigned int> index;
+  variables.clear();
+  for( auto & scalar : scalars ) {
+    index[scalar.first] = variables.size();
+    variables.push_back( scalar.first );
+  }
+
+  // Headers read , and matrices a callee may reach.
+  std::set<std::string> escaping;
+  std::string matrix , offset;
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    const Taco & quad = QA[addr];
+    if( readsDimension( addr , matrix , offset ) and matrices.count( matrix ) and index.count( matrix ) == 0 ) {
+      index[matrix] = variables.size();
+      variables.push_back( matrix );
+    }
+    if( quad.opCode == OP_PARAM and not ( addr + 1 < to and readsDimension( addr + 1 , matrix , offset ) ) )
+      escaping.insert( quad.z );
+  }
+
+  unsigned int count = to - from - 1;
+  std::vector< std::vector<SSAOperand> > uses( count ) , defs( count );
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    const Taco & quad = QA[addr];
+    std::vector<SSAOperand> & use = uses[addr - from - 1] , & def = defs[addr - from - 1];
+    auto read = [&](char field , const std::string & id) {
+      auto it = index.find( id );
+      if( it != index.end() and scalars.count( id ) ) use.emplace_back( field , it->second );
+    };
+    switch( quad.opCode ) {
+    case OP_PARAM : case OP_RETURN : case OP_DEALLOC : read( 'z' , quad.z ) ; break;
+    case OP_L_DEREF : case OP_LXC : read( 'z' , quad.z ) ; read( 'x' , quad.x ) ; read( 'y' , quad.y ) ; break;
+    case OP_GOTO : case OP_DECLARE : case OP_CALL : case OP_SPAWN : break;
+    default : read( 'x' , quad.x ) ; read( 'y' , quad.y );
+    }
+    if( definesResult( quad ) and scalars.count( quad.z ) )
+      def.emplace_back( 'z' , index[quad.z] );
+
+    // Matrix headers
+    bool dimension = readsDimension( addr , matrix , offset );
+    if( dimension and matrices.count( matrix ) )
+      use.emplace_back( 'x' , index[matrix] );
+    auto header = index.find( quad.z );
+    if( header != index.end() and matrices.count( quad.z ) and not quad.isJump()
+	and quad.opCode != OP_PARAM and quad.opCode != OP_RETURN and quad.opCode != OP_DECLARE
+	and ( quad.opCode != OP_LXC or isHeaderOffset( quad.x ) ) )
+      def.emplace_back( 'z' , header->second );
+    if( ( quad.opCode == OP_CALL or quad.opCode == OP_SPAWN ) and not dimension )
+      for( const std::string & id : escaping )
+	if( matrices.count( id ) and index.count( id ) and id != quad.z ) def.emplace_back( 'z' , index[id] );
+  }
+  return mm_ssa( QA , from , to , variables.size() , uses , defs );
+}
+
+/* Lattice of sparse conditional constant propagation. */
+struct LatticeValue {
+  enum { TOP , CONSTANT , BOTTOM } state;
+  Symbol constant;
+  LatticeValue() : state(TOP) { }
+};
+
+static bool sameConstant(const Symbol & a , const Symbol & b) {
+  if( a.type != b.type ) return false;
+  if( a.type == MM_DOUBLE_TYPE ) return memcmp( &a.value.doubleVal , &b.value.doubleVal , sizeof(double) ) == 0;
+  if( a.type == MM_INT_TYPE ) return a.value.intVal == b.value.intVal;
+  return a.value.charVal == b.value.charVal;
+}
+
+/*
+  Sparse conditional constant propagation , after Wegman and Zadeck , over
+  the SSA form : every value is assumed constant until proven otherwise , and
+  only quads of blocks reached along edges whose condition may hold are
+  evaluated. Uses of constant values become constants , their definitions
+  copies of a constant , and jumps on constants gotos. Dimensions of static
+  matrices read from their header are constants.
+*/
+bool mm_optimizer::propagateConditionalConstants(unsigned int from , unsigned int to) {
+  std::vector<Taco> & QA = mic.quadArray;
+  std::vector<std::string> variables;
+  mm_ssa ssa = buildSSA( from , to , variables );
+  const unsigned int tracked = scalars.size(); // variables numbered below are scalars
+  const ControlFlowGraph & cfg = ssa.cfg;
+  if( cfg.blocks.empty() ) return false;
+  const unsigned int NONE = mm_ssa::NONE , blocks = cfg.blocks.size();
+
+  std::vector<LatticeValue> lattice( ssa.values.size() );
+  for(unsigned int v = 0; v < ssa.variables ; v++ ) lattice[v].state = LatticeValue::BOTTOM;
+
+  std::vector< std::vector<unsigned int> > quadUsers( ssa.values.size() ) , phiUsers( ssa.values.size() );
+  for(unsigned int addr = from + 1; addr < to ; addr++ )
+    for( const SSAOperand & use : ssa.uses[addr - from - 1] )
+      if( use.value != NONE ) quadUsers[use.value].push_back( addr );
+  for(unsigned int b = 0; b < blocks ; b++ )
+    for( const SSAPhi & phi : ssa.phis[b] )
+      for( unsigned int arg : phi.args )
+	if( arg != NONE ) phiUsers[arg].push_back( b );
+
+  // Edges are ( pred , block ) , the entry edge coming from blocks.
+  std::set< std::pair<unsigned int,unsigned int> > edges;
+  std::vector< std::pair<unsigned int,unsigned int> > flowWork( 1 , std::make_pair( blocks , 0u ) );
+  std::vector<unsigned int> ssaWork;
+  std::vector<bool> executable( blocks , false );
+
+  auto lower = [&](unsigned int value , const LatticeValue & result) {
+    LatticeValue & current = lattice[value];
+    if( current.state == LatticeValue::BOTTOM or result.state == LatticeValue::TOP ) return;
+    if( current.state == LatticeValue::CONSTANT and result.state == LatticeValue::CONSTANT
+	and sameConstant( current.constant , result.constant ) ) return;
+    if( current.state == LatticeValue::CONSTANT and result.state == LatticeValue::CONSTANT )
+      current.state = LatticeValue::BOTTOM;
+    else
+      current = result;
+    ssaWork.push_back( value );
+  };
+
+  auto visitPhis = [&](unsigned int b) {
+    const std::vector<unsigned int> & pred = cfg.blocks[b].pred;
+    for( const SSAPhi & phi : ssa.phis[b] ) {
+      LatticeValue result;
+      for(unsigned int j = 0; j < phi.args.size() ; j++ ) {
+	unsigned int p = ( j < pred.size() ? pred[j] : blocks );
+	if( edges.count( std::make_pair( p , b ) ) == 0 or phi.args[j] == NONE ) continue;
+	const LatticeValue & arg = lattice[ phi.args[j] ];
+	if( arg.state == LatticeValue::TOP ) continue;
+	if( result.state == LatticeValue::TOP ) result = arg;
+	else if( arg.state == LatticeValue::BOTTOM or not sameConstant( arg.constant , result.constant ) )
+	  result.state = LatticeValue::BOTTOM;
+      }
+      lower( phi.value , result );
+    }
+  };
+
+  // value of an operand read by the quad at addr
+  auto operand = [&](unsigned int addr , char field , const std::string & id , const DataType & type) -> LatticeValue {
+    LatticeValue result;
+    for( const SSAOperand & use : ssa.uses[addr - from - 1] )
+      if( use.field == field and use.var < tracked )
+	return use.value == NONE ? result : lattice[use.value];
+    std::map<std::string,Symbol> none;
+    if( constantOf( id , type , none , result.constant ) ) result.state = LatticeValue::CONSTANT;
+    else result.state = LatticeValue::BOTTOM;
+    return result;
+  };
+
+  auto visitQuad = [&](unsigned int addr) {
+    const Taco & quad = QA[addr];
+    unsigned int b = cfg.blockOf( addr );
+    auto follow = [&](unsigned int target) {
+      if( from < target and target < to ) flowWork.emplace_back( b , cfg.blockOf( target ) );
+    };
+    if( quad.isJump() ) {
+      unsigned int target = atoi( quad.z.c_str() );
+      bool both = true;
+      if( OP_LT <= quad.opCode and quad.opCode <= OP_NEQ ) {
+	DataType type = typeOf( quad.x );
+	LatticeValue x = operand( addr , 'x' , quad.x , type ) , y = operand( addr , 'y' , quad.y , type );
+	bool taken;
+	if( x.state == LatticeValue::TOP or y.state == LatticeValue::TOP ) {
+	  if( x.state != LatticeValue::BOTTOM and y.state != LatticeValue::BOTTOM ) return;
+	} else if( x.state == LatticeValue::CONSTANT and y.state == LatticeValue::CONSTANT
+		   and compare( quad.opCode , x.constant , y.constant , taken ) ) {
+	  if( taken ) follow( target ); else follow( addr + 1 );
+	  return;
+	}
+      } else if( quad.opCode == OP_GOTO ) {
+	both = false;
+      }
+      follow( target );
+      if( both ) follow( addr + 1 );
+      return;
+    }
+    if( addr + 1 == cfg.blocks[b].end and quad.opCode != OP_RETURN ) follow( addr + 1 );
+
+    for( const SSAOperand & def : ssa.defs[addr - from - 1] ) {
+      LatticeValue result;
+      result.state = LatticeValue::BOTTOM;
+      if( def.var < tracked ) {
+	DataType type = scalars[quad.z];
+	LatticeValue x , y;
+	switch( quad.opCode ) {
+	case OP_PLUS : case OP_MINUS : case OP_MULT : case OP_DIV : case OP_MOD : case OP_UMINUS :
+	  x = operand( addr , 'x' , quad.x , type );
+	  y = ( quad.opCode == OP_UMINUS ? x : operand( addr , 'y' , quad.y , type ) );
+	  if( x.state == LatticeValue::BOTTOM or y.state == LatticeValue::BOTTOM ) break;
+	  if( x.state == LatticeValue::TOP or y.state == LatticeValue::TOP ) result.state = LatticeValue::TOP;
+	  else if( fold( quad.opCode , x.constant , y.constant , type , result.constant ) ) result.state = LatticeValue::CONSTANT;
+	  break;
+	case OP_COPY :
+	  x = operand( addr , 'x' , quad.x , type );
+	  if( x.state != LatticeValue::CONSTANT or x.constant.type == type ) result = x;
+	  break;
+	case OP_CONV_TO_CHAR : case OP_CONV_TO_INT : case OP_CONV_TO_DOUBLE :
+	  x = operand( addr , 'x' , quad.x , typeOf( quad.x ) );
+	  if( x.state == LatticeValue::TOP ) result.state = LatticeValue::TOP;
+	  else if( x.state == LatticeValue::CONSTANT and convert( quad.opCode , x.constant , result.constant )
+		   and result.constant.type == type ) result.state = LatticeValue::CONSTANT;
+	  break;
+	case OP_RXC : case OP_CALL : {
+	  std::string matrix , offset;
+	  if( readsDimension( addr , matrix , offset ) and type == MM_INT_TYPE ) {
+	    DataType matrixType = typeOf( matrix );
+	    if( matrixType.isStaticMatrix() ) {
+	      result.constant.type = MM_INT_TYPE;
+	      result.constant.value.intVal = ( offset == "0" ? matrixType.rows : matrixType.cols );
+	      result.state = LatticeValue::CONSTANT;
+	    }
+	  }
+	} break;
+	default : break;
+	}
+      }
+      lower( def.value , result );
+    }
+  };
+
+  while( not flowWork.empty() or not ssaWork.empty() ) {
+    if( not flowWork.empty() ) {
+      std::pair<unsigned int,unsigned int> edge = flowWork.back();
+      flowWork.pop_back();
+      if( not edges.insert( edge ).second ) continue;
+      unsigned int b = edge.second;
+      visitPhis( b );
+      if( executable[b] ) continue;
+      executable[b] = true;
+      for(unsigned int addr = cfg.blocks[b].start; addr < cfg.blocks[b].end ; addr++ ) visitQuad( addr );
+    } else {
+      unsigned int value = ssaWork.back();
+      ssaWork.pop_back();
+      for( unsigned int b : phiUsers[value] )
+	if( executable[b] ) visitPhis( b );
+      for( unsigned int addr : quadUsers[value] )
+	if( executable[ cfg.blockOf( addr ) ] ) visitQuad( addr );
+    }
+  }
+
+  bool changed = false;
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    if( not executable[ cfg.blockOf( addr ) ] ) continue;
+    Taco & quad = QA[addr];
+    for( const SSAOperand & use : ssa.uses[addr - from - 1] ) {
+      if( use.var >= tracked or use.value == NONE ) continue;
+      if( lattice[use.value].state != LatticeValue::CONSTANT ) continue;
+      std::string & id = ( use.field == 'z' ? quad.z : use.field == 'x' ? quad.x : quad.y );
+      id = constantSymbol( lattice[use.value].constant );
+      changed = true;
+    }
+
+    Symbol x , y;
+    std::map<std::string,Symbol> none;
+    if( OP_LT <= quad.opCode and quad.opCode <= OP_NEQ ) {
+      DataType type = typeOf( quad.x );
+      bool taken;
+      if( constantOf( quad.x , type , none , x ) and constantOf( quad.y , type , none , y )
+	  and compare( quad.opCode , x , y , taken ) ) {
+	if( taken ) quad = Taco( OP_GOTO , quad.z );
+	else removed[addr] = true;
+	changed = true;
+      }
+      continue;
+    }
+    for( const SSAOperand & def : ssa.defs[addr - from - 1] ) {
+      if( def.var >= tracked or lattice[def.value].state != LatticeValue::CONSTANT ) continue;
+      if( quad.opCode == OP_COPY and constantOf( quad.x , scalars[quad.z] , none , x ) ) continue;
+      if( quad.opCode == OP_CALL ) removed[addr-1] = true; // its parameter
+      quad = Taco( OP_COPY , quad.z , constantSymbol( lattice[def.value].constant ) );
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+/*
+  Folds quads whose operands are constants , and replaces uses of scalars by
+  their known constant value or by the scalar they were copied from. Facts are
+  gathered walking each basic block and forgotten at its end. Scalars are
+  never modified behind the quads' back , as their address is never taken.
+*/
+bool mm_optimizer::propagateConstants(unsigned int from , unsigned int to) {
+  std::vector<Taco> & QA = mic.quadArray;
+  ControlFlowGraph cfg( QA , from , to );
+  std::map<std::string,Symbol> known;        // scalar -> constant value
+  std::map<std::string,std::string> copies;  // scalar -> scalar it holds a copy of
+  bool changed = false;
+
+  auto substitute = [&](std::string & id) {
+    if( scalars.count( id ) == 0 ) return;
+    auto value = known.find( id );
+    if( value != known.end() ) {
+      id = constantSymbol( value->second );
+      changed = true;
+    } else {
+      auto copy = copies.find( id );
+      if( copy != copies.end() ) id = copy->second , changed = true;
+    }
+  };
+
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    if( addr == cfg.blocks[ cfg.blockOf( addr ) ].start ) {
+      known.clear() ; copies.clear();
+    }
+    Taco & quad = QA[addr];
+    switch( quad.opCode ) {
+    case OP_DECLARE : case OP_GOTO : case OP_CALL : case OP_SPAWN : case OP_REFER : break;
+    case OP_PARAM : case OP_RETURN : substitute( quad.z ) ; break;
+    case OP_L_DEREF : substitute( quad.z ) ; substitute( quad.x ) ; break;
+    default : substitute( quad.x ) ; substitute( quad.y );
+    }
+
+    Symbol x , y , result;
+    if( OP_LT <= quad.opCode and quad.opCode <= OP_NEQ ) {
+      DataType type = typeOf( quad.x );
+      bool taken;
+      if( constantOf( quad.x , type , known , x ) and constantOf( quad.y , type , known , y )
+	  and compare( quad.opCode , x , y , taken ) ) {
+	if( taken ) quad = Taco( OP_GOTO , quad.z );
+	else removed[addr] = true;
+	changed = true;
+      }
+      continue;
+    }
+    if( not definesResult( quad ) or scalars.count( quad.z ) == 0 ) continue;
+    if( quad.opCode == OP_COPY and quad.x == quad.z ) {
+      removed[addr] = changed = true;
+      continue;
+    }
+
+    const std::string z = quad.z;
+    DataType type = scalars[z];
+    bool folded = false;
+    switch( quad.opCode ) {
+    case OP_PLUS : case OP_MINUS : case OP_MULT : case OP_DIV : case OP_MOD : {
+      bool xConst = constantOf( quad.x , type , known , x ) , yConst = constantOf( quad.y , type , known , y );
+      if( xConst and yConst ) {
+	folded = fold( quad.opCode , x , y , type , result );
+      } else if( yConst and y.type == type ) { // x + 0 , x - 0 , x * 1 , x / 1
+	bool unit = ( type == MM_INT_TYPE ? y.value.intVal == 1 : type == MM_DOUBLE_TYPE and y.value.doubleVal == 1.0 );
+	bool zero = ( type == MM_INT_TYPE and y.value.intVal == 0 );
+	if( ( zero and ( quad.opCode == OP_PLUS or quad.opCode == OP_MINUS ) )
+	    or ( unit and ( quad.opCode == OP_MULT or quad.opCode == OP_DIV ) ) )
+	  quad = Taco( OP_COPY , z , quad.x ) , changed = true;
+      } else if( xConst and x.type == type ) { // 0 + y , 1 * y
+	bool unit = ( type == MM_INT_TYPE ? x.value.intVal == 1 : type == MM_DOUBLE_TYPE and x.value.doubleVal == 1.0 );
+	bool zero = ( type == MM_INT_TYPE and x.value.intVal == 0 );
+	if( ( zero and quad.opCode == OP_PLUS ) or ( unit and quad.opCode == OP_MULT ) )
+	  quad = Taco( OP_COPY , z , quad.y ) , changed = true;
+      }
+    } break;
+    case OP_UMINUS :
+      if( constantOf( quad.x , type , known , x ) ) folded = fold( quad.opCode , x , x , type , result );
+      break;
+    case OP_CONV_TO_CHAR : case OP_CONV_TO_INT : case OP_CONV_TO_DOUBLE :
+      if( constantOf( quad.x , typeOf( quad.x ) , known , x ) ) folded = convert( quad.opCode , x , result );
+      break;
+    default : break;
+    }
+    if( folded and result.type == type ) {
+      quad = Taco( OP_COPY , z , constantSymbol( result ) );
+      changed = true;
+    }
+
+    // z takes a new value
+    known.erase( z ) ; copies.erase( z );
+    for( auto copy = copies.begin() ; copy != copies.end() ; )
+      if( copy->second == z ) copy = copies.erase( copy ); else ++copy;
+    if( quad.opCode == OP_COPY and quad.x != z ) {
+      auto source = scalars.find( quad.x );
+      if( constantOf( quad.x , type , known , x ) ) {
+	if( x.type == type ) known[z] = x;
+      } else if( source != scalars.end() and source->second == type ) {
+	copies[z] = quad.x;
+      }
+    }
+  }
+  return changed;
+}
+
+/*
+  Removes quads without side effects computing a scalar that is dead
+  afterwards , from a liveness analysis over the basic blocks. Calls to rows
+  and cols count as such. Quads
+  computing constants , which code generation skips anyway , go as well.
+  A copy of a temporary computed by the previous quad and dead after the
+  copy is folded into that quad.
+*/
+bool mm_optimizer::eliminateDeadCode(unsigned int from , unsigned int to) {
+  std::vector<Taco> & QA = mic.quadArray;
+  std::map<std::string,unsigned int> index;
+  for( auto & scalar : scalars ) {
+    unsigned int n = index.size();
+    index[scalar.first] = n;
+  }
+
+  auto pure = [](OpCode opCode) {
+    return ( OP_PLUS <= opCode and opCode <= OP_MOD ) or opCode == OP_UMINUS
+      or ( OP_COPY <= opCode and opCode <= OP_RXC and opCode != OP_L_DEREF and opCode != OP_LXC )
+      or ( OP_CONV_TO_CHAR <= opCode and opCode <= OP_CONV_TO_DOUBLE );
+  };
+
+  typedef std::vector<bool> LiveSet;
+  auto transfer = [&](LiveSet & live , const Taco & quad) {
+    if( definesResult( quad ) ) {
+      auto it = index.find( quad.z );
+      if( it != index.end() ) live[it->second] = false;
+    }
+    std::vector<const std::string *> uses;
+    switch( quad.opCode ) {
+    case OP_PARAM : case OP_RETURN : case OP_DEALLOC : uses = { &quad.z } ; break;
+    case OP_L_DEREF : case OP_LXC : uses = { &quad.z , &quad.x , &quad.y } ; break;
+    case OP_GOTO : case OP_DECLARE : case OP_CALL : case OP_SPAWN : break;
+    default : uses = { &quad.x , &quad.y };
+    }
+    for( const std::string * id : uses ) {
+      auto it = index.find( *id );
+      if( it != index.end() ) live[it->second] = true;
+    }
+  };
+
+  ControlFlowGraph cfg( QA , from , to );
+  unsigned int blocks = cfg.blocks.size();
+  std::vector<LiveSet> liveIn( blocks , LiveSet( index.size() , false ) );
+  for( bool changed = true ; changed ; ) {
+    changed = false;
+    for(unsigned int b = blocks; b-- > 0 ; ) {
+      LiveSet live( index.size() , false );
+      for( unsigned int s : cfg.blocks[b].succ )
+	for(unsigned int v = 0; v < index.size() ; v++ )
+	  if( liveIn[s][v] ) live[v] = true;
+      for(unsigned int addr = cfg.blocks[b].end; addr-- > cfg.blocks[b].start ; ) transfer( live , QA[addr] );
+      if( live != liveIn[b] ) liveIn[b] = live , changed = true;
+    }
+  }
+
+  bool changed = false;
+  for(unsigned int b = 0; b < blocks ; b++ ) {
+    LiveSet live( index.size() , false );
+    for( unsigned int s : cfg.blocks[b].succ )
+      for(unsigned int v = 0; v < index.size() ; v++ )
+	if( liveIn[s][v] ) live[v] = true;
+    for(unsigned int addr = cfg.blocks[b].end; addr-- > cfg.blocks[b].start ; ) {
+      const Taco & quad = QA[addr];
+      if( quad.opCode == OP_COPY and addr > cfg.blocks[b].start and index.count( quad.x ) and not live[ index[quad.x] ] ) {
+	/* t = ... ; v = t , with t dead afterwards : compute v in place. */
+	Taco & prev = QA[addr-1];
+	if( prev.z == quad.x and prev.z != quad.z and definesResult( prev )
+	    and ( pure( prev.opCode ) or prev.opCode == OP_CALL ) and typeOf( quad.z ) == scalars[quad.x] ) {
+	  bool constant = false;
+	  try {
+	    constant = mic.getSymbol( mic.lookup( quad.z ) ).symType == SymbolType::CONST;
+	  } catch( int ) { }
+	  if( not constant ) {
+	    prev.z = quad.z;
+	    removed[addr] = changed = true;
+	    continue;
+	  }
+	}
+      }
+      std::string matrix , offset;
+      if( quad.opCode == OP_CALL and readsDimension( addr , matrix , offset )
+	  and index.count( quad.z ) and not live[ index[quad.z] ] ) {
+	removed[addr] = removed[addr-1] = changed = true; // with its parameter
+	continue;
+      }
+      if( definesResult( quad ) and pure( quad.opCode ) ) {
+	auto it = index.find( quad.z );
+	bool dead = ( it != index.end() and not live[it->second] );
+	if( it == index.end() ) {
+	  try {
+	    dead = mic.getSymbol( mic.lookup( quad.z ) ).symType == SymbolType::CONST;
+	  } catch( int ) { }
+	}
+	if( dead ) {
+	  removed[addr] = changed = true;
+	  continue;
+	}
+      }
+      transfer( live , quad );
+    }
+  }
+  return changed;
+}
+
+/*
+  Dominator-based global value numbering over the SSA form. Walking the
+  dominator tree , an expression over value numbers computed by a dominating
+  quad is not recomputed : the quad becomes a copy of the earlier result.
+  When the variable holding that result is assigned elsewhere in the function ,
+  the earlier quad computes into a new temporary copied to that variable. Copies give their source's
+  number , and phis whose arguments all share a number get it as well.
+  Arithmetic , conversions and reads of matrix dimensions , through the
+  header or through rows and cols , are numbered.
+*/
+bool mm_optimizer::numberValues(unsigned int from , unsigned int to) {
+  std::vector<Taco> & QA = mic.quadArray;
+  std::vector<std::string> variables;
+  mm_ssa ssa = buildSSA( from , to , variables );
+  const unsigned int tracked = scalars.size(); // variables numbered below are scalars
+  const ControlFlowGraph & cfg = ssa.cfg;
+  if( cfg.blocks.empty() ) return false;
+  const unsigned int NONE = mm_ssa::NONE;
+
+  std::vector<unsigned int> number( ssa.values.size() );
+  for(unsigned int v = 0; v < number.size() ; v++ ) number[v] = v;
+  std::map<std::string,unsigned int> available; // expression -> value computing it
+  std::vector< std::pair<unsigned int,unsigned int> > redundant; // quad , value it recomputes
+
+  auto key = [&](unsigned int addr , char field , const std::string & id , const DataType & type , std::string & result) -> bool {
+    for( const SSAOperand & use : ssa.uses[addr - from - 1] ) {
+      if( use.field != field ) continue;
+      if( use.value == NONE ) return false;
+      result = ( use.var < tracked ? "v" : "h" ) + std::to_string( number[use.value] );
+      return true;
+    }
+    Symbol constant;
+    std::map<std::string,Symbol> none;
+    if( not constantOf( id , type , none , constant ) ) return false;
+    long long bits = 0;
+    if( constant.type == MM_DOUBLE_TYPE ) memcpy( &bits , &constant.value.doubleVal , sizeof(double) );
+    else if( constant.type == MM_INT_TYPE ) bits = constant.value.intVal;
+    else bits = constant.value.charVal;
+    result = "c" + std::to_string( constant.type.cols ) + ":" + std::to_string( bits );
+    return true;
+  };
+
+  std::function<void(unsigned int)> visit = [&](unsigned int b) {
+    std::vector<std::string> added;
+    for( const SSAPhi & phi : ssa.phis[b] ) {
+      unsigned int same = NONE;
+      for( unsigned int arg : phi.args ) {
+	if( arg == NONE ) continue;
+	if( same == NONE ) same = number[arg];
+	else if( same != number[arg] ) same = phi.value;
+      }
+      if( same != NONE ) number[phi.value] = same;
+    }
+
+    for(unsigned int addr = cfg.blocks[b].start; addr < cfg.blocks[b].end ; addr++ ) {
+      const Taco & quad = QA[addr];
+      const std::vector<SSAOperand> & defs = ssa.defs[addr - from - 1];
+      auto def = std::find_if( defs.begin() , defs.end() , [&](const SSAOperand & d) { return d.var < tracked; } );
+      if( def == defs.end() ) continue;
+      DataType type = scalars[quad.z];
+
+      std::string x , y;
+      if( quad.opCode == OP_COPY ) {
+	if( typeOf( quad.x ) == type and key( addr , 'x' , quad.x , type , x ) and x[0] == 'v' )
+	  number[def->value] = atoi( x.c_str() + 1 );
+	continue;
+      }
+      bool numbered = false , commutative = false;
+      switch( quad.opCode ) {
+      case OP_PLUS : case OP_MULT : case OP_BIT_AND : case OP_BIT_XOR : case OP_BIT_OR :
+	commutative = true;
+      case OP_MINUS : case OP_DIV : case OP_MOD : case OP_SHL : case OP_SHR :
+	numbered = key( addr , 'x' , quad.x , type , x ) and key( addr , 'y' , quad.y , type , y );
+	break;
+      case OP_UMINUS : case OP_BIT_NOT :
+	numbered = key( addr , 'x' , quad.x , type , x );
+	break;
+      case OP_CONV_TO_CHAR : case OP_CONV_TO_INT : case OP_CONV_TO_DOUBLE :
+	numbered = key( addr , 'x' , quad.x , typeOf( quad.x ) , x );
+	y = std::to_string( typeOf( quad.x ).cols );
+	break;
+      default : break;
+      }
+      std::string matrix , offset;
+      OpCode opCode = quad.opCode;
+      if( readsDimension( addr , matrix , offset ) ) {
+	numbered = key( addr , 'x' , matrix , type , x ) and x[0] == 'h';
+	y = offset ; opCode = OP_RXC;
+      }
+      if( not numbered ) continue;
+      if( commutative and y < x ) std::swap( x , y );
+      std::string expression = std::to_string( opCode ) + "," + std::to_string( type.cols ) + "," + x + "," + y;
+      auto it = available.find( expression );
+      if( it != available.end() ) {
+	redundant.emplace_back( addr , it->second );
+	number[def->value] = it->second;
+      } else {
+	available[expression] = def->value;
+	added.push_back( expression );
+      }
+    }
+
+    for( unsigned int c : cfg.blocks[b].children ) visit( c );
+    for( const std::string & expression : added ) available.erase( expression );
+  };
+  visit( 0 );
+  if( redundant.empty() ) return false;
+
+  std::map<unsigned int,unsigned int> definitions; // variable -> number of quads assigning it
+  for( const std::vector<SSAOperand> & defs : ssa.defs )
+    for( const SSAOperand & def : defs ) definitions[def.var]++;
+
+  std::map<unsigned int,std::string> saved; // address -> temporary saving its result
+  for( auto & entry : redundant ) {
+    unsigned int addr = entry.first;
+    const SSAValue & leader = ssa.values[entry.second];
+    std::string source = variables[leader.var];
+    if( definitions[leader.var] > 1 ) {
+      auto it = saved.find( leader.site );
+      if( it == saved.end() ) {
+	DataType type = scalars[source];
+	std::string temp = mic.getSymbol( mic.genTemp( rootId , type ) ).id;
+	scalars[temp] = type;
+	QA[leader.site].z = temp;
+	inserted[leader.site].push_back( Taco( OP_COPY , source , temp ) );
+	it = saved.emplace( leader.site , temp ).first;
+      }
+      source = it->second;
+    }
+    if( QA[addr].opCode == OP_CALL ) removed[addr-1] = true; // its parameter
+    if( source == QA[addr].z ) removed[addr] = true;
+    else QA[addr] = Taco( OP_COPY , QA[addr].z , source );
+  }
+  return true;
+}
+
+/* Address after which code entering a loop goes : the end of its preheader ,
+   before the goto closing it if any. Returns false if there is no such place. */
+bool mm_optimizer::preheaderEnd(const ControlFlowGraph & cfg , const NaturalLoop & loop , unsigned int & addr) {
+  if( loop.preheader < 0 ) return false;
+  const BasicBlock & preheader = cfg.blocks[loop.preheader];
+  addr = preheader.end - 1;
+  if( not mic.quadArray[addr].isJump() ) return true;
+  if( mic.quadArray[addr].opCode != OP_GOTO or addr == preheader.start ) return false;
+  addr--;
+  return true;
+}
+
+/*
+  Loop-invariant code motion. A quad of a loop computing a value out of
+  constants , of values defined before the loop and of values hoisted
+  already is computed once , into a new temporary in the preheader , and
+  becomes a copy of it. Arithmetic , conversions , reads of matrix
+  dimensions and calls to rows and cols move. Int division stays , as it
+  may fault on an iteration that never runs. Loops are visited innermost
+  first , so code climbs one loop of a nest per run.
+*/
+bool mm_optimizer::hoistInvariants(unsigned int from , unsigned int to) {
+  std::vector<Taco> & QA = mic.quadArray;
+  std::vector<std::string> variables;
+  mm_ssa ssa = buildSSA( from , to , variables );
+  const unsigned int tracked = scalars.size(); // variables numbered below are scalars
+  const ControlFlowGraph & cfg = ssa.cfg;
+  const unsigned int NONE = mm_ssa::NONE;
+  std::vector<NaturalLoop> loops = cfg.findLoops();
+  if( loops.empty() ) return false;
+
+  auto useOf = [&](unsigned int addr , char field) -> unsigned int {
+    for( const SSAOperand & use : ssa.uses[addr - from - 1] )
+      if( use.field == field ) return use.value;
+    return NONE;
+  };
+  auto defOf = [&](unsigned int addr) -> unsigned int {
+    for( const SSAOperand & def : ssa.defs[addr - from - 1] )
+      if( def.var < tracked ) return def.value;
+    return NONE;
+  };
+
+  std::vector<bool> modified( cfg.blocks.size() , false );
+  bool changed = false;
+  for( const NaturalLoop & loop : loops ) {
+    unsigned int insertion;
+    if( not preheaderEnd( cfg , loop , insertion ) or modified[loop.preheader] ) continue;
+    if( std::any_of( loop.blocks.begin() , loop.blocks.end() , [&](unsigned int b) { return modified[b]; } ) )
+      continue;
+    std::vector<bool> inLoop( cfg.blocks.size() , false );
+    for( unsigned int b : loop.blocks ) inLoop[b] = true;
+    auto inside = [&](unsigned int value) -> bool {
+      const SSAValue & def = ssa.values[value];
+      if( def.kind == SSAValue::ENTRY ) return false;
+      return inLoop[ def.kind == SSAValue::PHI ? def.site : cfg.blockOf( def.site ) ];
+    };
+
+    std::map<unsigned int,bool> invariants;
+    std::function<bool(unsigned int)> invariant = [&](unsigned int value) -> bool {
+      if( value == NONE ) return false;
+      if( not inside( value ) ) return true;
+      auto it = invariants.find( value );
+      if( it != invariants.end() ) return it->second;
+      invariants[value] = false;
+      if( ssa.values[value].kind != SSAValue::QUAD ) return false;
+      unsigned int addr = ssa.values[value].site;
+      const Taco & quad = QA[addr];
+      DataType type = scalars[quad.z];
+      std::map<std::string,Symbol> none;
+      Symbol constant;
+      auto operand = [&](char field , const std::string & id) -> bool {
+	unsigned int v = useOf( addr , field );
+	return v != NONE ? invariant( v ) : constantOf( id , typeOf( id ) , none , constant );
+      };
+      std::string matrix , offset;
+      bool result = false;
+      if( readsDimension( addr , matrix , offset ) ) {
+	/* The header must be there even if the loop never runs : set before
+	   the loop , or that of a parameter. */
+	unsigned int dims = useOf( addr , 'x' );
+	if( dims != NONE and not inside( dims ) ) {
+	  const SSAValue & def = ssa.values[dims];
+	  if( def.kind == SSAValue::ENTRY )
+	    result = mic.getSymbol( mic.lookup( matrix ) ).symType == SymbolType::PARAM;
+	  else
+	    result = not ( def.kind == SSAValue::QUAD and QA[def.site].opCode == OP_DEALLOC );
+	}
+      } else {
+	switch( quad.opCode ) {
+	case OP_DIV : case OP_MOD :
+	  if( type != MM_DOUBLE_TYPE ) break;
+	case OP_PLUS : case OP_MINUS : case OP_MULT :
+	case OP_BIT_AND : case OP_BIT_XOR : case OP_BIT_OR : case OP_SHL : case OP_SHR :
+	  result = operand( 'x' , quad.x ) and operand( 'y' , quad.y );
+	  break;
+	case OP_UMINUS : case OP_BIT_NOT : case OP_CONV_TO_CHAR : case OP_CONV_TO_INT : case OP_CONV_TO_DOUBLE :
+	  result = operand( 'x' , quad.x );
+	  break;
+	default : break;
+	}
+      }
+      return invariants[value] = result;
+    };
+
+    std::map<unsigned int,std::string> hoisted;
+    std::function<std::string(unsigned int)> hoist = [&](unsigned int value) -> std::string {
+      if( not inside( value ) ) return variables[ ssa.values[value].var ];
+      auto it = hoisted.find( value );
+      if( it != hoisted.end() ) return it->second;
+      unsigned int addr = ssa.values[value].site;
+      const Taco & quad = QA[addr];
+      std::string x = quad.x , y = quad.y;
+      unsigned int v = useOf( addr , 'x' );
+      if( v != NONE and ssa.values[v].var < tracked ) x = hoist( v );
+      v = useOf( addr , 'y' );
+      if( v != NONE and ssa.values[v].var < tracked ) y = hoist( v );
+      DataType type = scalars[quad.z];
+      std::string temp = mic.getSymbol( mic.genTemp( rootId , type ) ).id;
+      scalars[temp] = type;
+      if( quad.opCode == OP_CALL ) inserted[insertion].push_back( QA[addr-1] );
+      inserted[insertion].push_back( Taco( quad.opCode , temp , x , y ) );
+      return hoisted[value] = temp;
+    };
+
+    std::vector<unsigned int> moved;
+    for( unsigned int b : loop.blocks )
+      for(unsigned int addr = cfg.blocks[b].start; addr < cfg.blocks[b].end ; addr++ ) {
+	unsigned int value = defOf( addr );
+	if( value != NONE and QA[addr].opCode != OP_COPY and invariant( value ) ) {
+	  hoist( value );
+	  moved.push_back( value );
+	}
+      }
+    if( moved.empty() ) continue;
+    for( unsigned int value : moved ) {
+      unsigned int addr = ssa.values[value].site;
+      if( QA[addr].opCode == OP_CALL ) removed[addr-1] = true; // its parameter
+      QA[addr] = Taco( OP_COPY , QA[addr].z , hoisted[value] );
+    }
+    for( unsigned int b : loop.blocks ) modified[b] = true;
+    modified[loop.preheader] = true;
+    changed = true;
+  }
+  return changed;
+}
+
+/*
+  Strength reduction of induction variables. In a loop with a preheader , a
+  basic induction variable is an int incremented by a constant once every
+  iteration. An int computed from one by adding loop invariants and
+  multiplying by constants is a linear function a * j + b of it , as is the
+  offset (i*cols+j)*8+8 of an element m[i][j] in a loop over j. Such a value
+  is computed once in the preheader , then bumped by a times the step at
+  the end of every iteration ; the multiplies and header reads it replaces
+  are left to dead code elimination. Loops are reduced innermost first , one
+  loop nest per run.
+*/
+bool mm_optimizer::reduceStrength(unsigned int from , unsigned int to) {
+  std::vector<Taco> & QA = mic.quadArray;
+  std::vector<std::string> variables;
+  mm_ssa ssa = buildSSA( from , to , variables );
+  const unsigned int tracked = scalars.size(); // variables numbered below are scalars
+  const ControlFlowGraph & cfg = ssa.cfg;
+  const unsigned int NONE = mm_ssa::NONE;
+  std::vector<NaturalLoop> loops = cfg.findLoops();
+  if( loops.empty() ) return false;
+
+  // value read by a field of the quad at addr , or NONE
+  auto useOf = [&](unsigned int addr , char field) -> unsigned int {
+    for( const SSAOperand & use : ssa.uses[addr - from - 1] )
+      if( use.field == field ) return use.value;
+    return NONE;
+  };
+  // scalar value defined by the quad at addr , or NONE
+  auto defOf = [&](unsigned int addr) -> unsigned int {
+    for( const SSAOperand & def : ssa.defs[addr - from - 1] )
+      if( def.var < tracked ) return def.value;
+    return NONE;
+  };
+  std::vector< std::vector<unsigned int> > quadUsers( ssa.values.size() );
+  std::vector<bool> phiUsed( ssa.values.size() , false );
+  for(unsigned int addr = from + 1; addr < to ; addr++ )
+    for( const SSAOperand & use : ssa.uses[addr - from - 1] )
+      if( use.value != NONE ) quadUsers[use.value].push_back( addr );
+  for( const std::vector<SSAPhi> & phis : ssa.phis )
+    for( const SSAPhi & phi : phis )
+      for( unsigned int arg : phi.args )
+	if( arg != NONE ) phiUsed[arg] = true;
+
+  std::vector<bool> modified( cfg.blocks.size() , false );
+  bool changed = false;
+  for( const NaturalLoop & loop : loops ) {
+    unsigned int insertion;
+    if( not preheaderEnd( cfg , loop , insertion ) or modified[loop.preheader] ) continue;
+    if( std::any_of( loop.blocks.begin() , loop.blocks.end() , [&](unsigned int b) { return modified[b]; } ) )
+      continue;
+
+    std::vector<bool> inLoop( cfg.blocks.size() , false );
+    for( unsigned int b : loop.blocks ) inLoop[b] = true;
+    auto inside = [&](unsigned int value) -> bool {
+      const SSAValue & def = ssa.values[value];
+      if( def.kind == SSAValue::ENTRY ) return false;
+      return inLoop[ def.kind == SSAValue::PHI ? def.site : cfg.blockOf( def.site ) ];
+    };
+
+    // Basic induction variables : value at the header -> increment and step.
+    std::map< unsigned int , std::pair<unsigned int,int> > basic;
+    std::map<std::string,Symbol> none;
+    for( const SSAPhi & phi : ssa.phis[loop.header] ) {
+      if( phi.var >= tracked or scalars[ variables[phi.var] ] != MM_INT_TYPE ) continue;
+      const std::vector<unsigned int> & pred = cfg.blocks[loop.header].pred;
+      unsigned int next = NONE;
+      bool unique = true;
+      for(unsigned int j = 0; j < pred.size() ; j++ ) {
+	if( not inLoop[pred[j]] ) continue;
+	if( next == NONE ) next = phi.args[j];
+	else if( next != phi.args[j] ) unique = false;
+      }
+      if( not unique or next == NONE or ssa.values[next].kind != SSAValue::QUAD ) continue;
+      unsigned int inc = ssa.values[next].site;
+      const Taco & quad = QA[inc];
+      Symbol step;
+      if( quad.opCode == OP_PLUS and useOf( inc , 'x' ) == phi.value and useOf( inc , 'y' ) == NONE
+	  and constantOf( quad.y , MM_INT_TYPE , none , step ) ) ;
+      else if( quad.opCode == OP_PLUS and useOf( inc , 'y' ) == phi.value and useOf( inc , 'x' ) == NONE
+	       and constantOf( quad.x , MM_INT_TYPE , none , step ) ) ;
+      else if( quad.opCode == OP_MINUS and useOf( inc , 'x' ) == phi.value and useOf( inc , 'y' ) == NONE
+	       and constantOf( quad.y , MM_INT_TYPE , none , step ) )
+	step.value.intVal = - (unsigned int) step.value.intVal;
+      else continue;
+      if( step.type != MM_INT_TYPE ) continue;
+      basic[phi.value] = std::make_pair( inc , step.value.intVal );
+    }
+    if( basic.empty() ) continue;
+
+    /* Values invariant in the loop , or linear in a basic induction variable.
+       A form is costly when computing it takes a multiply or a quad that
+       would leave the loop. */
+    enum { NEITHER , INVARIANT , LINEAR };
+    struct Form { int kind ; unsigned int iv ; unsigned int a ; bool costly; };
+    std::map<unsigned int,Form> forms;
+    std::function<Form(unsigned int)> formOf = [&](unsigned int value) -> Form {
+      auto it = forms.find( value );
+      if( it != forms.end() ) return it->second;
+      Form form = { NEITHER , NONE , 0 , false };
+      forms[value] = form; // through phis of inner loops
+      if( not inside( value ) ) {
+	form.kind = INVARIANT;
+      } else if( basic.count( value ) ) {
+	form = { LINEAR , value , 1 , false };
+      } else if( ssa.values[value].kind == SSAValue::QUAD ) {
+	unsigned int addr = ssa.values[value].site;
+	const Taco & quad = QA[addr];
+	DataType type = scalars[quad.z];
+	Symbol constant;
+	auto operand = [&](char field , const std::string & id) -> Form {
+	  unsigned int v = useOf( addr , field );
+	  if( v != NONE ) return formOf( v );
+	  Form leaf = { NEITHER , NONE , 0 , false };
+	  if( constantOf( id , type , none , constant ) ) leaf.kind = INVARIANT;
+	  return leaf;
+	};
+	auto factor = [&](char field , const std::string & id , unsigned int & k) -> bool {
+	  if( useOf( addr , field ) != NONE or not constantOf( id , MM_INT_TYPE , none , constant ) ) return false;
+	  k = constant.value.intVal;
+	  return true;
+	};
+	Form x , y;
+	unsigned int k;
+	switch( quad.opCode ) {
+	case OP_COPY :
+	  if( typeOf( quad.x ) == type ) form = operand( 'x' , quad.x );
+	  break;
+	case OP_PLUS : case OP_MINUS : case OP_MULT : case OP_DIV : case OP_MOD :
+	  x = operand( 'x' , quad.x ) , y = operand( 'y' , quad.y );
+	  if( x.kind == INVARIANT and y.kind == INVARIANT ) {
+	    form = { INVARIANT , NONE , 0 , true };
+	  } else if( type != MM_INT_TYPE ) {
+	  } else if( quad.opCode == OP_PLUS or quad.opCode == OP_MINUS ) {
+	    if( x.kind == LINEAR and y.kind == INVARIANT ) form = { LINEAR , x.iv , x.a , x.costly or y.costly };
+	    else if( quad.opCode == OP_PLUS and y.kind == LINEAR and x.kind == INVARIANT )
+	      form = { LINEAR , y.iv , y.a , x.costly or y.costly };
+	  } else if( quad.opCode == OP_MULT ) {
+	    if( x.kind == LINEAR and factor( 'y' , quad.y , k ) ) form = { LINEAR , x.iv , x.a * k , true };
+	    else if( y.kind == LINEAR and factor( 'x' , quad.x , k ) ) form = { LINEAR , y.iv , y.a * k , true };
+	  }
+	  break;
+	case OP_UMINUS : case OP_CONV_TO_CHAR : case OP_CONV_TO_INT : case OP_CONV_TO_DOUBLE :
+	  if( operand( 'x' , quad.x ).kind == INVARIANT ) form = { INVARIANT , NONE , 0 , true };
+	  break;
+	case OP_RXC : case OP_CALL : {
+	  std::string matrix , offset;
+	  if( readsDimension( addr , matrix , offset ) and matrices.count( matrix ) ) {
+	    unsigned int dims = useOf( addr , 'x' );
+	    if( dims != NONE and not inside( dims ) ) form = { INVARIANT , NONE , 0 , true };
+	  }
+	} break;
+	default : break;
+	}
+      }
+      return forms[value] = form;
+    };
+
+    // Linear values read by anything else than another linear value.
+    std::vector<unsigned int> roots;
+    for( unsigned int b : loop.blocks ) {
+      for(unsigned int addr = cfg.blocks[b].start; addr < cfg.blocks[b].end ; addr++ ) {
+	unsigned int value = defOf( addr );
+	if( value == NONE or scalars[QA[addr].z] != MM_INT_TYPE ) continue;
+	Form form = formOf( value );
+	if( form.kind != LINEAR or not form.costly or form.a == 0 ) continue;
+	bool escapes = phiUsed[value];
+	for( unsigned int user : quadUsers[value] ) {
+	  unsigned int result = defOf( user );
+	  if( result == NONE or formOf( result ).kind != LINEAR ) escapes = true;
+	}
+	if( escapes ) roots.push_back( value );
+      }
+    }
+    if( roots.empty() ) continue;
+
+    /* The reduced values are bumped on the latches , before the jump back to
+       the header , so that every root of an iteration , before the increment
+       or after it , reads the value of that iteration. A latch must not go
+       on elsewhere in the loop , as it would bump twice. */
+    bool latched = true;
+    for( unsigned int latch : loop.latches )
+      for( unsigned int succ : cfg.blocks[latch].succ )
+	if( succ != loop.header and inLoop[succ] ) latched = false;
+    if( not latched ) continue;
+
+    // Compute the roots in the preheader , with the induction variables at their initial value.
+    std::map<unsigned int,std::string> emitted;
+    std::function<std::string(unsigned int)> emit = [&](unsigned int value) -> std::string {
+      if( not inside( value ) or basic.count( value ) ) return variables[ ssa.values[value].var ];
+      auto it = emitted.find( value );
+      if( it != emitted.end() ) return it->second;
+      unsigned int addr = ssa.values[value].site;
+      const Taco & quad = QA[addr];
+      std::string x = quad.x , y = quad.y;
+      unsigned int v = useOf( addr , 'x' );
+      if( quad.opCode == OP_COPY ) return emitted[value] = emit( v );
+      if( v != NONE and ssa.values[v].var < tracked ) x = emit( v );
+      v = useOf( addr , 'y' );
+      if( v != NONE and ssa.values[v].var < tracked ) y = emit( v );
+      DataType type = scalars[quad.z];
+      std::string temp = mic.getSymbol( mic.genTemp( rootId , type ) ).id;
+      scalars[temp] = type;
+      if( quad.opCode == OP_CALL ) inserted[insertion].push_back( QA[addr-1] );
+      inserted[insertion].push_back( Taco( quad.opCode , temp , x , y ) );
+      return emitted[value] = temp;
+    };
+    std::set<std::string> bumped;
+    std::vector<Taco> bumps;
+    for( unsigned int root : roots ) {
+      std::string reduced = emit( root );
+      if( not bumped.insert( reduced ).second ) continue; // a copy of another root
+      Form form = formOf( root );
+      Symbol bump;
+      bump.type = MM_INT_TYPE;
+      bump.value.intVal = form.a * (unsigned int) basic[form.iv].second;
+      bumps.push_back( Taco( OP_PLUS , reduced , reduced , constantSymbol( bump ) ) );
+    }
+    for( unsigned int latch : loop.latches ) {
+      unsigned int last = cfg.blocks[latch].end - 1;
+      if( not QA[last].isJump() ) {
+	inserted[last].insert( inserted[last].end() , bumps.begin() , bumps.end() );
+	continue;
+      }
+      // Jumps to the latch's jump land on the bumps.
+      std::vector<Taco> code( bumps );
+      code.push_back( QA[last] );
+      code.insert( code.end() , inserted[last].begin() , inserted[last].end() );
+      removed[last] = true;
+      std::swap( inserted[last] , code );
+    }
+    for( unsigned int root : roots ) {
+      Taco & quad = QA[ ssa.values[root].site ];
+      quad = Taco( OP_COPY , quad.z , emitted[root] );
+    }
+    for( unsigned int b : loop.blocks ) modified[b] = true;
+    modified[loop.preheader] = true;
+    changed = true;
+  }
+  return changed;
+}
+
+/*
+  Threads jumps to gotos through to their final target , turns
+    if x relop y goto L1 ; goto L2 ; L1 :
+  into
+    if x !relop y goto L2 ; L1 :
+  and drops jumps to the next quad.
+*/
+bool mm_optimizer::simplifyJumps(unsigned int from , unsigned int to) {
+  std::vector<Taco> & QA = mic.quadArray;
+  bool changed = false;
+
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    Taco & quad = QA[addr];
+    if( not quad.isJump() ) continue;
+    unsigned int target = atoi( quad.z.c_str() ) , hops = 0;
+    while( from < target and target < to and QA[target].opCode == OP_GOTO
+	   and target != addr and hops++ < to - from )
+      target = atoi( QA[target].z.c_str() );
+    if( std::to_string( target ) != quad.z ) quad.z = std::to_string( target ) , changed = true;
+  }
+
+  std::vector<bool> isTarget( to - from + 1 , false );
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    if( QA[addr].isJump() ) {
+      unsigned int target = atoi( QA[addr].z.c_str() );
+      if( from <= target and target <= to ) isTarget[target - from] = true;
+    }
+  }
+
+  for(unsigned int addr = from + 1; addr + 1 < to ; addr++ ) {
+    Taco & quad = QA[addr];
+    if( not ( OP_LT <= quad.opCode and quad.opCode <= OP_NEQ ) ) continue;
+    if( QA[addr+1].opCode != OP_GOTO or isTarget[addr + 1 - from] ) continue;
+    if( (unsigned int) atoi( quad.z.c_str() ) != addr + 2 ) continue;
+    if( typeOf( quad.x ) == MM_DOUBLE_TYPE ) continue; // unordered compares
+    switch( quad.opCode ) {
+    case OP_LT : quad.opCode = OP_GTE ; break;
+    case OP_LTE : quad.opCode = OP_GT ; break;
+    case OP_GT : quad.opCode = OP_LTE ; break;
+    case OP_GTE : quad.opCode = OP_LT ; break;
+    case OP_EQ : quad.opCode = OP_NEQ ; break;
+    case OP_NEQ : quad.opCode = OP_EQ ; break;
+    default : break;
+    }
+    quad.z = QA[addr+1].z;
+    removed[addr+1] = changed = true;
+  }
+
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    const Taco & quad = QA[addr];
+    if( removed[addr] or not ( quad.opCode == OP_GOTO or ( OP_LT <= quad.opCode and quad.opCode <= OP_NEQ ) ) )
+      continue;
+    unsigned int next = addr + 1;
+    while( next < to and removed[next] ) next++;
+    if( (unsigned int) atoi( quad.z.c_str() ) == next ) removed[addr] = changed = true;
+  }
+  return changed;
+}
+
+/* Removes basic blocks not reachable from the function entry. */
+bool mm_optimizer::removeUnreachableCode(unsigned int from , unsigned int to) {
+  ControlFlowGraph cfg( mic.quadArray , from , to );
+  std::vector<bool> reached( cfg.blocks.size() , false );
+  for( unsigned int b : cfg.order ) reached[b] = true;
+
+  bool changed = false;
+  for(unsigned int b = 0; b < cfg.blocks.size() ; b++ ) {
+    if( reached[b] ) continue;
+    for(unsigned int addr = cfg.blocks[b].start; addr < cfg.blocks[b].end ; addr++ ) removed[addr] = true;
+    changed = true;
+  }
+  return changed;
+}
+
+bool mm_optimizer::isElementwise(const Taco & quad) {
+  if( not typeOf( quad.z ).isMatrix() or not typeOf( quad.x ).isMatrix() ) return false;
+  switch( quad.opCode ) {
+  case OP_PLUS : case OP_MINUS : return typeOf( quad.y ).isMatrix();
+  case OP_MULT : case OP_DIV : return not quad.y.empty() and not typeOf( quad.y ).isMatrix();
+  case OP_UMINUS : return true;
+  default : return false;
+  }
+}
+
+bool mm_optimizer::isFusedAway(const std::string & id , unsigned int first , unsigned int last) {
+  const std::vector<Taco> & QA = mic.quadArray;
+  return isElementwise( QA[first] ) and isElementwise( QA[last] ) and QA[last].z != id;
+}
+
+/*
+  Escape analysis of matrix temporaries , keeping those that never leave
+  their function in its frame instead of on the heap. A temporary escapes
+  if it is returned , passed to a spawned call or to a function neither
+  defined in the quad array nor one of the readers of the standard library ,
+  or used by any quad but its allocation and deallocation , matrix
+  arithmetic , copies , moves and element accesses : one moved into another
+  matrix is copied instead when kept in the frame. A temporary whose
+  allocation gives it a static shape of at most STACK_ELEMENTS elements
+  becomes a static matrix : the allocation turns into writes of its header , and the
+  deallocation goes. One of dynamic shape gets SCRATCH_ELEMENTS elements of
+  scratch storage in the frame , taken whenever its shape fits ( see
+  mm_scratch ). Intermediates of element-wise chains need neither. At most
+  FRAME_BUDGET bytes of the frame go to temporaries.
+*/
+bool mm_optimizer::placeTemporaries(unsigned int from , unsigned int to) {
+  std::vector<Taco> & QA = mic.quadArray;
+  static const std::set<std::string> readers = { "rows" , "cols" , "printMat" , "saveMat" };
+
+  struct Sites {
+    std::vector<unsigned int> allocs , uses , deallocs; // addresses , increasing
+    bool escapes;
+    Sites() : escapes(false) { }
+  };
+  std::map<std::string,Sites> temporaries;
+  for( const std::string & id : matrices )
+    if( mic.isTemporary( mic.lookup( id ) ) ) temporaries[id];
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    const Taco & quad = QA[addr];
+    for( const std::string * id : { &quad.z , &quad.x , &quad.y } ) {
+      auto it = temporaries.find( *id );
+      if( it == temporaries.end() or ( quad.isJump() and id == &quad.z ) ) continue;
+      Sites & sites = it->second;
+      bool local = false;
+      switch( quad.opCode ) {
+      case OP_ALLOC :
+	if( id == &quad.z ) {
+	  sites.allocs.push_back( addr );
+	  continue;
+	}
+	local = true; // shape read
+	break;
+      case OP_DEALLOC :
+	sites.deallocs.push_back( addr );
+	continue;
+      case OP_PLUS : case OP_MINUS : case OP_UMINUS : case OP_MULT : case OP_DIV :
+      case OP_MULT_NT : case OP_MULT_TN : case OP_TRANSPOSE :
+      case OP_COPY : case OP_MOVE : case OP_RXC : case OP_LXC :
+	local = true;
+	break;
+      case OP_PARAM : {
+	unsigned int call = addr;
+	while( call < to and QA[call].opCode == OP_PARAM ) call++;
+	local = QA[call].opCode == OP_CALL and ( functions.count( QA[call].x ) or readers.count( QA[call].x ) );
+	break;
+      }
+      default : break;
+      }
+      if( not local ) sites.escapes = true;
+      if( sites.uses.empty() or sites.uses.back() != addr ) sites.uses.push_back( addr );
+    }
+  }
+
+  // By allocation , so that a temporary the shape is read off is placed first.
+  std::vector<std::string> order;
+  for( const auto & entry : temporaries ) {
+    const Sites & sites = entry.second;
+    if( not sites.escapes and sites.allocs.size() == 1 and not sites.uses.empty()
+	and sites.allocs[0] < sites.uses[0]
+	and not isFusedAway( entry.first , sites.uses.front() , sites.uses.back() ) )
+      order.push_back( entry.first );
+  }
+  std::sort( order.begin() , order.end() , [&](const std::string & a , const std::string & b) {
+      return temporaries[a].allocs[0] < temporaries[b].allocs[0];
+    } );
+
+  unsigned int budget = FRAME_BUDGET;
+  bool changed = false;
+  for( const std::string & id : order ) {
+    const Sites & sites = temporaries[id];
+    unsigned int addr = sites.allocs[0];
+    const Taco & alloc = QA[addr];
+    DataType x = typeOf( alloc.x ) , y = typeOf( alloc.y );
+    std::map<std::string,Symbol> none;
+    Symbol rows , cols;
+    rows.type = cols.type = MM_INT_TYPE;
+    rows.value.intVal = cols.value.intVal = 0;
+    if( alloc.y.empty() ) { // z = alloc( Matrix )
+      if( x.isStaticMatrix() ) rows.value.intVal = x.rows , cols.value.intVal = x.cols;
+    } else if( alloc.x.empty() ) { // z = alloc( Matrix.' )
+      if( y.isStaticMatrix() ) rows.value.intVal = y.cols , cols.value.intVal = y.rows;
+    } else if( x.isMatrix() ) { // z = alloc( Matrix , Matrix )
+      if( x.isStaticMatrix() and y.isStaticMatrix() ) rows.value.intVal = x.rows , cols.value.intVal = y.cols;
+    } else if( not constantOf( alloc.x , MM_INT_TYPE , none , rows ) or not constantOf( alloc.y , MM_INT_TYPE , none , cols ) ) {
+      rows.value.intVal = cols.value.intVal = 0;
+    }
+
+    DataType type = MM_MATRIX_TYPE;
+    if( rows.value.intVal > 0 and cols.value.intVal > 0 ) {
+      type.rows = rows.value.intVal , type.cols = cols.value.intVal;
+      if( type.rows * type.cols > STACK_ELEMENTS or type.getSize() > budget ) continue;
+      mic.getSymbol( mic.lookup( id ) ).type = type;
+      matrices.erase( id );
+      removed[addr] = true;
+      inserted[addr].push_back( Taco( OP_LXC , id , "0" , constantSymbol( rows ) ) );
+      inserted[addr].push_back( Taco( OP_LXC , id , "4" , constantSymbol( cols ) ) );
+      inserted[addr].push_back( Taco( OP_LXC , id , std::to_string( MATRIX_LD ) , constantSymbol( cols ) ) );
+      for( unsigned int dealloc : sites.deallocs ) removed[dealloc] = true;
+    } else {
+      type.rows = 1 , type.cols = SCRATCH_ELEMENTS;
+      if( type.getSize() > budget ) continue;
+      mic.scratch[id] = mic.getSymbol( mic.genTemp( rootId , type ) ).id;
+    }
+    budget -= type.getSize();
+    changed = true;
+  }
+  return changed;
+}
+
+/*
+  Buffer assignment for matrix temporaries , run once the other passes are
+  done. Candidates are the temporaries allocated once and deallocated once ,
+  but for intermediates of element-wise chains and those moved into another
+  matrix , which keeps their storage. Inside a basic
+  block , a temporary allocated after the last use of another takes over its
+  buffer. The deallocation of a temporary used only inside a loop then moves
+  to the exits of the outermost such loop , so that its buffer lasts from one
+  iteration to the next , and its allocation moves to the preheader if the
+  shape it is given stays the same throughout the loop. Allocations of
+  temporaries left in a loop resize the buffer in place , replacing it only
+  when it is too small.
+*/
+bool mm_optimizer::assignBuffers(unsigned int from , unsigned int to) {
+  std::vector<Taco> & QA = mic.quadArray;
+  struct Buffer {
+    std::vector<unsigned int> allocs , uses , deallocs; // addresses , increasing
+  };
+  std::map<std::string,Buffer> buffers;
+  std::set<std::string> excluded;
+  for( const std::string & id : matrices )
+    if( mic.isTemporary( mic.lookup( id ) ) ) buffers[id];
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    const Taco & quad = QA[addr];
+    if( quad.opCode == OP_SPAWN ) // the spawned call may read its matrices after the spawn
+      for(unsigned int param = addr - 1; param > from and QA[param].opCode == OP_PARAM ; param-- )
+	excluded.insert( QA[param].z );
+    if( quad.opCode == OP_CALL and quad.x == "mm_slice" ) { // the matrix is its first parameter
+      unsigned int first = addr;
+      while( first - 1 > from and QA[first - 1].opCode == OP_PARAM ) first--;
+      if( first < addr ) excluded.insert( QA[first].z ); // viewed by the slice for as long as it lives
+    }
+    if( quad.opCode == OP_MOVE )
+      excluded.insert( quad.x ); // its storage passes to the destination
+    for( const std::string * id : { &quad.z , &quad.x , &quad.y } ) {
+      auto it = buffers.find( *id );
+      if( it == buffers.end() or ( quad.isJump() and id == &quad.z ) ) continue;
+      Buffer & buffer = it->second;
+      if( quad.opCode == OP_ALLOC and id == &quad.z ) buffer.allocs.push_back( addr );
+      else if( quad.opCode == OP_DEALLOC ) buffer.deallocs.push_back( addr );
+      else if( quad.opCode == OP_CALL and id == &quad.z ) excluded.insert( *id ); // storage of the callee
+      else if( buffer.uses.empty() or buffer.uses.back() != addr ) buffer.uses.push_back( addr );
+    }
+  }
+  for( auto it = buffers.begin() ; it != buffers.end() ; ) {
+    const Buffer & buffer = it->second;
+    bool candidate = not excluded.count( it->first ) and buffer.allocs.size() == 1
+      and buffer.deallocs.size() == 1 and not buffer.uses.empty()
+      and buffer.allocs[0] < buffer.uses[0] and buffer.uses.back() < buffer.deallocs[0]
+      and not isFusedAway( it->first , buffer.uses.front() , buffer.uses.back() );
+    if( candidate ) ++it;
+    else it = buffers.erase( it );
+  }
+  if( buffers.empty() ) return false;
+
+  ControlFlowGraph cfg( QA , from , to );
+  bool changed = false;
+  for( const BasicBlock & block : cfg.blocks ) {
+    std::vector<std::string> local; // temporaries living in the block , by allocation
+    for( const auto & entry : buffers )
+      if( block.start <= entry.second.allocs[0] and entry.second.uses.back() < block.end )
+	local.push_back( entry.first );
+    std::sort( local.begin() , local.end() , [&](const std::string & a , const std::string & b) {
+	return buffers[a].allocs[0] < buffers[b].allocs[0];
+      } );
+    std::vector<std::string> owners;
+    for( const std::string & id : local ) {
+      Buffer & buffer = buffers[id];
+      auto owner = std::find_if( owners.begin() , owners.end() , [&](const std::string & other) {
+	  return buffers[other].uses.back() < buffer.allocs[0];
+	} );
+      if( owner == owners.end() ) {
+	owners.push_back( id );
+	continue;
+      }
+      Buffer & shared = buffers[*owner];
+      for( const std::vector<unsigned int> * sites : { &buffer.allocs , &buffer.uses , &buffer.deallocs } )
+	for( unsigned int addr : *sites )
+	  for( std::string * field : { &QA[addr].z , &QA[addr].x , &QA[addr].y } )
+	    if( *field == id ) *field = *owner;
+      auto scratch = mic.scratch.find( id );
+      if( scratch != mic.scratch.end() ) { // now unused
+	mic.getSymbol( mic.lookup( scratch->second ) ).type = MM_VOID_TYPE;
+	mic.scratch.erase( scratch );
+      }
+      // The later deallocation follows the uses of both.
+      if( buffer.deallocs[0] > shared.deallocs[0] ) std::swap( buffer.deallocs , shared.deallocs );
+      removed[ buffer.deallocs[0] ] = true;
+      shared.allocs.push_back( buffer.allocs[0] );
+      shared.uses.insert( shared.uses.end() , buffer.uses.begin() , buffer.uses.end() );
+      buffers.erase( id );
+      changed = true;
+    }
+  }
+
+  cfg.computeDominators();
+  std::vector<NaturalLoop> loops = cfg.findLoops();
+  auto contains = [&](const NaturalLoop & loop , unsigned int addr) {
+    return std::binary_search( loop.blocks.begin() , loop.blocks.end() , cfg.blockOf( addr ) );
+  };
+  /* The shape an allocation reads off an operand is the same on every
+     iteration , and there before the loop , if the operand is not set in
+     the loop. Copies between matrices of different shapes abort , so only
+     allocations , calls and the header writes declaring a static matrix
+     set the shape of a matrix. */
+  auto invariant = [&](const NaturalLoop & loop , const std::string & id) -> bool {
+    if( id.empty() ) return true;
+    Symbol symbol;
+    try {
+      symbol = mic.getSymbol( mic.lookup( id ) );
+    } catch( int ) {
+      return false;
+    }
+    if( symbol.symType == SymbolType::CONST ) return true;
+    bool matrix = symbol.type.isMatrix();
+    if( matrix ? symbol.type == MM_MATRIX_TYPE and not matrices.count( id ) : not scalars.count( id ) )
+      return false;
+    for( unsigned int b : loop.blocks )
+      for(unsigned int addr = cfg.blocks[b].start; addr < cfg.blocks[b].end ; addr++ ) {
+	const Taco & quad = QA[addr];
+	if( quad.z != id or quad.isJump() ) continue;
+	if( matrix ? quad.opCode == OP_ALLOC or quad.opCode == OP_DEALLOC or quad.opCode == OP_CALL
+	    or ( quad.opCode == OP_LXC and isHeaderOffset( quad.x ) ) : definesResult( quad ) )
+	  return false;
+      }
+    return true;
+  };
+
+  std::map< unsigned int , std::vector<std::string> > exits; // address -> deallocations moved before it
+  for( const auto & entry : buffers ) {
+    const Buffer & buffer = entry.second;
+    const NaturalLoop * outer = NULL;
+    for( const NaturalLoop & loop : loops ) {
+      bool inside = contains( loop , buffer.deallocs[0] );
+      for( const std::vector<unsigned int> * sites : { &buffer.allocs , &buffer.uses } )
+	for( unsigned int addr : *sites ) inside = inside and contains( loop , addr );
+      if( inside and ( outer == NULL or loop.blocks.size() > outer->blocks.size() ) ) outer = &loop;
+    }
+    if( outer == NULL ) continue;
+
+    removed[ buffer.deallocs[0] ] = true;
+    for( unsigned int b : outer->blocks )
+      for( unsigned int succ : cfg.blocks[b].succ ) {
+	if( std::binary_search( outer->blocks.begin() , outer->blocks.end() , succ ) ) continue;
+	std::vector<std::string> & moved = exits[ cfg.blocks[succ].start ];
+	if( std::find( moved.begin() , moved.end() , entry.first ) == moved.end() ) moved.push_back( entry.first );
+      }
+
+    unsigned int insertion , alloc = buffer.allocs[0];
+    if( buffer.allocs.size() == 1 and preheaderEnd( cfg , *outer , insertion )
+	and invariant( *outer , QA[alloc].x ) and invariant( *outer , QA[alloc].y ) ) {
+      inserted[insertion].push_back( QA[alloc] );
+      removed[alloc] = true;
+    }
+    changed = true;
+  }
+
+  /* Deallocations go before the first quad of an exit , so that jumps
+     leaving the loop reach them. The temporary is dead wherever else the
+     exit is entered from , and its storage either gone already or its own. */
+  for( auto & exit : exits ) {
+    unsigned int addr = exit.first;
+    std::vector<Taco> code;
+    for( const std::string & id : exit.second ) code.push_back( Taco( OP_DEALLOC , id ) );
+    if( not removed[addr] ) code.push_back( QA[addr] );
+    code.insert( code.end() , inserted[addr].begin() , inserted[addr].end() );
+    removed[addr] = true;
+    std::swap( inserted[addr] , code );
+  }
+  return changed;
+}
+
+void mm_optimizer::compact(unsigned int & from , unsigned int & to) {
+  std::vector<Taco> & QA = mic.quadArray;
+  if( std::find( removed.begin() , removed.end() , true ) == removed.end()
+      and std::all_of( inserted.begin() , inserted.end() , [](const std::vector<Taco> & quads) { return quads.empty(); } ) )
+    return;
+
+  // newAddr[addr] : address of the first quad kept or inserted at or after addr
+  std::vector<unsigned int> newAddr( QA.size() + 1 );
+  std::vector<Taco> code;
+  for(unsigned int addr = 0; addr < QA.size() ; addr++ ) {
+    newAddr[addr] = code.size();
+    if( not removed[addr] ) code.push_back( QA[addr] );
+    code.insert( code.end() , inserted[addr].begin() , inserted[addr].end() );
+  }
+  newAddr[QA.size()] = code.size();
+  for( Taco & quad : code )
+    if( quad.isJump() ) quad.z = std::to_string( newAddr[ atoi( quad.z.c_str() ) ] );
+
+  std::swap( QA , code );
+  removed.assign( QA.size() , false );
+  inserted.assign( QA.size() , std::vector<Taco>() );
+  for( const Taco & quad : QA )
+    if( quad.opCode == OP_FUNC_START ) functions.insert( quad.z );
+  from = newAddr[from] ; to = newAddr[to];
+}
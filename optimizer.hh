@@ -0,0 +1,113 @@
+#ifndef MM_OPTIMIZER_H
+#define MM_OPTIMIZER_H
+
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include "translator.hh"
+#include "ssa.hh"
+
+/**
+   Machine independant optimizer over the quad array , run function by
+   function between translation and code generation :
+     - sparse conditional constant propagation over the SSA form of the function ,
+     - constant folding and propagation , and copy propagation , inside basic blocks ,
+     - elimination of quads computing dead scalars ,
+     - global value numbering over the SSA form , replacing recomputations
+       of a value by copies ,
+     - loop-invariant code motion into loop preheaders ,
+     - strength reduction of ints linear in a loop's induction variables ,
+       such as the offsets of matrix elements ,
+     - jump threading and removal of unreachable blocks ,
+     - and last , placement in the frame of matrix temporaries that do not
+       escape the function , and assignment of buffers to the others , sharing
+       them between temporaries whose lives do not overlap and keeping them
+       from one iteration of a loop to the next.
+   Removed quads are erased from the quad array , inserted ones added , and
+   jump targets repatched. Constants met while folding , and temporaries
+   holding values numbered , are added to the function's symbol table.
+*/
+class mm_optimizer {
+public:
+
+  mm_optimizer(mm_translator &);
+  virtual ~mm_optimizer();
+
+  /* Reference to machine independant code and data. */
+  mm_translator & mic;
+
+  /* Optimize every function of the quad array. */
+  void optimize();
+
+  /* Bounds on the frame space given to matrix temporaries : elements of a
+     temporary of static shape , elements of scratch storage for one of
+     dynamic shape , and bytes per function. */
+  static const unsigned int STACK_ELEMENTS = 256 , SCRATCH_ELEMENTS = 64 , FRAME_BUDGET = 32768;
+
+private:
+  /* Symbol table of the function being optimized. */
+  unsigned int rootId;
+
+  /* Scalars of the function whose value is known only through its quads :
+     char , int , double and pointer locals , parameters and temporaries
+     whose address is never taken. */
+  std::map< std::string , DataType > scalars;
+
+  /* Dynamic matrices of the function whose address is never taken. */
+  std::set< std::string > matrices;
+
+  /* Functions defined in the quad array , which may shadow the standard library. */
+  std::set< std::string > functions;
+
+  /* Constant symbols created for the function , by type and value. */
+  std::map< std::pair< unsigned int , long long > , std::string > constants;
+
+  /* Quads to erase , and quads to insert after a given address , at the next compaction. */
+  std::vector< bool > removed;
+  std::vector< std::vector< Taco > > inserted;
+
+  void collectScalars(unsigned int,unsigned int);
+  void dft(unsigned int);
+
+  /* Passes over the function in [from,to]. Each returns wether it changed anything. */
+  bool propagateConditionalConstants(unsigned int,unsigned int);
+  bool propagateConstants(unsigned int,unsigned int);
+  bool eliminateDeadCode(unsigned int,unsigned int);
+  bool numberValues(unsigned int,unsigned int);
+  bool hoistInvariants(unsigned int,unsigned int);
+  bool reduceStrength(unsigned int,unsigned int);
+  bool simplifyJumps(unsigned int,unsigned int);
+  bool removeUnreachableCode(unsigned int,unsigned int);
+  bool placeTemporaries(unsigned int,unsigned int);
+  bool assignBuffers(unsigned int,unsigned int);
+
+  /* Erase removed quads , add inserted ones and repatch jumps , moving [from,to] along. */
+  void compact(unsigned int &,unsigned int &);
+
+  /* SSA form of the function over its scalars , followed by one variable
+     per matrix for its header : dimensions read by OP_RXC at offsets 0 and 4.
+     Fills in the name of every variable. */
+  mm_ssa buildSSA(unsigned int,unsigned int,std::vector<std::string> &);
+
+  /* Address after which code is inserted to run before a loop. */
+  bool preheaderEnd(const ControlFlowGraph &,const NaturalLoop &,unsigned int &);
+
+  // type of an operand : literals are ints
+  DataType typeOf(const std::string &);
+  // value of an operand of given type , if it is a constant or a literal
+  bool constantOf(const std::string &,const DataType &,const std::map<std::string,Symbol> &,Symbol &);
+  // id of a constant symbol holding given value
+  std::string constantSymbol(const Symbol &);
+  // returns wether quad writes its z operand
+  static bool definesResult(const Taco &);
+  // returns wether the quad at an address reads a matrix dimension , which matrix and at which offset
+  bool readsDimension(unsigned int,std::string &,std::string &);
+  // returns wether quad is an element-wise matrix operation , as loop fusion sees it
+  bool isElementwise(const Taco &);
+  // returns wether a temporary , first and last used at given addresses , is an
+  // intermediate of an element-wise chain , which a fused loop keeps in registers
+  bool isFusedAway(const std::string &,unsigned int,unsigned int);
+};
+
+#endif /* ! MM_OPTIMIZER_H */
@@ -29,6 +29,7 @@
 %code {
   /* Include translator definitions completely */
 #include "translator.hh"
+#include "optimizer.hh"
   
   /* Helper functions to get dereferenced symbols for scalars
    * Only used when Expression is known to be non-matrix type. */
@@ -87,7 +88,30 @@
 
   /* Dereference any pointer / matrix element */
   void dereference(mm_translator &,Expression &);
+
+  /* Undo the copy made for a transposed matrix operand , if nothing emitted since uses it.
+     The expression then refers to the untransposed matrix. */
+  bool dropTranspose(mm_translator &,Expression &);
   
+  /* Shape of the result of a matrix operation , static when the shapes of its
+     operands make it so : `+' , `-' and `=' need equal shapes , `*' conforming
+     ones , `\'' transposes the left operand , and any other operation keeps its
+     shape. Static shapes that disagree are reported at compile time. */
+  DataType matrixShape(char ,
+		       DataType ,
+		       DataType ,
+		       yy::mm_parser &,
+		       const yy::location & );
+
+  /* Creates a temporary for the result of a matrix operation of the given shape.
+     One of static shape , of at most mm_optimizer::STACK_ELEMENTS elements ,
+     is a static matrix whose header is written in place ; any other is
+     allocated by the given OP_ALLOC quad , once its result is filled in. */
+  SymbolRef genMatrixTemp(mm_translator & , DataType , Taco );
+
+  /* Constant int temporary */
+  SymbolRef genIntConstant(mm_translator & , int );
+
   /* Emit opcodes to call a function after creating appropriate temporaries. */
   void callFunction(mm_translator &,
 		    yy::mm_parser &,
@@ -122,7 +146,10 @@ MM_ELSE "else"
 MM_DO "do"
 MM_WHILE "while"
 MM_FOR "for"
+MM_PARFOR "parfor"
 MM_RETURN "return"
+MM_SPAWN "spawn"
+MM_SYNC "sync"
 MM_VOID "void"
 MM_CHAR "char"
 MM_INT "int"
@@ -284,13 +311,13 @@ postfix_expression "[" expression "]" "[" expression "]" {
     translator.emit(Taco(OP_MULT,temp.id,rowIndex.id,std::to_string(LHS.type.cols)));
     translator.emit(Taco(OP_PLUS,temp.id,temp.id,colIndex.id));
     translator.emit(Taco(OP_MULT,temp.id,temp.id,std::to_string(SIZE_OF_DOUBLE)));
-    translator.emit(Taco(OP_PLUS,temp.id,temp.id,std::to_string(2*SIZE_OF_INT)));
+    translator.emit(Taco(OP_PLUS,temp.id,temp.id,std::to_string(MATRIX_HEADER)));
 
     if( rowIndex.isConstant and colIndex.isConstant ) {
       temp.isConstant = temp.isInitialized = true;
       temp.value.intVal =
 	(rowIndex.value.intVal * LHS.type.cols + colIndex.value.intVal ) *SIZE_OF_DOUBLE
-	+ 2 * SIZE_OF_INT;
+	+ MATRIX_HEADER;
       temp.symType = SymbolType::CONST;
     }
     
@@ -306,11 +333,11 @@ postfix_expression "[" expression "]" "[" expression "]" {
     if( rowIndex.type != MM_INT_TYPE or colIndex.type != MM_INT_TYPE ) {
       throw syntax_error(@$ , "Non-integral index for matrix " + LHS.id + "." );
     }
-    translator.emit(Taco(OP_RXC,temp.id,LHS.id, std::to_string(SIZE_OF_INT) ));//t = m[4] (# of columns)
+    translator.emit(Taco(OP_RXC,temp.id,LHS.id, std::to_string(MATRIX_LD) ));//t = m[8] (leading dimension)
     translator.emit(Taco(OP_MULT,temp.id,rowIndex.id,temp.id));
     translator.emit(Taco(OP_PLUS,temp.id,temp.id,colIndex.id));
     translator.emit(Taco(OP_MULT,temp.id,temp.id,std::to_string(SIZE_OF_DOUBLE)));
-    translator.emit(Taco(OP_PLUS,temp.id,temp.id,std::to_string(2*SIZE_OF_INT)));
+    translator.emit(Taco(OP_PLUS,temp.id,temp.id,std::to_string(MATRIX_HEADER)));
     $$.auxSymbol = tempRef;
     $$.isReference = true;
   } else {
@@ -318,6 +345,30 @@ postfix_expression "[" expression "]" "[" expression "]" {
   }
 
 } |
+/* Slice : rows [a,b) and columns [c,d) of a matrix , as a view sharing its
+   elements. The runtime checks the bounds and builds the view's header , in
+   place of the one built when the slice was last evaluated. */
+postfix_expression "[" expression ":" expression "]" "[" expression ":" expression "]" {
+  std::swap($$,$1);
+  if( not translator.isMatrixOperand($$) ) {
+    throw syntax_error(@1,"Slice of non-matrix operand.");
+  }
+  std::vector<Expression *> bounds = { &$3 , &$5 , &$8 , &$10 };
+  for( Expression * bound : bounds ) {
+    dereference(translator,*bound);
+    if( translator.getSymbol(bound->symbol).type != MM_INT_TYPE )
+      throw syntax_error(@$ , "Non-integral bound for slice of matrix " + translator.getSymbol($$.symbol).id + "." );
+  }
+  translator.emit(Taco(OP_PARAM,translator.getSymbol($$.symbol).id));
+  for( Expression * bound : bounds )
+    translator.emit(Taco(OP_PARAM,translator.getSymbol(bound->symbol).id));
+  DataType matType = MM_MATRIX_TYPE;
+  SymbolRef retRef = translator.genView(matType);
+  translator.emit(Taco(OP_PARAM,translator.getSymbol(retRef).id));
+  translator.emit(Taco(OP_CALL,translator.getSymbol(retRef).id,"mm_slice",std::to_string(bounds.size()+2)));
+  $$.symbol = retRef;
+  $$.isReference = false;
+} |
 /* Function call */
 postfix_expression "(" optional_argument_list ")" {
   Symbol & fSym = translator.getSymbol($1.symbol);
@@ -396,12 +447,12 @@ postfix_expression inc_dec_op { // inc_dec_op generates ++ or --
 postfix_expression ".'" {
   std::swap($$,$1);
   if( translator.isMatrixOperand($$) ) {
-    DataType matType = MM_MATRIX_TYPE;
-    SymbolRef retRef = translator.genTemp(matType);
-    Symbol & retSym = translator.getSymbol(retRef);
     Symbol & matSym = translator.getSymbol($$.symbol);
-    translator.emit(Taco(OP_ALLOC,retSym.id,"",matSym.id)); // DogeMaster
-    translator.emit(Taco(OP_TRANSPOSE,retSym.id,matSym.id));// ret = m.'
+    DataType shape = matrixShape('\'',matSym.type,matSym.type,*this,@$);
+    SymbolRef retRef = genMatrixTemp(translator,shape,Taco(OP_ALLOC,"","",matSym.id)); // DogeMaster
+    Symbol & retSym = translator.getSymbol(retRef);
+    Symbol & srcSym = translator.getSymbol($$.symbol);
+    translator.emit(Taco(OP_TRANSPOSE,retSym.id,srcSym.id));// ret = m.'
     $$.symbol = retRef;
     $$.isReference = false;
   } else {
@@ -545,11 +596,10 @@ unary_operator unary_expression {
     if( $$.isReference ) {
       if( translator.isSimpleReference($$) ) {
 	if( rType.isMatrix() ) {
-	  DataType matType = MM_MATRIX_TYPE;
-	  SymbolRef retRef = translator.genTemp(matType);
+	  DataType shape = matrixShape('=',rType,rType,*this,@$);
+	  SymbolRef retRef = genMatrixTemp(translator,shape,Taco(OP_ALLOC,"",translator.getSymbol($$.symbol).id)); // DogeMaster
 	  Symbol & retSym = translator.getSymbol(retRef);
 	  Symbol & matSym = translator.getSymbol($$.symbol);
-	  translator.emit(Taco(OP_ALLOC,retSym.id,matSym.id)); // DogeMaster
 	  translator.emit(Taco(OP_COPY,retSym.id,matSym.id));// ret = +m
 	  $$.symbol = retRef;
 	  $$.isReference = false;
@@ -590,11 +640,10 @@ unary_operator unary_expression {
     if( $$.isReference ) {
       if( translator.isSimpleReference($$) ) {
 	if( rType.isMatrix() ) {
-	  DataType matType = MM_MATRIX_TYPE;
-	  SymbolRef retRef = translator.genTemp(matType);
+	  DataType shape = matrixShape('=',rType,rType,*this,@$);
+	  SymbolRef retRef = genMatrixTemp(translator,shape,Taco(OP_ALLOC,"",translator.getSymbol($$.symbol).id)); // DogeMaster
 	  Symbol & retSym = translator.getSymbol(retRef);
 	  Symbol & matSym = translator.getSymbol($$.symbol);
-	  translator.emit(Taco(OP_ALLOC,retSym.id,matSym.id)); // DogeMaster
 	  translator.emit(Taco(OP_UMINUS,retSym.id,matSym.id));// ret = -m
 	  $$.symbol = retRef;
 	  $$.isReference = false;
@@ -628,6 +677,13 @@ unary_operator unary_expression {
       $$.isReference = false;
     } else if( rType.isPointer() ) {
       throw syntax_error(@$ , "Unary minus on pointer not allowed." );
+    } else if( rType.isMatrix() and not translator.isTemporary($$.symbol) ) { // a slice
+      DataType shape = matrixShape('=',rType,rType,*this,@$);
+      SymbolRef retRef = genMatrixTemp(translator,shape,Taco(OP_ALLOC,"",translator.getSymbol($$.symbol).id));
+      Symbol & retSym = translator.getSymbol(retRef);
+      Symbol & matSym = translator.getSymbol($$.symbol);
+      translator.emit(Taco(OP_UMINUS,retSym.id,matSym.id));
+      $$.symbol = retRef;
     } else if( rType.isMatrix() ) {
       Symbol & RHS = translator.getSymbol($$.symbol);
       translator.emit(Taco(OP_UMINUS,RHS.id,RHS.id)); // Not DogeMaster
@@ -722,11 +778,9 @@ cast_expression {
 	mulRef = typeCheck(mulRef,coeffType,true,translator,*this,@1);
 	SymbolRef retRef = $3.symbol;
 	if( !translator.isTemporary(retRef) ) {
-	  DataType matType = MM_MATRIX_TYPE;
-	  retRef = translator.genTemp(matType);
-	  Symbol & retSym = translator.getSymbol(retRef);
 	  Symbol & matSym = translator.getSymbol($3.symbol);
-	  translator.emit(Taco(OP_ALLOC,retSym.id,matSym.id)); // DogeMaster
+	  DataType shape = matrixShape('=',matSym.type,matSym.type,*this,@3);
+	  retRef = genMatrixTemp(translator,shape,Taco(OP_ALLOC,"",matSym.id)); // DogeMaster
 	}
 	Symbol & mulSym = translator.getSymbol(mulRef);
 	Symbol & matSym = translator.getSymbol($3.symbol);
@@ -734,14 +788,40 @@ cast_expression {
 	translator.emit(Taco(OP_MULT,retSym.id,matSym.id,mulSym.id));
 	$$.symbol = retRef;
       } else { // matrix * matrix
+	/* A * B.' and A.' * B read the transposed operand in place ,
+	   and become symmetric rank-k updates when A and B are the same matrix. */
+	DataType shape = matrixShape('*',translator.getSymbol($1.symbol).type,translator.getSymbol($3.symbol).type,*this,@$);
+	OpCode product = OP_MULT;
+	if( dropTranspose(translator,$3) ) product = OP_MULT_NT;
+	else if( dropTranspose(translator,$1) ) product = OP_MULT_TN;
 	SymbolRef LHR = $1.symbol , RHR = $3.symbol;
-	DataType retType = MM_MATRIX_TYPE;
-	SymbolRef retRef = translator.genTemp(retType);
+	SymbolRef retRef;
+	if( product == OP_MULT ) {
+	  Symbol & lSym = translator.getSymbol(LHR);
+	  Symbol & rSym = translator.getSymbol(RHR);
+	  retRef = genMatrixTemp(translator,shape,Taco(OP_ALLOC,"",lSym.id,rSym.id)); // DogeMaster
+	} else if( shape.isStaticMatrix() ) {
+	  std::string rowsId = translator.getSymbol( genIntConstant(translator,shape.rows) ).id;
+	  std::string colsId = translator.getSymbol( genIntConstant(translator,shape.cols) ).id;
+	  retRef = genMatrixTemp(translator,shape,Taco(OP_ALLOC,"",rowsId,colsId));
+	} else { // dimensions of the result are read off the headers
+	  DataType retType = MM_MATRIX_TYPE , intType = MM_INT_TYPE;
+	  retRef = translator.genTemp(retType);
+	  SymbolRef rowsRef = translator.genTemp(intType) , colsRef = translator.genTemp(intType);
+	  std::string offset = ( product == OP_MULT_NT ) ? "0" : std::to_string(SIZE_OF_INT) ;
+	  Symbol & lSym = translator.getSymbol(LHR);
+	  Symbol & rSym = translator.getSymbol(RHR);
+	  Symbol & retSym = translator.getSymbol(retRef);
+	  Symbol & rowsSym = translator.getSymbol(rowsRef);
+	  Symbol & colsSym = translator.getSymbol(colsRef);
+	  translator.emit(Taco(OP_RXC,rowsSym.id,lSym.id,offset)); // rows of x or x.'
+	  translator.emit(Taco(OP_RXC,colsSym.id,rSym.id,offset)); // cols of y.' or y
+	  translator.emit(Taco(OP_ALLOC,retSym.id,rowsSym.id,colsSym.id));
+	}
 	Symbol & lSym = translator.getSymbol(LHR);
 	Symbol & rSym = translator.getSymbol(RHR);
 	Symbol & retSym = translator.getSymbol(retRef);
-	translator.emit(Taco(OP_ALLOC,retSym.id,lSym.id,rSym.id)); // DogeMaster
-	translator.emit(Taco(OP_MULT,retSym.id,lSym.id,rSym.id));
+	translator.emit(Taco(product,retSym.id,lSym.id,rSym.id));
 	$$.symbol = retRef;
       }
     } else { // matrix * / scalar
@@ -750,11 +830,9 @@ cast_expression {
       mulRef = typeCheck(mulRef,coeffType,true,translator,*this,@3);
       SymbolRef retRef = $1.symbol;
       if( !translator.isTemporary(retRef) ) {
-	DataType matType = MM_MATRIX_TYPE;
-	retRef = translator.genTemp(matType);
-	Symbol & retSym = translator.getSymbol(retRef);
 	Symbol & matSym = translator.getSymbol($1.symbol);
-	translator.emit(Taco(OP_ALLOC,retSym.id,matSym.id)); // DogeMaster
+	DataType shape = matrixShape('=',matSym.type,matSym.type,*this,@1);
+	retRef = genMatrixTemp(translator,shape,Taco(OP_ALLOC,"",matSym.id)); // DogeMaster
       }
       Symbol & mulSym = translator.getSymbol(mulRef);
       Symbol & matSym = translator.getSymbol($1.symbol);
@@ -835,14 +913,11 @@ multiplicative_expression {
     if( lMat and rMat ) {
       SymbolRef LHR = $1.symbol , RHR = $3.symbol;
       bool lTemp = translator.isTemporary(LHR) , rTemp = translator.isTemporary(RHR) ;
+      DataType shape = matrixShape($2,translator.getSymbol(LHR).type,translator.getSymbol(RHR).type,*this,@$);
       SymbolRef retRef;
       if(!lTemp and !rTemp) {
-	DataType matType = MM_MATRIX_TYPE;
-	retRef = translator.genTemp(matType);
 	Symbol & lSym = translator.getSymbol(LHR);
-	Symbol & rSym = translator.getSymbol(RHR);
-	Symbol & retSym = translator.getSymbol(retRef);
-	translator.emit(Taco(OP_ALLOC,retSym.id,lSym.id)); // DogeMaster
+	retRef = genMatrixTemp(translator,shape,Taco(OP_ALLOC,"",lSym.id)); // DogeMaster
       } else {
 	if( lTemp ) retRef = LHR;
 	else retRef = RHR;
@@ -1013,7 +1088,9 @@ unary_expression "=" assignment_expression {
 	}
 	Symbol & retSym = translator.getSymbol($$.symbol);
 	Symbol & rSym = translator.getSymbol($3.symbol);
-	translator.emit(Taco(OP_COPY,retSym.id,rSym.id));
+	matrixShape('=',retSym.type,rSym.type,*this,@$);
+	// a temporary dies with the assignment : its elements are taken over
+	translator.emit(Taco(translator.isTemporary($3.symbol) ? OP_MOVE : OP_COPY,retSym.id,rSym.id));
       } else if( lType == MM_CHAR_TYPE or lType == MM_INT_TYPE or lType == MM_DOUBLE_TYPE ) {
 	SymbolRef RHR = getScalarBinaryOperand(translator,*this,@3,$3);
 	Symbol & RHS = translator.getSymbol(RHR);
@@ -1119,7 +1196,7 @@ declarator "=" expression {
       }
       Symbol & retSym = translator.getSymbol($1);
       Symbol & rSym = translator.getSymbol($3.symbol);
-      translator.emit(Taco(OP_COPY,retSym.id,rSym.id));
+      translator.emit(Taco(translator.isTemporary($3.symbol) ? OP_MOVE : OP_COPY,retSym.id,rSym.id));
     }
   } else if( defSym.type.isPointer() ) {
     if( translator.currentEnvironment() == 0 ) {
@@ -1164,7 +1241,7 @@ declarator "=" "{" initializer_row_list "}" { // for static matrices
     if( matSym.type.rows != $4.size() or matSym.type.cols != $4[0].size() ) {
       throw syntax_error(@4,"Size mismatch. Matrix dimensions don't match initializer.");
     }
-    int offset = 2 * SIZE_OF_INT; // initial offset
+    int offset = MATRIX_HEADER; // initial offset
     for( int row = 0 ; row < matSym.type.rows ; row++ ) {
       for( int col = 0 ; col < matSym.type.cols ; col++ , offset += SIZE_OF_DOUBLE ) {
 	Symbol & elemSym = translator.getSymbol($4[row][col]);
@@ -1341,6 +1418,7 @@ IDENTIFIER "[" expression "]" "[" expression "]" {  // only 2-dimensions to be s
       curSymbol.type.cols = colSym.value.intVal;
       translator.emit(Taco(OP_LXC,curSymbol.id,"0",rowSym.id));
       translator.emit(Taco(OP_LXC,curSymbol.id,std::to_string(SIZE_OF_INT),colSym.id));
+      translator.emit(Taco(OP_LXC,curSymbol.id,std::to_string(MATRIX_LD),colSym.id));
     } else {
       unsigned int currEnv = translator.currentEnvironment();
       if( currEnv == 0 ) {// Check environment. Globally declared dynamic matrices should not be allowed.
@@ -1428,6 +1506,7 @@ statement :
 | selection_statement { std::swap($$,$1); }
 | iteration_statement { std::swap($$,$1); }
 | jump_statement      { std::swap($$,$1); }
+| task_statement      { }
 | expression_statement { } ;
 
 %type <AddressList> compound_statement;
@@ -1550,6 +1629,116 @@ instruction_mark optional_expression // Iteration expression.
   translator.patchBack($9.falseList,$5); // link totally
   
   std::swap($$,$6.falseList); // terminate
+} |
+/* Parallel loop over [lo,hi). The body is outlined into a function of the index
+   range , called on chunks of it by the worker pool of the standard library. */
+"parfor" "(" IDENTIFIER "=" expression ";" IDENTIFIER "<" expression ";" IDENTIFIER "++" ")" {
+  if( not translator.outlining.empty() ) {
+    throw syntax_error(@1,"Nested parfor not supported.");
+  }
+  if( $3 != $7 or $3 != $11 ) {
+    throw syntax_error(@$,"parfor must initialize, test and increment the same index.");
+  }
+  DataType intType = MM_INT_TYPE;
+  SymbolRef bounds[2];
+  Expression * bound[2] = { &$5 , &$9 };
+  for( int b = 0 ; b < 2 ; b++ ) {
+    if( bound[b]->isBoolean ) {
+      throw syntax_error(@$,"Non-integral parfor bound.");
+    }
+    dereference(translator,*bound[b]);
+    DataType type = translator.getSymbol(bound[b]->symbol).type;
+    if( type != MM_CHAR_TYPE and type != MM_INT_TYPE ) {
+      throw syntax_error(@$,"Non-integral parfor bound.");
+    }
+    bounds[b] = typeCheck(bound[b]->symbol,intType,true,translator,*this,@$);
+  }
+
+  /* The outlined function is named after the enclosing one , and its table is
+     linked to the current one so that the body sees the enclosing variables. */
+  unsigned int parentEnv = translator.currentEnvironment() , root = parentEnv;
+  while( translator.tables[root].parent != 0 ) root = translator.tables[root].parent;
+  std::string name = translator.tables[root].name + ".parfor." + std::to_string(++translator.parallelLoops);
+  translator.emit(Taco(OP_PARFOR,name,translator.getSymbol(bounds[0]).id,translator.getSymbol(bounds[1]).id));
+
+  unsigned int newEnv = translator.newEnvironment(name);
+  translator.currentTable().parent = parentEnv;
+  translator.currentTable().params = 3;
+  translator.currentTable().isDefined = true;
+  DataType voidType = MM_VOID_TYPE , frameType(1,0,1) ;
+  translator.createSymbol(translator.scopePrefix + "ret#",voidType,SymbolType::RETVAL);
+  translator.createSymbol(translator.scopePrefix + "frame#",frameType,SymbolType::PARAM); // %rbp of the caller
+  translator.createSymbol(translator.scopePrefix + "lo#",intType,SymbolType::PARAM);
+  translator.createSymbol(translator.scopePrefix + "hi#",intType,SymbolType::PARAM);
+  translator.createSymbol(translator.scopePrefix + $3,intType,SymbolType::LOCAL); // private index
+  DataType funcType = MM_FUNC_TYPE;
+  SymbolRef funcRef = translator.createSymbol(0,"::" + name,funcType,SymbolType::LOCAL);
+  translator.getSymbol(funcRef).child = newEnv;
+  translator.outlining = name;
+} instruction_mark statement {
+  std::vector<Taco> & QA = translator.quadArray;
+  const std::string & name = translator.outlining;
+  unsigned int start = $15 , end = translator.nextInstruction();
+  translator.patchBack($16,end);
+
+  /* Variables of the enclosing function the body uses. Only elements of its
+     matrices may be written : iterations run concurrently. */
+  unsigned int env = translator.currentEnvironment();
+  auto inside = [&](unsigned int table) {
+    for( ; table != 0 ; table = translator.tables[table].parent )
+      if( table == env ) return true;
+    return false;
+  };
+  std::set<std::string> & captured = translator.captures[name];
+  for(unsigned int addr = start; addr < end ; addr++ ) {
+    const Taco & quad = QA[addr];
+    if( quad.opCode == OP_RETURN ) {
+      throw syntax_error(@16,"Return from inside a parfor body.");
+    }
+    for( const std::string * id : { &quad.z , &quad.x , &quad.y } ) {
+      if( id == &quad.z and quad.isJump() ) continue; // label
+      SymbolRef ref;
+      try {
+	ref = translator.lookup(*id);
+      } catch ( ... ) {
+	continue; // literals , function names
+      }
+      if( ref.first == 0 or inside(ref.first) ) continue;
+      if( translator.getSymbol(ref).symType == SymbolType::CONST ) continue;
+      captured.insert(*id);
+    }
+    bool writes = not ( quad.isJump() or quad.opCode == OP_PARAM or quad.opCode == OP_L_DEREF or quad.opCode == OP_LXC
+			or quad.opCode == OP_DEALLOC or quad.opCode == OP_DECLARE );
+    if( writes and captured.count(quad.z) ) {
+      std::string id = quad.z.substr(quad.z.rfind("::") + 2);
+      throw syntax_error(@16,id + " of the enclosing function assigned in parfor body.");
+    }
+  }
+
+  /* Outlined function : the loop over [lo,hi) , with the body moved in.
+     Jumps are relative to its start , the body's end mapping to the increment. */
+  SymbolTable & table = translator.currentTable();
+  const std::string & lo = table.table[2].id , & hi = table.table[3].id , & index = table.table[4].id ;
+  const unsigned int body = 6 , size = end - start;
+  std::vector<Taco> function;
+  function.emplace_back(OP_FUNC_START,name);
+  function.emplace_back(OP_COPY,index,lo);
+  function.emplace_back(OP_LT,std::to_string(body),index,hi);
+  function.emplace_back(OP_GOTO,std::to_string(body + size + 1));
+  function.emplace_back(OP_PLUS,index,index,"1");
+  function.emplace_back(OP_GOTO,"2");
+  for(unsigned int addr = start; addr < end ; addr++ ) {
+    function.push_back(QA[addr]);
+    if( QA[addr].isJump() )
+      function.back().z = std::to_string(atoi(QA[addr].z.c_str()) - start + body);
+  }
+  function.emplace_back(OP_GOTO,"4");
+  function.emplace_back(OP_FUNC_END,name);
+  QA.erase(QA.begin() + start,QA.end());
+  translator.outlined.push_back(function);
+
+  translator.outlining.clear();
+  translator.popEnvironment();
 } ;
 
 %type <AddressList> jump_statement;
@@ -1594,6 +1783,43 @@ jump_statement :
   translator.emit(Taco(OP_RETURN,retSym.id));
 } ;
 
+/* Task parallelism : spawned calls run on the scheduler of the standard library ,
+   until a sync , or the end of the function. Arguments are passed in registers only. */
+task_statement :
+"spawn" IDENTIFIER "(" optional_argument_list ")" ";" {
+  SymbolRef funcRef;
+  try {
+    funcRef = translator.lookup(std::string("::" + $2));
+  } catch ( ... ) {
+    throw syntax_error(@2,"Identifier :"+$2+" not declared in scope.");
+  }
+  Symbol & fSym = translator.getSymbol(funcRef);
+  if( fSym.type != MM_FUNC_TYPE ) {
+    throw syntax_error(@2,"Not a function.");
+  }
+  unsigned int tableId = fSym.child;
+  if( translator.tables[tableId].table[0].type.isMatrix() ) {
+    throw syntax_error(@$,"Spawned function cannot return a matrix.");
+  }
+  unsigned int stdRegs = 0 , fpRegs = 0;
+  for( Expression & argument : $4 ) {
+    if( translator.getSymbol(argument.symbol).type == MM_DOUBLE_TYPE ) fpRegs++;
+    else stdRegs++;
+  }
+  if( stdRegs > 6 or fpRegs > 8 ) {
+    throw syntax_error(@$,"Too many arguments to spawn.");
+  }
+  Expression result;
+  callFunction(translator,*this,@$,result,tableId,$4);
+  Taco & call = translator.quadArray.back();
+  call = Taco(OP_SPAWN,"",call.x,call.y);
+} |
+"sync" ";" {
+  DataType intType = MM_INT_TYPE;
+  SymbolRef retRef = translator.genTemp(intType);
+  translator.emit(Taco(OP_CALL,translator.getSymbol(retRef).id,"mmSync","0")); // a call to the scheduler
+} ;
+
 %type <Expression> optional_expression;
 optional_expression : %empty { } | expression { std::swap($$,$1); } ;
 
@@ -1629,6 +1855,7 @@ type_specifier function_declarator "{" {
 } optional_block_item_list "}" {
   translator.patchBack($5,translator.nextInstruction());
   translator.emit(Taco(OP_FUNC_END,translator.currentTable().name));
+  translator.emitOutlined(); // bodies of its parallel loops
   translator.popEnvironment();
   // #DogeMaster : Remaining matrix memory deallocation is handled by OP_FUNC_END itself.
   translator.typeContext.pop();
@@ -2005,6 +2232,100 @@ void dereference(mm_translator &translator,Expression &expr) {
   }
 }
 
+bool dropTranspose(mm_translator &translator,Expression &expr) {
+  if( expr.isReference or !translator.isTemporary(expr.symbol) ) return false;
+  if( translator.quadArray.size() < 2 ) return false;
+  std::string id = translator.getSymbol(expr.symbol).id;
+  std::vector<Taco> & QA = translator.quadArray;
+  /* Look for `id = alloc( , m )' , `id = m.'' with nothing but straight-line code after it ,
+     so that removing them shifts no jump target. */
+  unsigned int addr = QA.size();
+  while( addr > 1 ) {
+    const Taco & quad = QA[--addr];
+    if( quad.isJump() or quad.opCode == OP_FUNC_START ) return false;
+    if( quad.opCode == OP_TRANSPOSE and quad.z == id ) break;
+    if( quad.z == id or quad.x == id or quad.y == id ) return false;
+  }
+  const Taco & transpose = QA[addr];
+  if( transpose.opCode != OP_TRANSPOSE or transpose.z != id ) return false;
+  /* Either `id = alloc( , m )' or the header writes of a static temporary precede it. */
+  unsigned int first = addr;
+  if( QA[addr-1].opCode == OP_ALLOC and QA[addr-1].z == id and QA[addr-1].x.empty() ) first = addr - 1;
+  else while( first > 1 and QA[first-1].opCode == OP_LXC and QA[first-1].z == id ) first--;
+  if( first == addr ) return false;
+  SymbolRef source = translator.lookup(transpose.x);
+  QA.erase( QA.begin() + first , QA.begin() + addr + 1 );
+  /* The temporary is never allocated now : keep it out of scope-end deallocations. */
+  translator.getSymbol(expr.symbol).type = MM_VOID_TYPE;
+  expr.symbol = source;
+  return true;
+}
+
+DataType matrixShape(char opChar ,
+		     DataType lType ,
+		     DataType rType ,
+		     yy::mm_parser & parser ,
+		     const yy::location & loc
+		     ) {
+  DataType shape = MM_MATRIX_TYPE;
+  bool lStatic = lType.isStaticMatrix() , rStatic = rType.isStaticMatrix();
+  switch( opChar ) {
+  case '+' : case '-' : case '=' :
+    if( lStatic and rStatic and lType != rType ) {
+      parser.error(loc , "Matrix dimensions do not agree.");
+    }
+    if( lStatic ) shape = lType;
+    else if( rStatic ) shape = rType;
+    break;
+  case '*' :
+    if( lStatic and rStatic ) {
+      if( lType.cols != rType.rows ) {
+	parser.error(loc , "Matrix dimensions do not agree.");
+      }
+      shape.rows = lType.rows;
+      shape.cols = rType.cols;
+    }
+    break;
+  case '\'' :
+    if( lStatic ) {
+      shape.rows = lType.cols;
+      shape.cols = lType.rows;
+    }
+    break;
+  default :
+    if( lStatic ) shape = lType;
+  }
+  return shape;
+}
+
+SymbolRef genMatrixTemp(mm_translator & translator , DataType shape , Taco alloc) {
+  if( !shape.isStaticMatrix() or shape.rows * shape.cols > mm_optimizer::STACK_ELEMENTS ) {
+    DataType matType = MM_MATRIX_TYPE;
+    SymbolRef retRef = translator.genTemp(matType);
+    alloc.z = translator.getSymbol(retRef).id;
+    translator.emit(alloc);
+    return retRef;
+  }
+  SymbolRef retRef = translator.genTemp(shape);
+  std::string id = translator.getSymbol(retRef).id;
+  std::string rowsId = translator.getSymbol( genIntConstant(translator,shape.rows) ).id;
+  std::string colsId = translator.getSymbol( genIntConstant(translator,shape.cols) ).id;
+  translator.emit(Taco(OP_LXC,id,"0",rowsId));
+  translator.emit(Taco(OP_LXC,id,std::to_string(SIZE_OF_INT),colsId));
+  translator.emit(Taco(OP_LXC,id,std::to_string(MATRIX_LD),colsId));
+  return retRef;
+}
+
+SymbolRef genIntConstant(mm_translator & translator , int value) {
+  DataType intType = MM_INT_TYPE;
+  SymbolRef ref = translator.genTemp(intType);
+  Symbol & temp = translator.getSymbol(ref);
+  temp.symType = SymbolType::CONST;
+  temp.value.intVal = value;
+  temp.isInitialized = temp.isConstant = true;
+  return ref;
+}
+
 void callFunction(mm_translator &translator,
 		  yy::mm_parser &parser,
 		  yy::location &loc,
@@ -43,11 +43,13 @@ std::ostream& operator<<(std::ostream& out,const Taco& taco) {
   case OP_GOTO:return out<<"goto "<<taco.z;
   case OP_PARAM:return out<<"param "<<taco.z;
   case OP_CALL:return out<<taco.z<<" = call "<<taco.x<<" , "<<taco.y;
+  case OP_SPAWN:return out<<"spawn "<<taco.x<<" , "<<taco.y;
   case OP_RETURN:return out<<"return "<<taco.z;
   case OP_FUNC_START:return out<<"function "<<taco.z<<" starts";
   case OP_FUNC_END:return out<<"function "<<taco.z<<" ends";
 
   case OP_COPY:return out<<taco.z<<" = "<<taco.x;
+  case OP_MOVE:return out<<taco.z<<" = move "<<taco.x;
   case OP_REFER:return out<<taco.z<<" = & "<<taco.x;
   case OP_L_DEREF:return out<<"* "<<taco.z<<" = "<<taco.x;
   case OP_R_DEREF:return out<<taco.z<<" = * "<<taco.x;
@@ -62,6 +64,10 @@ std::ostream& operator<<(std::ostream& out,const Taco& taco) {
   case OP_DEALLOC : return out<<"dealloc( "<<taco.z<<" )";
 
   case OP_TRANSPOSE : return out<<taco.z<<" = "<<taco.x<<".'";
+  case OP_MULT_NT : return out<<taco.z<<" = "<<taco.x<<" * "<<taco.y<<".'";
+  case OP_MULT_TN : return out<<taco.z<<" = "<<taco.x<<".' * "<<taco.y;
+
+  case OP_PARFOR : return out<<"parfor "<<taco.z<<" ( "<<taco.x<<" , "<<taco.y<<" )";
 
   case OP_DECLARE : return out<<"Declared : "<<taco.z;
   default : break;
@@ -34,12 +34,14 @@ enum OpCode {
   OP_GOTO,      // goto L
   OP_PARAM,     // push parameter
   OP_CALL,      // y = call p,N
+  OP_SPAWN,     // spawn p,N : call p on the task scheduler , not waiting for it
   OP_RETURN,    // return v
   OP_FUNC_START,// function start label
   OP_FUNC_END,  // function end label
   
   /* Copy / Move instructions */
   OP_COPY,      // z = x
+  OP_MOVE,      // z = x , x a matrix temporary dying here : z takes over its elements
   OP_REFER,     // z = &x
   OP_L_DEREF,   // *z = x
   OP_R_DEREF,   // z = *x
@@ -57,6 +59,9 @@ enum OpCode {
 
   /* Misc. */
   OP_TRANSPOSE,      // z = transpose(x) , where z and x point to a block of same size
+  OP_MULT_NT,        // z = x * y.' , matrix product reading y transposed in place , symmetric if x == y
+  OP_MULT_TN,        // z = x.' * y , matrix product reading x transposed in place , symmetric if x == y
+  OP_PARFOR,         // parfor z(x,y) , runs the outlined loop body z over indices [x,y) on the worker pool
   OP_DECLARE         // declare z , just used as a marker
 };
 
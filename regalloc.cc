@@ -0,0 +1,217 @@
+#include "x86_64gen.hh"
+#include "cfg.hh"
+#include <set>
+#include <algorithm>
+
+/*
+  Register pools of the allocator. General purpose registers are the
+  callee-saved ones : every caller-saved register is scratch for some emitter ,
+  and those survive calls into the runtime and the C library for free.
+  %xmm9 - %xmm15 are only touched by fused loops ( %xmm8 also carries the
+  9th and later double parameters of a call ) , so a double may live in one
+  of them as long as its interval crosses none of the quads clobbering
+  vector registers.
+*/
+static const size_t gprPool[] = { 1 , 12 , 13 , 14 , 15 }; // %rbx , %r12 - %r15
+static const size_t xmmPool[] = { 9 , 10 , 11 , 12 , 13 , 14 , 15 };
+
+/* Live interval of a candidate : quad addresses [start,end]. */
+struct LiveInterval {
+  unsigned int start , end , var ;
+};
+
+/* Linear scan over intervals sorted by start. Intervals crossing a clobber ,
+   and those losing the furthest-end contest when every register is taken ,
+   stay in memory. Returns the register of every interval , or -1.
+   Clobbers are sorted half-addresses : 2 * addr if the quad at addr clobbers
+   before reading its operands , 2 * addr + 1 if after. */
+static std::vector<int> linearScan(std::vector<LiveInterval> & intervals ,
+				   const size_t * pool , size_t poolSize ,
+				   const std::vector<unsigned int> & clobbers) {
+  std::vector<int> reg( intervals.size() , -1 );
+  std::vector<unsigned int> active; // sorted by end
+  std::vector<size_t> freeRegs( pool , pool + poolSize );
+  std::reverse( freeRegs.begin() , freeRegs.end() );
+  auto byEnd = [&](unsigned int a , unsigned int b) { return intervals[a].end < intervals[b].end; };
+
+  for(unsigned int i = 0; i < intervals.size() ; i++ ) {
+    const LiveInterval & cur = intervals[i];
+    while( not active.empty() and intervals[active.front()].end < cur.start ) {
+      freeRegs.push_back( reg[active.front()] );
+      active.erase( active.begin() );
+    }
+    auto clobber = std::upper_bound( clobbers.begin() , clobbers.end() , 2 * cur.start + 1 );
+    if( clobber != clobbers.end() and *clobber <= 2 * cur.end ) continue;
+
+    if( freeRegs.empty() ) {
+      unsigned int victim = active.back();
+      if( intervals[victim].end <= cur.end ) continue; // spill the current interval
+      reg[i] = reg[victim] ; reg[victim] = -1;
+      active.pop_back();
+    } else {
+      reg[i] = freeRegs.back();
+      freeRegs.pop_back();
+    }
+    active.insert( std::upper_bound( active.begin() , active.end() , i , byEnd ) , i );
+  }
+  return reg;
+}
+
+/*
+  Assigns registers to the scalar int , double and pointer variables of the
+  function in quads [from,to] , following Poletto and Sarkar's linear scan.
+  Live intervals come from a liveness analysis over the basic blocks of the
+  function , flattened to the first and last address where a variable is live.
+  Variables whose address is taken stay on the stack , as do the ones spilled.
+  Allocated variables move from vars to regR.
+*/
+void ActivationRecord::allocateRegisters(mm_translator & mic , unsigned int from , unsigned int to) {
+  std::vector<Taco> & QA = mic.quadArray;
+
+  /* Variables whose address is taken , and those an outlined parallel loop
+     body reaches through the frame pointer. */
+  std::set<std::string> referred;
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    if( QA[addr].opCode == OP_REFER ) referred.insert( QA[addr].x );
+    if( QA[addr].opCode == OP_PARFOR ) referred.insert( mic.captures[QA[addr].z].begin() , mic.captures[QA[addr].z].end() );
+  }
+
+  std::map<std::string,unsigned int> candidate; // id -> index in vars
+  for(unsigned int n = 0; n < vars.size() ; n++ ) {
+    DataType & type = vars[n].type;
+    if( referred.count( vars[n].id ) ) continue;
+    if( type == MM_INT_TYPE or type == MM_DOUBLE_TYPE or type.isPointer() )
+      candidate[ vars[n].id ] = n;
+  }
+
+  /* Uses and definitions of every quad. Parameters are read by the call
+     that follows them , as that is where their code is emitted. */
+  unsigned int count = to - from - 1;
+  std::vector< std::vector<unsigned int> > uses( count ) , defs( count );
+  auto use = [&](unsigned int addr , const std::string & id) {
+    auto it = candidate.find( id );
+    if( it != candidate.end() ) uses[addr - from - 1].push_back( it->second );
+  };
+  auto def = [&](unsigned int addr , const std::string & id) {
+    auto it = candidate.find( id );
+    if( it != candidate.end() ) defs[addr - from - 1].push_back( it->second );
+  };
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    const Taco & quad = QA[addr];
+    switch( quad.opCode ) {
+    case OP_GOTO : case OP_PARAM : case OP_DECLARE : break;
+    case OP_CALL : case OP_SPAWN :
+      for(unsigned int param = addr - 1; param > from and QA[param].opCode == OP_PARAM ; param-- )
+	use( addr , QA[param].z );
+      def( addr , quad.z );
+      break;
+    case OP_RETURN : case OP_DEALLOC :
+      use( addr , quad.z );
+      break;
+    case OP_L_DEREF : case OP_LXC :
+      use( addr , quad.z ) ; use( addr , quad.x ) ; use( addr , quad.y );
+      break;
+    default :
+      use( addr , quad.x ) ; use( addr , quad.y );
+      if( not quad.isJump() ) def( addr , quad.z );
+    }
+  }
+
+  ControlFlowGraph cfg( QA , from , to );
+  unsigned int blocks = cfg.blocks.size();
+
+  /* Liveness , iterated to a fixed point. */
+  typedef std::vector<bool> LiveSet;
+  std::vector<LiveSet> liveIn( blocks , LiveSet( vars.size() , false ) ) , liveOut( liveIn );
+  auto transfer = [&](LiveSet & live , unsigned int n) {
+    for( unsigned int v : defs[n] ) live[v] = false;
+    for( unsigned int v : uses[n] ) live[v] = true;
+  };
+  for( bool changed = true ; changed ; ) {
+    changed = false;
+    for(unsigned int b = blocks; b-- > 0 ; ) {
+      LiveSet live( vars.size() , false );
+      for( unsigned int s : cfg.blocks[b].succ )
+	for(unsigned int v = 0; v < vars.size() ; v++ )
+	  if( liveIn[s][v] ) live[v] = true;
+      liveOut[b] = live;
+      for(unsigned int addr = cfg.blocks[b].end; addr-- > cfg.blocks[b].start ; ) transfer( live , addr - from - 1 );
+      if( live != liveIn[b] ) liveIn[b] = live , changed = true;
+    }
+  }
+
+  /* Live intervals. */
+  const unsigned int NONE = -1;
+  std::vector<unsigned int> first( vars.size() , NONE ) , last( vars.size() , 0 );
+  auto mark = [&](unsigned int v , unsigned int addr) {
+    if( first[v] == NONE or addr < first[v] ) first[v] = addr;
+    if( addr > last[v] ) last[v] = addr;
+  };
+  for(unsigned int b = 0; b < blocks ; b++ ) {
+    LiveSet live = liveOut[b];
+    for(unsigned int addr = cfg.blocks[b].end; addr-- > cfg.blocks[b].start ; ) {
+      unsigned int n = addr - from - 1;
+      for(unsigned int v = 0; v < vars.size() ; v++ )
+	if( live[v] ) mark( v , addr );
+      for( unsigned int v : defs[n] ) mark( v , addr );
+      for( unsigned int v : uses[n] ) mark( v , addr );
+      transfer( live , n );
+    }
+  }
+
+  /* Quads emitted as calls or as loops over vector registers. Those of
+     element-wise chains are among them , which keeps the scalars of a fused
+     loop in memory even though it reads them at the address of its last quad.
+     Only a call reads all of its operands , the parameters , beforehand. */
+  std::vector<unsigned int> clobbers;
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    const Taco & quad = QA[addr];
+    bool matrixResult = false;
+    if( quad.opCode != OP_LXC and not quad.isJump() ) {
+      try {
+	matrixResult = mic.getSymbol( mic.lookup( quad.z ) ).type.isMatrix();
+      } catch( int ) { }
+    }
+    if( quad.opCode == OP_CALL or quad.opCode == OP_SPAWN or quad.opCode == OP_PARFOR )
+      clobbers.push_back( 2 * addr + 1 );
+    else if( matrixResult or quad.opCode == OP_ALLOC or quad.opCode == OP_DEALLOC )
+      clobbers.push_back( 2 * addr );
+  }
+
+  std::vector<LiveInterval> gprIntervals , xmmIntervals;
+  for( auto & entry : candidate ) {
+    unsigned int v = entry.second;
+    if( first[v] == NONE ) continue; // never used
+    LiveInterval interval = { first[v] , last[v] , v };
+    if( vars[v].type == MM_DOUBLE_TYPE ) xmmIntervals.push_back( interval );
+    else gprIntervals.push_back( interval );
+  }
+  auto byStart = [](const LiveInterval & a , const LiveInterval & b) {
+    return a.start < b.start or ( a.start == b.start and a.var < b.var );
+  };
+  std::sort( gprIntervals.begin() , gprIntervals.end() , byStart );
+  std::sort( xmmIntervals.begin() , xmmIntervals.end() , byStart );
+
+  std::vector<int> regOf( vars.size() , -1 );
+  // An outlined loop body keeps the frame pointer of its caller in %rbx.
+  size_t reserved = outlined ? 1 : 0;
+  std::vector<int> gprRegs = linearScan( gprIntervals , gprPool + reserved , sizeof(gprPool)/sizeof(size_t) - reserved , {} );
+  std::vector<int> xmmRegs = linearScan( xmmIntervals , xmmPool , sizeof(xmmPool)/sizeof(size_t) , clobbers );
+  for(unsigned int i = 0; i < gprIntervals.size() ; i++ ) regOf[ gprIntervals[i].var ] = gprRegs[i];
+  for(unsigned int i = 0; i < xmmIntervals.size() ; i++ ) regOf[ xmmIntervals[i].var ] = xmmRegs[i];
+
+  std::vector<bool> saved( 16 , false );
+  std::vector< Symbol > onStack;
+  for(unsigned int v = 0; v < vars.size() ; v++ ) {
+    if( regOf[v] < 0 ) {
+      onStack.push_back( vars[v] );
+    } else {
+      regR.emplace_back( vars[v] , regOf[v] );
+      if( vars[v].type != MM_DOUBLE_TYPE ) saved[ regOf[v] ] = true;
+    }
+  }
+  std::swap( vars , onStack );
+
+  for( size_t reg : gprPool )
+    if( saved[reg] ) savedRegs.emplace_back( reg , 0 );
+}
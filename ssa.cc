@@ -0,0 +1,90 @@
+#include "ssa.hh"
+#include <algorithm>
+
+mm_ssa::mm_ssa(const std::vector<Taco> & QA , unsigned int from , unsigned int to , unsigned int _variables ,
+	       const std::vector< std::vector<SSAOperand> > & _uses ,
+	       const std::vector< std::vector<SSAOperand> > & _defs) :
+  cfg( QA , from , to ) , variables(_variables) , uses(_uses) , defs(_defs) , phis( cfg.blocks.size() ) {
+  cfg.computeDominators();
+  for(unsigned int v = 0; v < variables ; v++ ) values.emplace_back( SSAValue::ENTRY , v , 0 );
+  if( cfg.blocks.empty() ) return;
+  placePhis();
+  std::vector< std::vector<unsigned int> > stacks( variables );
+  for(unsigned int v = 0; v < variables ; v++ ) stacks[v].push_back( v );
+  rename( 0 , stacks );
+}
+
+mm_ssa::~mm_ssa() { }
+
+/*
+  Places phis on the iterated dominance frontier of the blocks defining a
+  variable. Variables never read before being written in a block are dead
+  at every join and get none.
+*/
+void mm_ssa::placePhis() {
+  const unsigned int from = cfg.from;
+  std::vector<bool> global( variables , false );
+  std::vector< std::vector<unsigned int> > defBlocks( variables );
+  for( unsigned int b : cfg.order ) {
+    std::vector<bool> killed( variables , false );
+    for(unsigned int addr = cfg.blocks[b].start; addr < cfg.blocks[b].end ; addr++ ) {
+      for( const SSAOperand & use : uses[addr - from - 1] )
+	if( not killed[use.var] ) global[use.var] = true;
+      for( const SSAOperand & def : defs[addr - from - 1] ) {
+	if( not killed[def.var] ) defBlocks[def.var].push_back( b );
+	killed[def.var] = true;
+      }
+    }
+  }
+
+  std::vector<int> placed( cfg.blocks.size() , -1 ) , queued( cfg.blocks.size() , -1 );
+  for(unsigned int v = 0; v < variables ; v++ ) {
+    if( not global[v] ) continue;
+    std::vector<unsigned int> work = defBlocks[v];
+    work.push_back( 0 ); // the value on entry
+    for( unsigned int b : work ) queued[b] = v;
+    while( not work.empty() ) {
+      unsigned int b = work.back();
+      work.pop_back();
+      for( unsigned int d : cfg.blocks[b].frontier ) {
+	if( placed[d] == (int) v ) continue;
+	placed[d] = v;
+	SSAPhi phi;
+	phi.var = v ; phi.value = values.size();
+	phi.args.assign( cfg.blocks[d].pred.size() + ( d == 0 ) , NONE );
+	values.emplace_back( SSAValue::PHI , v , d );
+	phis[d].push_back( phi );
+	if( queued[d] != (int) v ) queued[d] = v , work.push_back( d );
+      }
+    }
+  }
+}
+
+/* Renames along the dominator tree , stacks holding the current value of every variable. */
+void mm_ssa::rename(unsigned int b , std::vector< std::vector<unsigned int> > & stacks) {
+  const unsigned int from = cfg.from;
+  const BasicBlock & block = cfg.blocks[b];
+  std::vector<unsigned int> pushed;
+  if( b == 0 )
+    for( SSAPhi & phi : phis[b] ) phi.args.back() = stacks[phi.var].back();
+  for( SSAPhi & phi : phis[b] ) {
+    stacks[phi.var].push_back( phi.value );
+    pushed.push_back( phi.var );
+  }
+  for(unsigned int addr = block.start; addr < block.end ; addr++ ) {
+    for( SSAOperand & use : uses[addr - from - 1] ) use.value = stacks[use.var].back();
+    for( SSAOperand & def : defs[addr - from - 1] ) {
+      def.value = values.size();
+      values.emplace_back( SSAValue::QUAD , def.var , addr );
+      stacks[def.var].push_back( def.value );
+      pushed.push_back( def.var );
+    }
+  }
+  for( unsigned int s : block.succ ) {
+    const std::vector<unsigned int> & pred = cfg.blocks[s].pred;
+    unsigned int j = std::find( pred.begin() , pred.end() , b ) - pred.begin();
+    for( SSAPhi & phi : phis[s] ) phi.args[j] = stacks[phi.var].back();
+  }
+  for( unsigned int c : block.children ) rename( c , stacks );
+  for( unsigned int v : pushed ) stacks[v].pop_back();
+}
@@ -0,0 +1,60 @@
+#ifndef MM_SSA_H
+#define MM_SSA_H
+
+#include <vector>
+#include "cfg.hh"
+
+/* Occurrence of a variable in field 'z' , 'x' or 'y' of a quad ,
+   and the SSA value it reads or defines there. */
+class SSAOperand {
+public:
+  char field;
+  unsigned int var , value;
+  SSAOperand(char _field,unsigned int _var) : field(_field) , var(_var) , value(-1) { }
+};
+
+/* value = phi( args ) at the head of a block , one argument per predecessor.
+   The entry block takes one more argument : the value on function entry. */
+class SSAPhi {
+public:
+  unsigned int var , value;
+  std::vector<unsigned int> args;
+};
+
+/* Where an SSA value is defined : on function entry , by the phi of a block
+   or by the quad at an address. */
+class SSAValue {
+public:
+  enum Kind { ENTRY , PHI , QUAD } kind;
+  unsigned int var , site;
+  SSAValue(Kind _kind,unsigned int _var,unsigned int _site) : kind(_kind) , var(_var) , site(_site) { }
+};
+
+/**
+   Static single assignment view of the function in quads [from,to] , after
+   Cytron et al. with phis only for variables live across blocks. The quads
+   are left untouched : the caller lists the variables every quad reads and
+   writes , and each occurrence is mapped to the SSA value it stands for.
+   Uses in blocks unreachable from the entry get the value NONE.
+*/
+class mm_ssa {
+public:
+  static const unsigned int NONE = -1;
+
+  // variables , then uses and definitions of every quad indexed by addr - from - 1
+  mm_ssa(const std::vector<Taco> &,unsigned int,unsigned int,unsigned int,
+	 const std::vector< std::vector<SSAOperand> > &,const std::vector< std::vector<SSAOperand> > &);
+  virtual ~mm_ssa();
+
+  ControlFlowGraph cfg;
+  unsigned int variables;
+  std::vector< std::vector<SSAOperand> > uses , defs;
+  std::vector< std::vector<SSAPhi> > phis; // by block
+  std::vector< SSAValue > values;          // the first ones are the values on entry
+
+private:
+  void placePhis();
+  void rename(unsigned int,std::vector< std::vector<unsigned int> > &);
+};
+
+#endif /* ! MM_SSA_H */
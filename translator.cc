@@ -8,6 +8,7 @@ mm_translator::mm_translator(const std::string &_file) :
   needsDefinition = false;
   parameterDeclaration = false;
   temporaryCount = 0; // initialize tempCount to 0  
+  parallelLoops = 0;
   newEnvironment("gST"); // initialize global table
   scopePrefix = "::";
   globalTable().parent = 0;
@@ -161,11 +162,21 @@ SymbolRef mm_translator::genTemp(unsigned int idx , DataType & type) {
   return createSymbol(idx,tempId,type,SymbolType::TEMP);
 }
 
+SymbolRef mm_translator::genView(DataType & type) {
+  std::string tempId = "#" + std::to_string(++temporaryCount);
+  return createSymbol(tempId,type,SymbolType::LOCAL);
+}
+
 bool mm_translator::isTemporary(SymbolRef ref) {
   Symbol & symbol = getSymbol(ref);
   return symbol.symType == SymbolType::TEMP;
 }
 
+bool mm_translator::isView(SymbolRef ref) {
+  Symbol & symbol = getSymbol(ref);
+  return symbol.symType == SymbolType::LOCAL and symbol.id[0] == '#';
+}
+
 /* Print the entire symbol table */
 void mm_translator::printSymbolTable() {
   for( int i = 0; i < tables.size() ; i++ )
@@ -197,6 +208,17 @@ void mm_translator::patchBack(std::list<unsigned int>& quadList,unsigned int add
   }
 }
 
+void mm_translator::emitOutlined() {
+  for( std::vector<Taco> & function : outlined ) {
+    unsigned int base = nextInstruction();
+    for( Taco & quad : function ) {
+      if( quad.isJump() ) quad.z = std::to_string( base + atoi( quad.z.c_str() ) );
+      emit( quad );
+    }
+  }
+  outlined.clear();
+}
+
 void mm_translator::emit_MIC() {
   fout << file << " : Translated code :\n";
   fout << "3 Address codes :\n";
@@ -3,6 +3,8 @@
 
 #include <string>
 #include <stack>
+#include <map>
+#include <set>
 #include <fstream>
 
 /* Policy based data structures */
@@ -92,6 +94,9 @@ public:
   SymbolRef genTemp( DataType & ) ;
   // the symbol table id is provided
   SymbolRef genTemp( unsigned int , DataType & ) ;
+  // generate a view of another matrix's elements : freed like a local ,
+  // but never taken for a temporary whose storage may be written in place
+  SymbolRef genView( DataType & ) ;
   
   // Update offsets of a symbol table
   void updateSymbolTable(unsigned int);
@@ -133,6 +138,8 @@ public:
   /* Helper functions */
   // returns wether given symbol is a temporary
   bool isTemporary(SymbolRef);
+  // returns wether given symbol is a view made by genView
+  bool isView(SymbolRef);
 
   /* Returns the greater of two types in basic type heirarchy 
      To be used only for non-matrix types only.
@@ -140,6 +147,22 @@ public:
   */
   static DataType maxType( DataType & , DataType & );
 
+  /* Parallel loops. The body of every parfor is outlined into a function of
+     its own , named after the enclosing one , whose quads wait in outlined
+     until the enclosing function ends. */
+  std::string outlining;      // outlined function being parsed , if any
+  unsigned int parallelLoops; // outlined functions so far
+  std::vector< std::vector<Taco> > outlined; // jumps relative to the function start
+  // variables of the enclosing function an outlined function reads or writes
+  std::map< std::string , std::set<std::string> > captures;
+  // append the quads of outlined functions to the quad array
+  void emitOutlined();
+
+  /* Matrix temporaries of dynamic shape that never escape their function ,
+     and the static matrix of the frame they are stored in when they fit.
+     Filled in by the optimizer. */
+  std::map< std::string , std::string > scratch;
+
   /* Table of string constants. */
   std::vector<std::string> stringTable;
 
@@ -20,7 +20,7 @@ unsigned int DataType::getSize() {
     if( cols == 4 ) return SIZE_OF_DOUBLE;
     return 0;
   }
-  return 2 * SIZE_OF_INT + rows * cols * SIZE_OF_DOUBLE ;
+  return MATRIX_HEADER + rows * cols * SIZE_OF_DOUBLE ;
 }
 
 bool DataType::operator==(const DataType & type) const {
@@ -9,6 +9,22 @@ const unsigned int SIZE_OF_CHAR = 1;
 const unsigned int SIZE_OF_INT = 4;
 const unsigned int SIZE_OF_DOUBLE = 8;
 
+/* A matrix starts with a header holding its rows , columns and leading
+   dimension ( elements from the start of a row to the next ) as ints , at
+   offsets 0 , 4 and MATRIX_LD , then the address of its first element at
+   MATRIX_DATA. The header is padded to a cache line. The elements of a
+   matrix follow its header row by row , but for a slice , whose header
+   points into the elements of the matrix it views.
+   Dynamic matrices may share elements , copied on the first write : the
+   header at MATRIX_STORE is that of the block holding them , which counts
+   the matrices using it at MATRIX_REFS. A count of 0 marks elements that
+   are never shared , as those of static matrices and slices. */
+const unsigned int MATRIX_LD = 2 * SIZE_OF_INT;
+const unsigned int MATRIX_DATA = 4 * SIZE_OF_INT;
+const unsigned int MATRIX_STORE = 6 * SIZE_OF_INT;
+const unsigned int MATRIX_REFS = 8 * SIZE_OF_INT;
+const unsigned int MATRIX_HEADER = 64;
+
 /**
    Class for defining data types and their reference level.
    (rows , cols) are also used to refer to basic datatypes :
@@ -0,0 +1,252 @@
+#include "vectorizer.hh"
+#include <algorithm>
+
+mm_vectorizer::mm_vectorizer(mm_translator & translator) : mic(translator) { }
+
+mm_vectorizer::~mm_vectorizer() { }
+
+bool mm_vectorizer::typeOf(const std::string & id , DataType & type) {
+  if( id.empty() ) return false;
+  try {
+    type = mic.getSymbol( mic.lookup(id) ).type;
+    return true;
+  } catch( int ) {
+    return false; // literals , labels
+  }
+}
+
+bool mm_vectorizer::isConstant(const std::string & id , int value) {
+  if( id == std::to_string(value) ) return true;
+  try {
+    const Symbol & symbol = mic.getSymbol( mic.lookup(id) );
+    return symbol.symType == SymbolType::CONST and symbol.type == MM_INT_TYPE
+      and symbol.value.intVal == value;
+  } catch( int ) {
+    return false;
+  }
+}
+
+/* Local matrices may share their elements with others after an assignment ,
+   but emitVectorLoop gives every matrix stored to elements of its own before
+   the loop runs , so a stored local aliases no other local. Parameters and
+   globals may be the same matrix under two names. */
+bool mm_vectorizer::isShared(const std::string & id) {
+  SymbolRef ref = mic.lookup(id);
+  SymbolType symType = mic.getSymbol(ref).symType;
+  return ref.first == 0 or not ( symType == SymbolType::LOCAL or symType == SymbolType::TEMP );
+}
+
+void mm_vectorizer::vectorizeElementLoops() {
+  std::vector<Taco> & QA = mic.quadArray;
+  for(unsigned int addr = 0; addr < QA.size() ; ) {
+    if( QA[addr].opCode == OP_FUNC_START ) {
+      unsigned int nxtAddr = addr;
+      for( ; nxtAddr < QA.size() and QA[nxtAddr].opCode != OP_FUNC_END ; nxtAddr++ ) ;
+      vectorizeFunction(addr , nxtAddr);
+      addr = nxtAddr + 1;
+    } else {
+      addr++;
+    }
+  }
+}
+
+void mm_vectorizer::vectorizeFunction(unsigned int from , unsigned int to) {
+  std::vector<Taco> & QA = mic.quadArray;
+  occurrences.clear();
+  for(unsigned int addr = from + 1; addr < to ; addr++ ) {
+    const Taco & quad = QA[addr];
+    if( quad.isJump() or quad.opCode == OP_CALL or quad.opCode == OP_SPAWN ) continue; // labels , function names
+    for( const std::string * id : { &quad.z , &quad.x , &quad.y } )
+      if( not id->empty() ) occurrences[*id].push_back( addr );
+  }
+
+  ControlFlowGraph cfg( QA , from , to );
+  cfg.computeDominators();
+  for( const NaturalLoop & loop : cfg.findLoops() ) {
+    VectorLoop vector;
+    if( vectorizeLoop( cfg , loop , vector ) ) loops[ cfg.blocks[loop.header].start ] = vector;
+  }
+}
+
+/* Matches the loop against the shape above , and fills in its vector loop. */
+bool mm_vectorizer::vectorizeLoop(const ControlFlowGraph & cfg , const NaturalLoop & loop , VectorLoop & vector) {
+  const std::vector<Taco> & QA = mic.quadArray;
+  if( loop.blocks.size() != 3 or loop.preheader < 0 ) return false;
+
+  /* Header : a lone comparison of int counter and bound , entered by falling through. */
+  const BasicBlock & header = cfg.blocks[loop.header];
+  unsigned int start = header.start;
+  const Taco & test = QA[start];
+  if( header.end != start + 1 or ( test.opCode != OP_LT and test.opCode != OP_LTE ) ) return false;
+  if( (unsigned int) cfg.blocks[loop.preheader].end != start or QA[start - 1].isJump() ) return false;
+  DataType counterType , boundType;
+  if( not typeOf( test.x , counterType ) or not typeOf( test.y , boundType ) ) return false;
+  if( counterType != MM_INT_TYPE or boundType != MM_INT_TYPE ) return false;
+  if( mic.getSymbol( mic.lookup( test.x ) ).symType == SymbolType::CONST ) return false;
+  vector.counter = test.x;
+  vector.bound = test.y;
+  vector.inclusive = ( test.opCode == OP_LTE );
+
+  /* Body entered when the test holds , and latch closing the loop. */
+  unsigned int target = atoi( test.z.c_str() );
+  if( target <= cfg.from or target >= cfg.to ) return false;
+  unsigned int b = cfg.blockOf( target ) , l = loop.blocks[0] + loop.blocks[1] + loop.blocks[2] - b - loop.header;
+  if( b == loop.header or not std::binary_search( loop.blocks.begin() , loop.blocks.end() , b ) ) return false;
+  const BasicBlock & body = cfg.blocks[b] , & latch = cfg.blocks[l];
+  const Taco & next = QA[body.end - 1] , & back = QA[latch.end - 1];
+  if( next.opCode != OP_GOTO or (unsigned int) atoi( next.z.c_str() ) != latch.start ) return false;
+  if( back.opCode != OP_GOTO or (unsigned int) atoi( back.z.c_str() ) != start ) return false;
+
+  /* Latch : the counter goes up by one , every offset by one double. */
+  bool counted = false;
+  for(unsigned int addr = latch.start; addr + 1 < latch.end ; addr++ ) {
+    const Taco & quad = QA[addr];
+    if( quad.opCode != OP_PLUS or quad.z != quad.x ) return false;
+    if( quad.z == vector.counter ) {
+      if( counted or not isConstant( quad.y , 1 ) ) return false;
+      counted = true;
+    } else {
+      DataType type;
+      if( not typeOf( quad.z , type ) or type != MM_INT_TYPE or not isConstant( quad.y , 8 ) ) return false;
+      if( std::find( vector.offsets.begin() , vector.offsets.end() , quad.z ) != vector.offsets.end() ) return false;
+      vector.offsets.push_back( quad.z );
+    }
+  }
+  if( not counted or vector.bound == vector.counter
+      or std::find( vector.offsets.begin() , vector.offsets.end() , vector.bound ) != vector.offsets.end() )
+    return false;
+
+  /* Body : loads , stores and double arithmetic. */
+  std::map<std::string,std::string> value; // variable -> operand holding its value
+  auto isDouble = [&](const std::string & id) {
+    DataType type;
+    return typeOf( id , type ) and type == MM_DOUBLE_TYPE;
+  };
+  auto operand = [&](const std::string & id) -> std::string {
+    auto it = value.find( id );
+    if( it != value.end() ) return it->second;
+    if( not isDouble( id ) ) return "";
+    if( std::find( vector.scalars.begin() , vector.scalars.end() , id ) == vector.scalars.end() )
+      vector.scalars.push_back( id );
+    return id;
+  };
+  auto stream = [&](const std::string & matrix , const std::string & offset) -> std::string {
+    DataType type;
+    if( not typeOf( matrix , type ) or not type.isMatrix() ) return "";
+    if( std::find( vector.offsets.begin() , vector.offsets.end() , offset ) == vector.offsets.end() ) return "";
+    auto access = std::make_pair( matrix , offset );
+    auto it = std::find( vector.streams.begin() , vector.streams.end() , access );
+    if( it == vector.streams.end() ) it = vector.streams.insert( it , access );
+    return "@" + std::to_string( it - vector.streams.begin() );
+  };
+  auto define = [&](const std::string & id , const std::string & result) {
+    if( not isDouble( id ) or mic.getSymbol( mic.lookup( id ) ).symType == SymbolType::CONST ) return false;
+    for( unsigned int addr : occurrences[id] )
+      if( addr < body.start or addr >= body.end ) return false; // live outside the body
+    value[id] = result;
+    return true;
+  };
+  std::vector<bool> stored;
+  vector.negates = false;
+  for(unsigned int addr = body.start; addr + 1 < body.end ; addr++ ) {
+    const Taco & quad = QA[addr];
+    std::string n = "%" + std::to_string( vector.steps.size() );
+    switch( quad.opCode ) {
+    case OP_RXC : {
+      std::string x = stream( quad.x , quad.y );
+      if( x.empty() ) return false;
+      vector.steps.emplace_back( OP_RXC , x );
+      if( not define( quad.z , n ) ) return false;
+    } break;
+    case OP_LXC : {
+      std::string z = stream( quad.z , quad.x ) , y = operand( quad.y );
+      if( z.empty() or y.empty() ) return false;
+      vector.steps.emplace_back( OP_LXC , z , y );
+      stored.resize( vector.streams.size() , false );
+      stored[ atoi( z.c_str() + 1 ) ] = true;
+    } break;
+    case OP_PLUS : case OP_MINUS : case OP_MULT : case OP_DIV : {
+      std::string x = operand( quad.x ) , y = operand( quad.y );
+      if( x.empty() or y.empty() ) return false;
+      vector.steps.emplace_back( quad.opCode , x , y );
+      if( not define( quad.z , n ) ) return false;
+    } break;
+    case OP_UMINUS : {
+      std::string x = operand( quad.x );
+      if( x.empty() ) return false;
+      vector.steps.emplace_back( OP_UMINUS , x );
+      vector.negates = true;
+      if( not define( quad.z , n ) ) return false;
+    } break;
+    case OP_COPY : {
+      std::string x = operand( quad.x );
+      if( x.empty() or not define( quad.z , x ) ) return false;
+    } break;
+    default : return false;
+    }
+  }
+  stored.resize( vector.streams.size() , false );
+  if( std::find( stored.begin() , stored.end() , true ) == stored.end() ) return false;
+  if( vector.streams.size() > MAX_STREAMS ) return false;
+
+  /* Scalars are invariant : read before any write in the body would carry
+     a value over from the previous iteration. */
+  for( const std::string & id : vector.scalars )
+    if( value.count( id ) ) return false;
+
+  /* A stored matrix is only accessed through the same offset , and shares
+     no element with any other matrix accessed. */
+  for(unsigned int s = 0; s < vector.streams.size() ; s++ ) {
+    if( not stored[s] ) continue;
+    for(unsigned int t = 0; t < vector.streams.size() ; t++ ) {
+      const std::string & a = vector.streams[s].first , & c = vector.streams[t].first;
+      if( t == s ) continue;
+      if( a == c ) return false;
+      if( isShared( a ) and isShared( c ) ) return false;
+    }
+  }
+  return assignSlots( vector );
+}
+
+/*
+  Gives every loaded or computed value a register , reusing those of values
+  past their last use. As in fused loops , the first operand is released before
+  the result is placed and the second one after. Broadcast scalars and the sign
+  mask take registers from the top of the range.
+  Returns false if the registers do not suffice.
+*/
+bool mm_vectorizer::assignSlots(VectorLoop & loop) {
+  unsigned int reserved = loop.scalars.size() + ( loop.negates ? 1 : 0 );
+  if( reserved >= MAX_REGISTERS ) return false;
+  unsigned int slots = MAX_REGISTERS - reserved;
+
+  std::vector<unsigned int> lastUse( loop.steps.size() , 0 );
+  for(unsigned int n = 0; n < loop.steps.size() ; n++ ) {
+    lastUse[n] = n;
+    for( const std::string * id : { &loop.steps[n].x , &loop.steps[n].y } )
+      if( not id->empty() and (*id)[0] == '%' ) lastUse[ atoi( id->c_str() + 1 ) ] = n;
+  }
+
+  std::vector<bool> busy( slots , false );
+  auto release = [&](const std::string & id , unsigned int n) {
+    if( id.empty() or id[0] != '%' ) return;
+    unsigned int step = atoi( id.c_str() + 1 );
+    if( lastUse[step] == n ) busy[ loop.steps[step].slot ] = false;
+  };
+  for(unsigned int n = 0; n < loop.steps.size() ; n++ ) {
+    FusedStep & step = loop.steps[n];
+    if( step.opCode == OP_LXC ) {
+      release( step.y , n );
+      continue;
+    }
+    release( step.x , n );
+    unsigned int slot = 0;
+    while( slot < slots and busy[slot] ) slot++;
+    if( slot == slots ) return false;
+    busy[slot] = true;
+    step.slot = slot;
+    if( step.y != step.x ) release( step.y , n );
+    if( lastUse[n] == n ) busy[slot] = false; // never used
+  }
+  return true;
+}
@@ -0,0 +1,77 @@
+#ifndef MM_VECTORIZER_H
+#define MM_VECTORIZER_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include "fusion.hh"
+#include "cfg.hh"
+
+/* An innermost loop over matrix elements , run several iterations at a time.
+   Steps are OP_RXC loads and OP_LXC stores of stream elements ( "@k" ) , and
+   double arithmetic over step results ( "%n" ) and invariant scalars. */
+class VectorLoop {
+public:
+  std::string counter , bound;  // iterates while counter < bound , or <= if inclusive
+  bool inclusive;
+  std::vector<std::string> offsets;  // byte offsets advanced by 8 with the counter
+  std::vector< std::pair<std::string,std::string> > streams;  // ( matrix , offset ) pairs
+  std::vector<std::string> scalars;  // loop invariant doubles
+  std::vector<FusedStep> steps;
+  bool negates;                      // wether a step needs the sign mask
+};
+
+/**
+   Vectorizer of innermost element loops , in the shape strength reduction
+   leaves them in :
+       H : if j < n goto B          ( or j <= n )
+           goto X
+       I : j = j + 1
+           p = p + 8                ( for every offset p )
+           goto H
+       B : straight-line body
+           goto I
+   Every matrix element the body touches is addressed by an offset , so all
+   accesses are unit-stride on j. The body may only load , store and combine
+   doubles , in variables dead outside of it and never read before being
+   written , and no matrix stored to may alias another one accessed.
+   Loops are not rewritten : a packed loop runs ahead of the header as long
+   as a whole vector of iterations remains , then advances the counter and
+   the offsets past them , and the original loop finishes the rest.
+*/
+class mm_vectorizer {
+public:
+
+  mm_vectorizer(mm_translator &);
+  virtual ~mm_vectorizer();
+
+  /* Reference to machine independant code and data. */
+  mm_translator & mic;
+
+  /* Vectorized loops , keyed by the address of their header. */
+  std::map< unsigned int , VectorLoop > loops;
+
+  /* Vectorize loops in every function of the quad array. */
+  void vectorizeElementLoops();
+
+  /* Limits imposed by the registers available to a vector loop :
+     values and broadcast scalars share %xmm0 - %xmm8. */
+  static const unsigned int MAX_STREAMS = 7 , MAX_REGISTERS = 9;
+
+private:
+  void vectorizeFunction(unsigned int,unsigned int);
+  bool vectorizeLoop(const ControlFlowGraph &,const NaturalLoop &,VectorLoop &);
+  bool assignSlots(VectorLoop &);
+
+  /* Addresses where every symbol of the function occurs. */
+  std::map< std::string , std::vector<unsigned int> > occurrences;
+
+  // returns type of symbol id , and false if id is no symbol
+  bool typeOf(const std::string &,DataType &);
+  // returns wether id is an int constant of given value
+  bool isConstant(const std::string &,int);
+  // returns wether matrix may share its elements with another matrix symbol
+  bool isShared(const std::string &);
+};
+
+#endif /* ! MM_VECTORIZER_H */
@@ -1,7 +1,12 @@
 #include "x86_64gen.hh"
+#include "optimizer.hh"
+#include "cfg.hh"
 
-mm_x86_64::mm_x86_64 (mm_translator & translator)
-  : mic(translator) , fout(std::cout) {
+mm_x86_64::mm_x86_64 (mm_translator & translator, const mm_fusion & _fusion,
+		      const mm_vectorizer & _vectorizer, unsigned int _simdWidth,
+		      unsigned int _unrollLimit)
+  : mic(translator) , fout(std::cout) , fusion(_fusion) , vectorizer(_vectorizer) ,
+    simdWidth(_simdWidth) , unrollLimit(_unrollLimit) {
   int len = mic.file.length();
   constIds = 0;
   tempLabels = 0;
@@ -9,6 +14,22 @@ mm_x86_64::mm_x86_64 (mm_translator & translator)
 
 mm_x86_64::~mm_x86_64 () { }
 
+/* Matrices of the same static shape need no check of their dimensions at run time. */
+static bool sameShape(DataType a , DataType b) {
+  return a.isStaticMatrix() and a == b;
+}
+
+/* Wether a matrix offset addresses an element rather than the header. The
+   elements of a dynamic matrix , which may be a slice , are reached through
+   the address in its header. */
+static bool isElementOffset(const std::string & offset) {
+  try {
+    return std::stoi( offset ) >= (int) MATRIX_HEADER;
+  } catch ( std::invalid_argument ex ) {
+    return true;
+  }
+}
+
 std::tuple< std::string , DataType >
 mm_x86_64::getLocation (const std::string & addr,const ActivationRecord & stack) {
   const size_t BP = 6;
@@ -18,6 +39,11 @@ mm_x86_64::getLocation (const std::string & addr,const ActivationRecord & stack)
     int pos = ref->second;
     retId = std::to_string(stack.acR[pos].second) + "(" + Regs[BP][QUAD] + ")" ;
     retType = stack.acR[pos].first.type ;
+  } else if( ( ref = stack.regMap.find( addr ) ) != stack.regMap.end() ) { // register allocated
+    const Record & record = stack.regR[ref->second];
+    retType = record.first.type ;
+    if( retType == MM_DOUBLE_TYPE ) retId = XReg + std::to_string( record.second );
+    else retId = Regs[record.second][ retType == MM_INT_TYPE ? LONG : QUAD ];
   } else if( ( ref = stack.constMap.find( addr ) ) != stack.constMap.end() ) { // constant literals
     int id = ref->second;
     const Symbol & sym = stack.toC[id];
@@ -33,6 +59,10 @@ mm_x86_64::getLocation (const std::string & addr,const ActivationRecord & stack)
       retId = "$.LS"+std::to_string( sym.value.intVal );
       usedStrings.emplace_back( sym.value.intVal );
     }
+  } else if( ( ref = stack.frameMap.find( addr ) ) != stack.frameMap.end() ) { // caller's , in a loop body
+    const Record & record = stack.frame[ref->second];
+    retId = std::to_string( record.second ) + "(%rbx)" ;
+    retType = record.first.type ;
   } else { // global variables
     const Symbol & sym = mic.getSymbol( mic.lookup( addr ) );
     retType = sym.type;
@@ -41,6 +71,13 @@ mm_x86_64::getLocation (const std::string & addr,const ActivationRecord & stack)
   return std::tie( retId , retType );
 }
 
+std::string mm_x86_64::moveCode(const std::string & movInstr , const std::string & src , const std::string & dst) {
+  if( src == dst ) return "";
+  if( movInstr == "movsd" and src.compare(0,4,XReg) == 0 and dst.compare(0,4,XReg) == 0 )
+    return "\tmovapd\t" + src + ", " + dst + '\n'; // movsd would merge into the old value of dst
+  return '\t' + movInstr + '\t' + src + ", " + dst + '\n';
+}
+
 void mm_x86_64::generateTargetCode() {
 
   // Handle global declarations.
@@ -100,31 +137,40 @@ void mm_x86_64::generateTargetCode() {
 	if( quad.opCode == OP_DECLARE and quad.z == sId ) break;
       }
     } else { // Matrix
-      int remSize = symbol.type.getSize();
+      int size = symbol.type.getSize() , done = 0;
       fout << "\t.globl\t" << name
-	   << "\n\t.align\t16"
+	   << "\n\t.align\t" << MATRIX_HEADER
 	   << "\n\t.type\t" << name << ", @object"
-	   << "\n\t.size\t" << name << ", " << remSize << '\n'
+	   << "\n\t.size\t" << name << ", " << size << '\n'
 	   << name << ':' ;
+      // header writes and initial values come in ascending offsets
+      auto skip = [&](int offset) { // zeros up to offset , but for the addresses of the elements and their block
+	if( done <= (int) MATRIX_DATA and offset > (int) MATRIX_DATA ) {
+	  if( done < (int) MATRIX_DATA ) fout << "\n\t.zero\t" << MATRIX_DATA - done ;
+	  fout << "\n\t.quad\t" << name << "+" << MATRIX_HEADER ;
+	  fout << "\n\t.quad\t" << name ; // at MATRIX_STORE , never shared
+	  done = MATRIX_STORE + 8;
+	}
+	if( offset > done ) fout << "\n\t.zero\t" << offset - done ;
+      };
       for( ; addr < QA.size() ; addr++ ) {
 	const Taco & quad = QA[addr];
 	if( quad.opCode == OP_DECLARE and quad.z == sId ) break;
 	if( quad.opCode == OP_LXC and quad.z == sId ) {
-	  if( quad.x == "0" ) {
-	    fout << "\n\t.long\t" << symbol.type.rows ;
-	    remSize -= 4;
-	  } else if( quad.x == "4" ) {
-	    fout << "\n\t.long\t" << symbol.type.cols ;
-	    remSize -= 4;
+	  int offset = std::stoi( quad.x );
+	  skip( offset );
+	  if( offset < (int) MATRIX_HEADER ) {
+	    fout << "\n\t.long\t" << ( offset == 0 ? symbol.type.rows : symbol.type.cols );
+	    done = offset + SIZE_OF_INT;
 	  } else {
 	    Symbol & sym = mic.getSymbol( mic.lookup( quad.y ) );
 	    int *ptr = (int*) (&sym.value.doubleVal);
 	    fout << "\n\t.long\t" << ptr[0] << "\n\t.long\t" << ptr[1];
-	    remSize -= 8;
+	    done = offset + SIZE_OF_DOUBLE;
 	  }
 	}
       }
-      if( remSize > 0 ) fout << "\n\t.zero\t" << remSize ;
+      skip( size );
       fout << '\n';
     }
   }
@@ -149,11 +195,14 @@ void mm_x86_64::generateTargetCode() {
   fout << "\t.align 8\n.LNEGD:\n\t.long\t0\n\t.long\t-2147483648\n";
   /* Float point unit. */
   fout << "\t.align 8\n.LUNIT:\n\t.long\t0\n\t.long\t1072693248\n";
+  /* Sign masks for packed negation. */
+  fout << "\t.align 32\n.LNEGPD:\n";
+  for( int lane = 0 ; lane < 4 ; lane++ ) fout << "\t.long\t0\n\t.long\t-2147483648\n";
 }
 
 void mm_x86_64::emitFunction(unsigned int from, unsigned int to, unsigned int rootId) {
   // Populate stack
-  ActivationRecord stack(mic,rootId);
+  ActivationRecord stack(mic,rootId,from,to);
   
   // Function header
   SymbolTable & rootTable = mic.tables[rootId];
@@ -169,9 +218,14 @@ void mm_x86_64::emitFunction(unsigned int from, unsigned int to, unsigned int ro
 
   // Align with nearest 16-byte mark
   int frameSize = stack.acR.empty() ? 0 : -stack.acR.back().second ; // last offset
+  if( not stack.savedRegs.empty() ) frameSize = -stack.savedRegs.back().second ;
   while( frameSize & 15 ) frameSize += frameSize & -frameSize;
   if( frameSize > 0 )
     fout << "\tsubq\t$" << frameSize << " , " << Regs[SP][QUAD] << '\n';
+
+  // Save callee-saved registers taken by the register allocator
+  for( const auto & save : stack.savedRegs )
+    fout << "\tmovq\t" << Regs[save.first][QUAD] << " , " << save.second << "(%rbp)\n" ;
   
   // Push parameters onto the stack
   const static int argRegs[] = { 5, 4, 3, 2, 8, 9 };
@@ -193,38 +247,68 @@ void mm_x86_64::emitFunction(unsigned int from, unsigned int to, unsigned int ro
     }
   }
   
+  // Parallel loop bodies reach the variables of the caller through its frame pointer
+  if( stack.outlined ) {
+    const std::vector<Record> & frame = frames[rootTable.name];
+    for(unsigned int index = 0; index < frame.size() ; index++ )
+      stack.frameMap[frame[index].first.id] = index;
+    stack.frame = frame;
+    fout << "\tmovq\t" << std::get<0>( getLocation( rootTable.table[1].id , stack ) ) << " , %rbx\n" ;
+  }
+  
+  // Matrices start out unallocated : temporaries too , as their storage may be resized.
+  // Those in the frame have their elements right after their header.
   for( Record record : stack.acR ) {
     Symbol & symbol = record.first ;
-    if( symbol.type == MM_MATRIX_TYPE and symbol.symType == SymbolType::LOCAL ) {
+    if( symbol.type == MM_MATRIX_TYPE and ( symbol.symType == SymbolType::LOCAL or symbol.symType == SymbolType::TEMP ) ) {
       // emitDeallocatorOps( Taco(OP_DEALLOC , symbol.id) , stack ) ;
       std::string id = std::to_string(record.second) + "(" + Regs[BP][QUAD] + ")" ;
       fout << "\tmovq\t$0, " << id << '\n'; // initialize with 0
+    } else if( symbol.type.isStaticMatrix() ) { // never shared
+      fout << "\tleaq\t" << record.second + (int) MATRIX_HEADER << "(" << Regs[BP][QUAD] << "), " << Regs[0][QUAD] << '\n';
+      fout << "\tmovq\t" << Regs[0][QUAD] << ", " << record.second + (int) MATRIX_DATA << "(" << Regs[BP][QUAD] << ")\n";
+      fout << "\tleaq\t" << record.second << "(" << Regs[BP][QUAD] << "), " << Regs[0][QUAD] << '\n';
+      fout << "\tmovq\t" << Regs[0][QUAD] << ", " << record.second + (int) MATRIX_STORE << "(" << Regs[BP][QUAD] << ")\n";
+      fout << "\tmovl\t$0, " << record.second + (int) MATRIX_REFS << "(" << Regs[BP][QUAD] << ")\n";
     }
   }
   
-  std::vector<int> marks;
   // Mark potential target instructions of all gotos.
-  for(unsigned int index = from + 1; index < to ; index++ ) {
-    const Taco & quad = mic.quadArray[index];
-    if( quad.isJump() ) {
-      marks.emplace_back( atoi(quad.z.c_str()) );
-    }
-  }
-
-  std::sort( marks.begin() , marks.end() , std::greater<int>() );
+  ControlFlowGraph cfg( mic.quadArray , from , to );
+  std::vector<unsigned int> marks( cfg.targets.rbegin() , cfg.targets.rend() );
   
   stdRegs = 0 , fpRegs = 0;
   std::stack<std::string> paramCodes; // to be passed in reverse order
   int paramOffset = 0; // change in %rsp on caller side
   
   for(unsigned int index = from + 1; index < to ; index++ ) {
+    auto vectorized = vectorizer.loops.find( index );
+    if( vectorized != vectorizer.loops.end() )
+      emitVectorLoop( vectorized->second , stack ); // entered only from before the loop
     if( not marks.empty() and marks.back() == index ) {
       fout << ".L" << index << ":\n";
-      while( not marks.empty() and marks.back() == index )
-	marks.pop_back();
+      marks.pop_back();
     }
     const Taco & quad = mic.quadArray[index];
-    if( quad.isJump() ) {
+    auto fused = fusion.loops.find( index );
+    /* A matrix result shares no elements once written : those kept in part
+       are copied over first. */
+    if( fused != fusion.loops.end() ) {
+      const std::vector<std::string> & read = fused->second.matrices;
+      bool keep = std::find( read.begin() , read.end() , fused->second.z ) != read.end();
+      emitUnshare( fused->second.z , keep ? "mm_unshare" : "mm_detach" , stack );
+    } else if( not fusion.absorbed[index] and ( quad.opCode == OP_PLUS or quad.opCode == OP_MINUS or quad.opCode == OP_UMINUS
+						or quad.opCode == OP_MULT or quad.opCode == OP_DIV or quad.opCode == OP_MULT_NT
+						or quad.opCode == OP_MULT_TN or quad.opCode == OP_TRANSPOSE ) ) {
+      emitUnshare( quad.z , quad.z == quad.x or quad.z == quad.y ? "mm_unshare" : "mm_detach" , stack );
+    }
+    if( fused != fusion.loops.end() ) {
+      emitFusedLoop( fused->second , stack ); // emit the whole chain ending here
+      
+    } else if( fusion.absorbed[index] ) {
+      continue; // part of a fused loop
+      
+    } else if( quad.isJump() ) {
       emitJumpOps( quad , stack ); // emit (conditional) jump operation
       
     } else if( quad.isCopy() ) {
@@ -249,7 +333,8 @@ void mm_x86_64::emitFunction(unsigned int from, unsigned int to, unsigned int ro
     } else if( quad.opCode == OP_DEALLOC ) {
       emitDeallocatorOps(quad , stack);
 
-    } else if( quad.opCode == OP_MULT or quad.opCode == OP_DIV or quad.opCode == OP_MOD ) {
+    } else if( quad.opCode == OP_MULT or quad.opCode == OP_DIV or quad.opCode == OP_MOD
+	       or quad.opCode == OP_MULT_NT or quad.opCode == OP_MULT_TN ) {
       emitMultDivOps( quad , stack );
       
     } else if( quad.opCode == OP_RETURN ) {
@@ -286,7 +371,7 @@ void mm_x86_64::emitFunction(unsigned int from, unsigned int to, unsigned int ro
 	  code = "\tmovsd\t"+pId+", %xmm8\n"; paramCodes.push( code );
 	  paramOffset += 8; // push on stack
 	} else {
-	  code = "\tmovsd\t"+pId+", "+XReg+std::to_string(fpRegs++)+'\n';
+	  code = moveCode( "movsd" , pId , XReg+std::to_string(fpRegs++) );
 	  paramCodes.push( code );
 	}
       } else if( pType.isMatrix() ) {
@@ -312,7 +397,22 @@ void mm_x86_64::emitFunction(unsigned int from, unsigned int to, unsigned int ro
 	}
       }
       
-    } else if( quad.opCode == OP_CALL ) {
+    } else if( quad.opCode == OP_CALL or quad.opCode == OP_SPAWN ) {
+      /* Matrices passed to a spawned call get elements of their own first ,
+	 as the tasks writing them would otherwise race to copy them. Slices
+	 passed are handed over to it , and taken afresh the next time their
+	 expression is evaluated. */
+      std::vector<std::string> views;
+      if( quad.opCode == OP_SPAWN )
+	for(unsigned int param = index - 1; param > from and mic.quadArray[param].opCode == OP_PARAM ; param-- ) {
+	  emitUnshare( mic.quadArray[param].z , "mm_unshare" , stack );
+	  if( mic.isView( mic.lookup( mic.quadArray[param].z ) ) ) {
+	    std::string viewId ;
+	    std::tie( viewId , std::ignore ) = getLocation( mic.quadArray[param].z , stack );
+	    fout << "\tmovq\t" << viewId << ", " << Regs[5][QUAD] << "\n\tcall\tmm_pin\n";
+	    views.push_back( viewId );
+	  }
+	}
       if( paramOffset & 15 ) { // align to 16 bytes
 	fout << "\tleaq\t-8(%rsp), %rsp\n";
 	paramOffset += 8;
@@ -321,6 +421,13 @@ void mm_x86_64::emitFunction(unsigned int from, unsigned int to, unsigned int ro
 	fout << paramCodes.top() ;
 	paramCodes.pop();
       }
+      if( quad.opCode == OP_SPAWN ) { // mmSpawn takes the callee after the register arguments
+	fout << "\tleaq\t-8(%rsp), %rsp\n\tleaq\t" << quad.x << "(%rip), %rax\n\tpushq\t%rax\n";
+	fout << "\tcall\tmmSpawn\n\tleaq\t16(%rsp), %rsp\n";
+	for( const std::string & viewId : views ) fout << "\tmovq\t$0, " << viewId << '\n';
+	stdRegs = fpRegs = 0;
+	continue;
+      }
       fout << "\tcall\t" << quad.x << '\n';
       if( paramOffset > 0 )
 	fout << "\tleaq\t" << paramOffset << "(%rsp), %rsp\n" ;// pop parameters off the stack
@@ -329,26 +436,37 @@ void mm_x86_64::emitFunction(unsigned int from, unsigned int to, unsigned int ro
       std::tie( retId , retType ) = getLocation( quad.z , stack );
       if( retType == MM_CHAR_TYPE ) fout << "\tmovb\t"+Regs[0][BYTE]+", "+retId+'\n';
       else if( retType == MM_INT_TYPE ) fout << "\tmovl\t"+Regs[0][LONG]+", "+retId+'\n';
-      else if( retType == MM_DOUBLE_TYPE ) fout << "\tmovsd\t%xmm0, "+retId+'\n';
+      else if( retType == MM_DOUBLE_TYPE ) fout << moveCode( "movsd" , "%xmm0" , retId );
       else fout << "\tmovq\t"+Regs[0][QUAD]+", "+retId+'\n'; // Poinrix / Matter
       
     } else if( quad.opCode == OP_TRANSPOSE ) {
       emitTransposeOps( quad , stack );
       
+    } else if( quad.opCode == OP_PARFOR ) {
+      emitParallelLoop( quad , stack );
+      
     }
   }
   
   fout << ".L" << to << ":\n";
   fout << "\tpushq\t" << Regs[0][QUAD] << '\n';
   fout << "\tleaq\t-8(%rsp), %rsp\n\tmovsd\t%xmm0, (%rsp)\n";
+  // Calls spawned may still use the frame , or matrices about to be freed.
+  for(unsigned int index = from + 1; index < to ; index++ )
+    if( mic.quadArray[index].opCode == OP_SPAWN ) {
+      fout << "\tcall\tmmSync\n";
+      break;
+    }
   // Deallocate all memory on heap , and leave.
   for( Record record : stack.acR ) {
     Symbol & symbol = record.first ;
-    if( symbol.type == MM_MATRIX_TYPE and symbol.symType == SymbolType::LOCAL )
+    if( symbol.type == MM_MATRIX_TYPE and ( symbol.symType == SymbolType::LOCAL or symbol.symType == SymbolType::TEMP ) )
       emitDeallocatorOps( Taco(OP_DEALLOC , symbol.id) , stack ) ;
   }
   fout << "\tmovsd\t(%rsp), %xmm0\n\tleaq\t8(%rsp), %rsp\n";
   fout << "\tpopq\t" << Regs[0][QUAD] << '\n';
+  for( const auto & save : stack.savedRegs )
+    fout << "\tmovq\t" << save.second << "(%rbp) , " << Regs[save.first][QUAD] << '\n' ;
   fout << "\tleave\n\tret\n" ; // return statement
   fout << "\t.size\t" << rootTable.name << ", .-" << rootTable.name << '\n' ;
   
@@ -367,7 +485,7 @@ void mm_x86_64::emitFunction(unsigned int from, unsigned int to, unsigned int ro
 
 void mm_x86_64::emitReturnOps(int retLabel,const Taco & quad , const ActivationRecord & stack) {
   if( stack.retVal.type != MM_VOID_TYPE ) {
-    const size_t BP = 6 , CX = 2 , DX = 3 , SI = 4 , DI = 5 ;
+    const size_t DI = 5 ;
     std::string retId ; DataType retType ;
     std::tie( retId , retType ) = getLocation( quad.z , stack ) ;
     const size_t ACC = 0;
@@ -381,32 +499,24 @@ void mm_x86_64::emitReturnOps(int retLabel,const Taco & quad , const ActivationR
     } else if( retType.isPointer() ) { // pointer
       movInstr = "movq" , regName = Regs[ACC][QUAD];
     } else if( retType.isMatrix() ) {
-      // Allocate memory for matrix to be returned and copy contents.
-      
+      /* Return a matrix of its own , sharing the elements if they are counted.
+	 A dynamic temporary or local dies with the function : it is returned
+	 itself , and left out of the deallocations that follow. */
+      SymbolType symType = mic.getSymbol( mic.lookup( quad.z ) ).symType;
       if( retType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
-      fout << retId << ", " << Regs[DX][QUAD] << '\n';
-      
-      fout << "\tmovl\t("  << Regs[DX][QUAD] << "), " << Regs[DI][LONG] << '\n'; // rows
-      fout << "\timull\t4(" << Regs[DX][QUAD] << "), " << Regs[DI][LONG] << '\n'; // rows * columns
-      fout << "\tincl\t" << Regs[DI][LONG] << '\n';
-      
-      fout << "\tmovq\t$8, "  << Regs[SI][QUAD] << '\n'; // size of each `element'
-      
-      fout << "\tmovslq\t" << Regs[SI][LONG] << ", " << Regs[14][QUAD] << '\n';
-      fout << "\timulq\t" << Regs[DI][QUAD] << ", " << Regs[14][QUAD] << '\n'; // save number of bytes
-      
-      fout << "\tcall\tcalloc\n" ;
-      
-      fout << "\tmovq\t" << Regs[ACC][QUAD] << ", " << Regs[15][QUAD] << '\n'; // save the pointer
-      
-      fout << "\tmovq\t" << Regs[ACC][QUAD] << ", " << Regs[DI][QUAD] << '\n'; // Destination pointer
-      if( retType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
-      fout << retId << ", " << Regs[SI][QUAD] << '\n'; // Source pointer
-      fout << "\tmovq\t" << Regs[14][QUAD] << ", " << Regs[DX][QUAD] << '\n'; // Number of bytes
-      fout << "\tcall\tmemcpy\n";
-      movInstr = "movq" , retId = Regs[15][QUAD] , regName = Regs[ACC][QUAD];
+      fout << retId << ", " << Regs[DI][QUAD] << '\n';
+      if( not retType.isStaticMatrix() and ( symType == SymbolType::TEMP or symType == SymbolType::LOCAL ) ) {
+	fout << "\tcall\tmm_take\n" ;
+	fout << "\tcmpq\t" << Regs[ACC][QUAD] << ", " << retId << '\n';
+	fout << "\tjne\t.LTEMP" << ++tempLabels << '\n';
+	fout << "\tmovq\t$0, " << retId << '\n';
+	fout << ".LTEMP" << tempLabels << ":\n";
+      } else {
+	fout << "\tcall\tmm_share\n" ;
+      }
+      movInstr = "movq" , retId = regName = Regs[ACC][QUAD];
     }
-    fout << '\t' << movInstr << '\t' << retId << ", " << regName << '\n';
+    fout << moveCode( movInstr , retId , regName );
   }
   fout << "\tjmp\t.L" << retLabel << '\n';
 }
@@ -414,6 +524,7 @@ void mm_x86_64::emitReturnOps(int retLabel,const Taco & quad , const ActivationR
 void mm_x86_64::emitMultDivOps(const Taco & quad , const ActivationRecord & stack) {
   if( stack.constMap.find( quad.z ) != stack.constMap.end() )
     return ; // Ignore.
+  if( emitUnrolledOps( quad , stack ) ) return ;
 
   const size_t ACC = 0 , CX = 2 , DX = 3 , SI = 4 , DI = 5;
   DataType retType , xType , yType ;
@@ -453,23 +564,32 @@ void mm_x86_64::emitMultDivOps(const Taco & quad , const ActivationRecord & stac
       else
 	fout << "\tmovl\t" << Regs[DX][LONG] << ", " << zId << '\n';
     } else if( retType == MM_DOUBLE_TYPE ) {
-      fout << "\tmovsd\t" << xId << ", %xmm0\n";
-      fout << "\tmovsd\t" << yId << ", %xmm1\n";
+      fout << moveCode( "movsd" , xId , "%xmm0" );
+      fout << moveCode( "movsd" , yId , "%xmm1" );
       if( quad.opCode == OP_MULT ) fout << "\tmulsd\t%xmm1, %xmm0\n";
       else fout << "\tdivsd\t%xmm1, %xmm0\n";
-      fout << "\tmovsd\t%xmm0, " << zId << '\n';
+      fout << moveCode( "movsd" , "%xmm0" , zId );
     }
     
   } else if( retType.isMatrix() ) {
     
-    if( yType.isMatrix() ) { // matrix multiplication
+    if( yType.isMatrix() and quad.opCode != OP_MULT and quad.x == quad.y ) { // x * x.' or x.' * x
+      if( retType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
+      fout << zId << ", " << Regs[DI][QUAD] << '\n'; // first argument
+      if( xType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
+      fout << xId << ", " << Regs[SI][QUAD] << '\n'; // second argument
+      if( quad.opCode == OP_MULT_NT ) fout << "\tcall\tmatSyrk\n" ;
+      else fout << "\tcall\tmatSyrkT\n" ;
+    } else if( yType.isMatrix() ) { // matrix multiplication
       if( retType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
       fout << zId << ", " << Regs[DI][QUAD] << '\n'; // first argument
       if( xType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
       fout << xId << ", " << Regs[SI][QUAD] << '\n'; // second argument
       if( yType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
       fout << yId << ", " << Regs[DX][QUAD] << '\n'; // third argument
-      fout << "\tcall\tmatMult\n" ;
+      if( quad.opCode == OP_MULT_NT ) fout << "\tcall\tmatMultNT\n" ;
+      else if( quad.opCode == OP_MULT_TN ) fout << "\tcall\tmatMultTN\n" ;
+      else fout << "\tcall\tmatMult\n" ;
     } else {
       
       if( retType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
@@ -478,24 +598,14 @@ void mm_x86_64::emitMultDivOps(const Taco & quad , const ActivationRecord & stac
       if( xType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
       fout << xId << ", " << Regs[SI][QUAD] << '\n';
       
-      fout << "\tmovsd\t" << yId << ", %xmm1\n";
-      fout << "\tmovq\t(" << Regs[DI][QUAD] <<"), " << Regs[DX][QUAD] << '\n';
-      fout << "\tmovq\t(" << Regs[SI][QUAD] <<"), " << Regs[CX][QUAD] << '\n';
-      fout << "\tcmpq\t" << Regs[DX][QUAD] << ", " << Regs[CX][QUAD] << '\n';
-      fout << "\tje\t.LTEMP" << ++tempLabels << "\n\tcall\tabort\n.LTEMP" << tempLabels << ":\n";
-      fout << "\tmovq\t$8, " << Regs[DX][QUAD] << '\n';
-      fout << "\tmovl\t(" << Regs[DI][QUAD] <<"), " << Regs[CX][LONG] << '\n';
-      fout << "\timull\t4(" << Regs[DI][QUAD] <<"), " << Regs[CX][LONG] << '\n';
-      fout << "\tincl\t" << Regs[CX][LONG] << '\n';
-      fout << "\timull\t$8, " << Regs[CX][LONG] << '\n';
-      fout << ".LTEMP" << ++tempLabels << ":\n";
-      fout << "\tmovsd\t(" << Regs[SI][QUAD] << "," << Regs[DX][QUAD] <<"), %xmm0\n";
-      opInstr = ( quad.opCode == OP_MULT ? "mulsd" : "divsd" );
-      fout << '\t' << opInstr << "\t%xmm1, %xmm0\n";
-      fout << "\tmovsd\t%xmm0, (" << Regs[DI][QUAD] << "," << Regs[DX][QUAD] <<")\n";
-      fout << "\taddq\t$8, " << Regs[DX][QUAD] << '\n';
-      fout << "\tcmpq\t" << Regs[DX][QUAD] << ", " << Regs[CX][QUAD] << '\n';
-      fout << "\tjg\t.LTEMP" << tempLabels << "\n";
+      if( not sameShape( retType , xType ) ) {
+	fout << "\tmovq\t(" << Regs[DI][QUAD] <<"), " << Regs[DX][QUAD] << '\n';
+	fout << "\tmovq\t(" << Regs[SI][QUAD] <<"), " << Regs[CX][QUAD] << '\n';
+	fout << "\tcmpq\t" << Regs[DX][QUAD] << ", " << Regs[CX][QUAD] << '\n';
+	fout << "\tje\t.LTEMP" << ++tempLabels << "\n\tcall\tabort\n.LTEMP" << tempLabels << ":\n";
+      }
+      
+      emitElementwiseLoop( quad.opCode , yId );
       
     }
     
@@ -506,6 +616,7 @@ void mm_x86_64::emitMultDivOps(const Taco & quad , const ActivationRecord & stac
 void mm_x86_64::emitPlusMinusOps(const Taco & quad , const ActivationRecord & stack) {
   if( stack.constMap.find( quad.z ) != stack.constMap.end() )
     return ; // Ignore.
+  if( emitUnrolledOps( quad , stack ) ) return ;
   
   const size_t ACC = 0 , CX = 2 , DX = 3 , SI = 4 , DI = 5;
   DataType retType , xType , yType ;
@@ -546,15 +657,15 @@ void mm_x86_64::emitPlusMinusOps(const Taco & quad , const ActivationRecord & st
       movInstr += "sd"; opInstr += "sd";
       alphaReg = XReg+"0" , betaReg = XReg+"1";
     }
-    fout << '\t' << movInstr << '\t' << xId << ", " << alphaReg << '\n';
+    fout << moveCode( movInstr , xId , alphaReg );
     
     if( inc_dec ) {
       fout << '\t' << opInstr << '\t' << alphaReg << '\n';
     } else {
-      fout << '\t' << movInstr << '\t' << yId << ", " << betaReg  << '\n';
+      fout << moveCode( movInstr , yId , betaReg );
       fout << '\t' << opInstr << '\t' << betaReg << ", " << alphaReg << '\n';
     }
-    fout << '\t' << movInstr << '\t' << alphaReg << ", " << zId << '\n';
+    fout << moveCode( movInstr , alphaReg , zId );
     
   } else if( retType.isPointer() ) {
     if( xType.isMatrix() and yType == MM_INT_TYPE ) { // base + offset
@@ -582,38 +693,21 @@ void mm_x86_64::emitPlusMinusOps(const Taco & quad , const ActivationRecord & st
     fout << zId << ", " << Regs[DI][QUAD] << '\n';
     
     if( xType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
-    fout << xId << ", " << Regs[8][QUAD] << '\n';
+    fout << xId << ", " << Regs[SI][QUAD] << '\n';
     
     if( yType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
-    fout << yId << ", " << Regs[9][QUAD] << '\n';
-    
-    fout << "\tmovq\t(" << Regs[DI][QUAD] <<"), " << Regs[DX][QUAD] << '\n';
-    fout << "\tmovq\t(" << Regs[8][QUAD] <<"), " << Regs[CX][QUAD] << '\n';
-    fout << "\tcmpq\t" << Regs[DX][QUAD] << ", " << Regs[CX][QUAD] << '\n';
-    fout << "\tje\t.LTEMP" << ++tempLabels << "\n\tcall\tabort\n.LTEMP" << tempLabels << ":\n";
-    
-    fout << "\tmovq\t(" << Regs[DI][QUAD] <<"), " << Regs[DX][QUAD] << '\n';
-    fout << "\tmovq\t(" << Regs[9][QUAD] <<"), " << Regs[CX][QUAD] << '\n';
-    fout << "\tcmpq\t" << Regs[DX][QUAD] << ", " << Regs[CX][QUAD] << '\n';
-    fout << "\tje\t.LTEMP" << ++tempLabels << "\n\tcall\tabort\n.LTEMP" << tempLabels << ":\n"; // check dimensions
-    
-    fout << "\tmovq\t$8, " << Regs[DX][QUAD] << '\n';
-    fout << "\tmovl\t(" << Regs[DI][QUAD] <<"), " << Regs[CX][LONG] << '\n';
-    fout << "\timull\t4(" << Regs[DI][QUAD] <<"), " << Regs[CX][LONG] << '\n';
-    fout << "\tincl\t" << Regs[CX][LONG] << '\n';
-    fout << "\timull\t$8, " << Regs[CX][LONG] << '\n'; // size in bytes
-    fout << ".LTEMP" << ++tempLabels << ":\n";
-    fout << "\tmovsd\t(" << Regs[8][QUAD] << "," << Regs[DX][QUAD] <<"), %xmm0\n";
-    
-    opInstr = (quad.opCode == OP_PLUS ? "addsd" : "subsd") ;
-    fout << '\t' << opInstr << "\t(" << Regs[9][QUAD] << "," << Regs[DX][QUAD] <<"), %xmm0\n";
-    
-    fout << "\tmovsd\t%xmm0, (" << Regs[DI][QUAD] << "," << Regs[DX][QUAD] <<")\n";
+    fout << yId << ", " << Regs[DX][QUAD] << '\n';
     
-    fout << "\taddq\t$8, " << Regs[DX][QUAD] << '\n';
+    if( not sameShape( retType , xType ) or not sameShape( retType , yType ) ) { // check dimensions
+      fout << "\tmovq\t(" << Regs[DI][QUAD] <<"), " << Regs[ACC][QUAD] << '\n';
+      fout << "\tcmpq\t(" << Regs[SI][QUAD] <<"), " << Regs[ACC][QUAD] << '\n';
+      fout << "\tje\t.LTEMP" << ++tempLabels << "\n\tcall\tabort\n.LTEMP" << tempLabels << ":\n";
+      
+      fout << "\tcmpq\t(" << Regs[DX][QUAD] <<"), " << Regs[ACC][QUAD] << '\n';
+      fout << "\tje\t.LTEMP" << ++tempLabels << "\n\tcall\tabort\n.LTEMP" << tempLabels << ":\n";
+    }
     
-    fout << "\tcmpq\t" << Regs[DX][QUAD] << ", " << Regs[CX][QUAD] << '\n';
-    fout << "\tjg\t.LTEMP" << tempLabels << "\n";
+    emitElementwiseLoop( quad.opCode , "" );
     
   }
   
@@ -622,13 +716,56 @@ void mm_x86_64::emitPlusMinusOps(const Taco & quad , const ActivationRecord & st
 void mm_x86_64::emitAllocatorOps(const Taco & quad , const ActivationRecord & stack) {
   fout << "\t#\t" << quad << '\n';
   
-  const size_t ACC = 0 , DI = 5 , SI = 4 , DX = 3 , CX = 2 ;
+  const size_t ACC = 0 , DI = 5 , SI = 4 , DX = 3 , CX = 2 , R8 = 8 ;
   
   std::string zId , xId , yId ;
   DataType xType , yType ;
   
   std::tie( zId , std::ignore ) = getLocation( quad.z , stack );
   
+  /* Called with the element count in %edi , leaves the storage in %rax with
+     the address of its elements set , and those counted as used once but for
+     scratch storage. A temporary is written in full by the quad that follows ,
+     so its storage is neither cleared nor , if left from an earlier pass
+     through a loop , large enough and not shared , replaced. One with scratch
+     storage in the frame is stored there whenever it fits. */
+  bool temporary = mic.isTemporary( mic.lookup( quad.z ) );
+  auto scratch = mic.scratch.find( quad.z );
+  auto allocate = [&]() {
+    if( scratch != mic.scratch.end() ) {
+      std::string bufferId ; DataType bufferType ;
+      std::tie( bufferId , bufferType ) = getLocation( scratch->second , stack );
+      fout << "\tmovl\t" << Regs[DI][LONG] << ", " << Regs[SI][LONG] << '\n';
+      fout << "\tmovl\t$8, "  << Regs[DX][LONG] << '\n'; // size of each `element'
+      fout << "\tmovq\t" << zId << ", " << Regs[DI][QUAD] << '\n';
+      fout << "\tleaq\t" << bufferId << ", " << Regs[CX][QUAD] << '\n';
+      fout << "\tmovl\t$" << bufferType.getSize() << ", " << Regs[R8][LONG] << '\n';
+      fout << "\tcall\tmm_scratch\n" ;
+    } else if( temporary ) {
+      fout << "\tmovl\t" << Regs[DI][LONG] << ", " << Regs[SI][LONG] << '\n';
+      fout << "\tmovl\t$8, "  << Regs[DX][LONG] << '\n'; // size of each `element'
+      fout << "\tmovq\t" << zId << ", " << Regs[DI][QUAD] << '\n';
+      fout << "\tcall\tmm_resize\n" ;
+    } else {
+      fout << "\tmovl\t$8, "  << Regs[SI][LONG] << '\n'; // size of each `element'
+      fout << "\tcall\tmm_alloc\n" ;
+    }
+    fout << "\tleaq\t" << MATRIX_HEADER << "(" << Regs[ACC][QUAD] << "), " << Regs[DI][QUAD] << '\n';
+    fout << "\tmovq\t" << Regs[DI][QUAD] << ", " << MATRIX_DATA << "(" << Regs[ACC][QUAD] << ")\n"; // elements
+    fout << "\tmovq\t" << Regs[ACC][QUAD] << ", " << MATRIX_STORE << "(" << Regs[ACC][QUAD] << ")\n"; // their block
+    if( scratch != mic.scratch.end() ) {
+      std::string bufferId ;
+      std::tie( bufferId , std::ignore ) = getLocation( scratch->second , stack );
+      fout << "\tleaq\t" << bufferId << ", " << Regs[CX][QUAD] << '\n';
+      fout << "\tcmpq\t" << Regs[CX][QUAD] << ", " << Regs[ACC][QUAD] << '\n';
+      fout << "\tsetne\t" << Regs[CX][BYTE] << '\n';
+      fout << "\tmovzbl\t" << Regs[CX][BYTE] << ", " << Regs[CX][LONG] << '\n';
+      fout << "\tmovl\t" << Regs[CX][LONG] << ", " << MATRIX_REFS << "(" << Regs[ACC][QUAD] << ")\n";
+    } else {
+      fout << "\tmovl\t$1, " << MATRIX_REFS << "(" << Regs[ACC][QUAD] << ")\n";
+    }
+  };
+  
   if( quad.y.empty() ) { // z = alloc( Matrix )
     std::tie( xId , xType ) = getLocation( quad.x , stack );
 
@@ -637,9 +774,8 @@ void mm_x86_64::emitAllocatorOps(const Taco & quad , const ActivationRecord & st
     
     fout << "\tmovl\t("  << Regs[DX][QUAD] << "), " << Regs[DI][LONG] << '\n'; // rows
     fout << "\timull\t4(" << Regs[DX][QUAD] << "), " << Regs[DI][LONG] << '\n'; // rows * columns
-    fout << "\tincl\t" << Regs[DI][LONG] << '\n';
-    fout << "\tmovl\t$8, "  << Regs[SI][LONG] << '\n'; // size of each `element'
-    fout << "\tcall\tcalloc\n" ;
+    fout << "\taddl\t$" << MATRIX_HEADER / SIZE_OF_DOUBLE << ", " << Regs[DI][LONG] << '\n'; // header
+    allocate();
     fout << "\tmovq\t" << Regs[ACC][QUAD] << ", " << zId << '\n';
 
     if( xType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
@@ -649,6 +785,7 @@ void mm_x86_64::emitAllocatorOps(const Taco & quad , const ActivationRecord & st
     fout << "\tmovl\t"  << Regs[DI][LONG] << ", (" << Regs[ACC][QUAD] << ")\n"; // rows
     fout << "\tmovl\t4("  << Regs[DX][QUAD] << "), " << Regs[DI][LONG] << '\n'; // copy
     fout << "\tmovl\t"  << Regs[DI][LONG] << ", 4(" << Regs[ACC][QUAD] << ")\n"; // cols
+    fout << "\tmovl\t"  << Regs[DI][LONG] << ", " << MATRIX_LD << "(" << Regs[ACC][QUAD] << ")\n"; // leading dimension
     
   } else if( quad.x.empty() ) { // z = alloc( Matrix.' )
     std::tie( yId , yType ) = getLocation( quad.y , stack );
@@ -658,9 +795,8 @@ void mm_x86_64::emitAllocatorOps(const Taco & quad , const ActivationRecord & st
     
     fout << "\tmovl\t4("  << Regs[DX][QUAD] << "), " << Regs[DI][LONG] << '\n'; // rows
     fout << "\timull\t(" << Regs[DX][QUAD] << "), " << Regs[DI][LONG] << '\n'; // rows * columns
-    fout << "\tincl\t" << Regs[DI][LONG] << '\n';
-    fout << "\tmovl\t$8, "  << Regs[SI][LONG] << '\n'; // size of each `element'
-    fout << "\tcall\tcalloc\n" ;
+    fout << "\taddl\t$" << MATRIX_HEADER / SIZE_OF_DOUBLE << ", " << Regs[DI][LONG] << '\n'; // header
+    allocate();
     fout << "\tmovq\t" << Regs[ACC][QUAD] << ", " << zId << '\n';
     
     if( yType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
@@ -670,6 +806,7 @@ void mm_x86_64::emitAllocatorOps(const Taco & quad , const ActivationRecord & st
     fout << "\tmovl\t"  << Regs[DI][LONG] << ", (" << Regs[ACC][QUAD] << ")\n"; // rows
     fout << "\tmovl\t("  << Regs[DX][QUAD] << "), " << Regs[DI][LONG] << '\n'; // copy
     fout << "\tmovl\t"  << Regs[DI][LONG] << ", 4(" << Regs[ACC][QUAD] << ")\n"; // cols
+    fout << "\tmovl\t"  << Regs[DI][LONG] << ", " << MATRIX_LD << "(" << Regs[ACC][QUAD] << ")\n"; // leading dimension
     
   } else { // z = alloc( Matrix , Matrix ) or alloc( int , int )
     std::tie( xId , xType ) = getLocation( quad.x , stack );
@@ -684,9 +821,8 @@ void mm_x86_64::emitAllocatorOps(const Taco & quad , const ActivationRecord & st
       
       fout << "\timull\t4(" << Regs[CX][QUAD] << "), " << Regs[DI][LONG] << '\n'; // rows * columns
       
-      fout << "\tincl\t" << Regs[DI][LONG] << '\n';
-      fout << "\tmovl\t$8, "  << Regs[SI][LONG] << '\n'; // size of each `element'
-      fout << "\tcall\tcalloc\n" ;
+      fout << "\taddl\t$" << MATRIX_HEADER / SIZE_OF_DOUBLE << ", " << Regs[DI][LONG] << '\n'; // header
+      allocate();
       fout << "\tmovq\t" << Regs[ACC][QUAD] << ", " << zId << '\n';
       
       if( xType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
@@ -698,37 +834,67 @@ void mm_x86_64::emitAllocatorOps(const Taco & quad , const ActivationRecord & st
       fout << "\tmovl\t"  << Regs[DI][LONG] << ", (" << Regs[ACC][QUAD] << ")\n"; // rows
       fout << "\tmovl\t4("  << Regs[CX][QUAD] << "), " << Regs[DI][LONG] << '\n'; // copy from y
       fout << "\tmovl\t"  << Regs[DI][LONG] << ", 4(" << Regs[ACC][QUAD] << ")\n"; // cols
+      fout << "\tmovl\t"  << Regs[DI][LONG] << ", " << MATRIX_LD << "(" << Regs[ACC][QUAD] << ")\n"; // leading dimension
       
     } else if( xType == MM_INT_TYPE and yType == MM_INT_TYPE ) {
       fout << "\tmovl\t"  << xId << ", " << Regs[DI][LONG] << '\n'; // rows
       fout << "\timull\t"  << yId << ", " << Regs[DI][LONG] << '\n'; // rows * columns
-      fout << "\tincl\t" << Regs[DI][LONG] << '\n';
-      fout << "\tmovl\t$8, "  << Regs[SI][LONG] << '\n'; // size of each `element'
-      fout << "\tcall\tcalloc\n" ;
+      fout << "\taddl\t$" << MATRIX_HEADER / SIZE_OF_DOUBLE << ", " << Regs[DI][LONG] << '\n'; // header
+      allocate();
       fout << "\tmovq\t" << Regs[ACC][QUAD] << ", " << zId << '\n';
       
       fout << "\tmovl\t"  << xId << ", " << Regs[DI][LONG] << '\n'; // copy
       fout << "\tmovl\t"  << Regs[DI][LONG] << ", (" << Regs[ACC][QUAD] << ")\n"; // rows
       fout << "\tmovl\t"  << yId << ", " << Regs[DI][LONG] << '\n'; // copy
       fout << "\tmovl\t"  << Regs[DI][LONG] << ", 4(" << Regs[ACC][QUAD] << ")\n"; // cols
+      fout << "\tmovl\t"  << Regs[DI][LONG] << ", " << MATRIX_LD << "(" << Regs[ACC][QUAD] << ")\n"; // leading dimension
       
     }
   }
   
 }
 
+void mm_x86_64::emitUnshare(const std::string & matrix , const std::string & routine , const ActivationRecord & stack) {
+  const size_t ACC = 0 , DI = 5 ;
+  try {
+    if( mic.getSymbol( mic.lookup( matrix ) ).type != MM_MATRIX_TYPE ) return; // static ones never share
+  } catch( int ) {
+    return;
+  }
+  std::string id ;
+  std::tie( id , std::ignore ) = getLocation( matrix , stack );
+  fout << "\tmovq\t" << id << ", " << Regs[DI][QUAD] << '\n';
+  fout << "\tmovq\t" << MATRIX_STORE << "(" << Regs[DI][QUAD] << "), " << Regs[ACC][QUAD] << '\n';
+  fout << "\tcmpl\t$1, " << MATRIX_REFS << "(" << Regs[ACC][QUAD] << ")\n";
+  fout << "\tjbe\t.LTEMP" << ++tempLabels << '\n';
+  fout << "\tcall\t" << routine << '\n';
+  fout << ".LTEMP" << tempLabels << ":\n";
+}
+
 void mm_x86_64::emitDeallocatorOps(const Taco & quad , const ActivationRecord & stack) {
   const size_t ACC = 0 , ARG1 = 5;
   std::string zId ;
   std::tie( zId , std::ignore ) = getLocation( quad.z , stack );
   fout << "\tmovq\t" << zId << ", " << Regs[ARG1][QUAD] << '\n';
-  fout << "\tcall\tfree\n" ;
+  auto scratch = mic.scratch.find( quad.z );
+  if( scratch != mic.scratch.end() ) { // scratch storage is not freed
+    std::string bufferId ;
+    std::tie( bufferId , std::ignore ) = getLocation( scratch->second , stack );
+    fout << "\tleaq\t" << bufferId << ", " << Regs[ACC][QUAD] << '\n';
+    fout << "\tcmpq\t" << Regs[ACC][QUAD] << ", " << Regs[ARG1][QUAD] << '\n';
+    fout << "\tje\t.LTEMP" << ++tempLabels << '\n';
+    fout << "\tcall\tmm_release\n" ;
+    fout << ".LTEMP" << tempLabels << ":\n";
+  } else {
+    fout << "\tcall\tmm_release\n" ;
+  }
   fout << "\tmovq\t$0, " << zId << '\n';
 }
 
 void mm_x86_64::emitUnaryMinusOps(const Taco & quad , const ActivationRecord & stack) {
   if( stack.constMap.find( quad.z ) != stack.constMap.end() )
     return ; // Ignore.
+  if( emitUnrolledOps( quad , stack ) ) return ;
 
   const size_t ACC = 0 , CX = 2 , DX = 3 , SI = 4 , DI = 5 ;
   DataType retType , rType ;
@@ -743,25 +909,14 @@ void mm_x86_64::emitUnaryMinusOps(const Taco & quad , const ActivationRecord & s
     if( rType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
     fout << xId << ", " << Regs[SI][QUAD] << '\n';
     
-    fout << "\tmovq\t(" << Regs[DI][QUAD] <<"), " << Regs[DX][QUAD] << '\n';
-    fout << "\tmovq\t(" << Regs[SI][QUAD] <<"), " << Regs[CX][QUAD] << '\n';
-    fout << "\tcmpq\t" << Regs[DX][QUAD] << ", " << Regs[CX][QUAD] << '\n';
-    fout << "\tje\t.LTEMP" << ++tempLabels << "\n\tcall\tabort\n.LTEMP" << tempLabels << ":\n";
-    
-    fout << "\tmovq\t$8, " << Regs[DX][QUAD] << '\n';
-    fout << "\tmovl\t(" << Regs[DI][QUAD] <<"), " << Regs[CX][LONG] << '\n';
-    fout << "\timull\t4(" << Regs[DI][QUAD] <<"), " << Regs[CX][LONG] << '\n';
-    fout << "\tincl\t" << Regs[CX][LONG] << '\n';
-    fout << "\timull\t$8, " << Regs[CX][LONG] << '\n';
-    fout << "\tmovsd\t.LNEGD(%rip), %xmm1\n" ;
-    fout << ".LTEMP" << ++tempLabels << ":\n";
-    fout << "\tmovsd\t(" << Regs[SI][QUAD] << "," << Regs[DX][QUAD] <<"), %xmm0\n";
-    fout << "\txorpd\t%xmm1, %xmm0\n" ;
-    fout << "\tmovsd\t%xmm0, (" << Regs[DI][QUAD] << "," << Regs[DX][QUAD] <<")\n";
-    fout << "\taddq\t$8, " << Regs[DX][QUAD] << '\n';
+    if( not sameShape( retType , rType ) ) {
+      fout << "\tmovq\t(" << Regs[DI][QUAD] <<"), " << Regs[DX][QUAD] << '\n';
+      fout << "\tmovq\t(" << Regs[SI][QUAD] <<"), " << Regs[CX][QUAD] << '\n';
+      fout << "\tcmpq\t" << Regs[DX][QUAD] << ", " << Regs[CX][QUAD] << '\n';
+      fout << "\tje\t.LTEMP" << ++tempLabels << "\n\tcall\tabort\n.LTEMP" << tempLabels << ":\n";
+    }
     
-    fout << "\tcmpq\t" << Regs[DX][QUAD] << ", " << Regs[CX][QUAD] << '\n';
-    fout << "\tjg\t.LTEMP" << tempLabels << "\n";
+    emitElementwiseLoop( quad.opCode , "" );
     
   } else {
     if( retType == MM_CHAR_TYPE ) {
@@ -774,61 +929,589 @@ void mm_x86_64::emitUnaryMinusOps(const Taco & quad , const ActivationRecord & s
       fout << "\tnegl\t" << Regs[ACC][LONG] << '\n';
       fout << "\tmovl\t" << Regs[ACC][LONG] << ", " << zId << '\n';
     } else {
-      fout << "\tmovsd\t" << xId << ", %xmm0\n" ;
+      fout << moveCode( "movsd" , xId , "%xmm0" );
       fout << "\tmovsd\t.LNEGD(%rip), %xmm1\n" ;
       fout << "\txorpd\t%xmm1, %xmm0\n" ;
-      fout << "\tmovsd\t%xmm0, " << zId << '\n';
+      fout << moveCode( "movsd" , "%xmm0" , zId );
     }
   }
 }
 
-void mm_x86_64::emitTransposeOps(const Taco & quad , const ActivationRecord & stack) {
+/*
+  Emits the loop body shared by all element-wise matrix operations.
+  Expects the destination in %rdi and the first operand in %rsi , both pointing
+  at matrix headers of equal dimensions. OP_PLUS / OP_MINUS take the second
+  matrix operand from %rdx , OP_MULT / OP_DIV scale by the double at scalarId ,
+  and OP_UMINUS flips signs. simdWidth doubles are processed per packed
+  instruction , two vectors per iteration , the rest by a scalar loop.
+*/
+/*
+  Matrices whose rows are all contiguous , as every matrix but a slice is ,
+  are walked as a single row of all their elements. Otherwise each row is
+  walked in turn , from the address of the elements and the leading dimension
+  of every matrix. The matrices , the row and the number of rows and of
+  elements in a row are kept on the stack meanwhile :
+      (%rsp) row , 8(%rsp) rows , 16(%rsp) elements in a row , 24(%rsp) matrices.
+*/
+std::pair<unsigned int,unsigned int> mm_x86_64::emitRowsBegin(const std::vector<size_t> & regs) {
+  const size_t ACC = 0 , CX = 2 ;
+  unsigned int stridedLabel = ++tempLabels , rowLabel = ++tempLabels , doneLabel = ++tempLabels ;
+  const std::string & dst = Regs[regs[0]][QUAD] ;
+  fout << "\tmovslq\t(" << dst << "), " << Regs[ACC][QUAD] << '\n'; // rows
+  fout << "\tmovslq\t4(" << dst << "), " << Regs[CX][QUAD] << '\n'; // columns
+  for( size_t reg : regs ) {
+    fout << "\tcmpl\t" << MATRIX_LD << "(" << Regs[reg][QUAD] << "), " << Regs[CX][LONG] << '\n';
+    fout << "\tjne\t.LTEMP" << stridedLabel << '\n';
+  }
+  fout << "\timulq\t" << Regs[ACC][QUAD] << ", " << Regs[CX][QUAD] << '\n';
+  fout << "\tmovl\t$1, " << Regs[ACC][LONG] << '\n';
+  fout << ".LTEMP" << stridedLabel << ":\n";
+  fout << "\ttestq\t" << Regs[ACC][QUAD] << ", " << Regs[ACC][QUAD] << '\n';
+  fout << "\tjz\t.LTEMP" << doneLabel << '\n';
+  for( unsigned int k = regs.size() ; k-- > 0 ; ) fout << "\tpushq\t" << Regs[regs[k]][QUAD] << '\n';
+  fout << "\tpushq\t" << Regs[CX][QUAD] << "\n\tpushq\t" << Regs[ACC][QUAD] << "\n\tpushq\t$0\n";
   
-  const size_t ACC = 0 , CX = 2 , DX = 3 , SI = 4 , DI = 5 ;
-  DataType retType , rType ;
-  std::string zId , xId;
-  std::tie( zId , retType ) = getLocation( quad.z , stack );
-  std::tie( xId , rType ) = getLocation( quad.x , stack );
+  /* Address of the row in every matrix. */
+  fout << ".LTEMP" << rowLabel << ":\n";
+  for( unsigned int k = 0 ; k < regs.size() ; k++ ) {
+    const std::string & reg = Regs[regs[k]][QUAD] ;
+    fout << "\tmovq\t" << 24 + 8 * k << "(%rsp), " << Regs[ACC][QUAD] << '\n';
+    fout << "\tmovslq\t" << MATRIX_LD << "(" << Regs[ACC][QUAD] << "), " << reg << '\n';
+    fout << "\timulq\t(%rsp), " << reg << '\n';
+    fout << "\tshlq\t$3, " << reg << '\n';
+    fout << "\taddq\t" << MATRIX_DATA << "(" << Regs[ACC][QUAD] << "), " << reg << '\n';
+  }
+  return std::make_pair( rowLabel , doneLabel );
+}
+
+void mm_x86_64::emitRowsEnd(const std::pair<unsigned int,unsigned int> & labels , const std::vector<size_t> & regs) {
+  const size_t ACC = 0 ;
+  fout << "\tincq\t(%rsp)\n";
+  fout << "\tmovq\t(%rsp), " << Regs[ACC][QUAD] << '\n';
+  fout << "\tcmpq\t8(%rsp), " << Regs[ACC][QUAD] << '\n';
+  fout << "\tjb\t.LTEMP" << labels.first << '\n';
+  fout << "\taddq\t$" << 24 + 8 * regs.size() << ", %rsp\n";
+  fout << ".LTEMP" << labels.second << ":\n";
+}
+
+void mm_x86_64::emitElementwiseLoop(OpCode opCode , const std::string & scalarId) {
+  const size_t CX = 2 , DX = 3 , SI = 4 , DI = 5 , ACC = 0 ;
+  const unsigned int unroll = 2 , step = simdWidth * unroll ;
+  bool binary = ( opCode == OP_PLUS or opCode == OP_MINUS ) ;
+  bool avx = ( simdWidth == 4 ) ;
+  std::string op ;
+  switch( opCode ) {
+  case OP_PLUS : op = "add" ; break;
+  case OP_MINUS : op = "sub" ; break;
+  case OP_MULT : op = "mul" ; break;
+  case OP_DIV : op = "div" ; break;
+  default : op = "xor" ; break; // OP_UMINUS
+  }
   
-  /* Check dimensions */
-  if( retType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
+  /* Scalar operand / sign mask in %xmm1 ( all lanes ). */
+  if( opCode == OP_UMINUS ) {
+    if( avx ) fout << "\tvmovupd\t.LNEGPD(%rip), %ymm1\n";
+    else fout << "\tmovupd\t.LNEGPD(%rip), %xmm1\n";
+  } else if( not binary ) {
+    if( avx ) fout << "\tvbroadcastsd\t" << scalarId << ", %ymm1\n";
+    else fout << "\tmovsd\t" << scalarId << ", %xmm1\n\tunpcklpd\t%xmm1, %xmm1\n";
+  }
+  
+  /* Elements of a row. */
+  std::vector<size_t> regs = { DI , SI };
+  if( binary ) regs.push_back( DX );
+  auto rows = emitRowsBegin( regs );
+  fout << "\tmovq\t16(%rsp), " << Regs[CX][QUAD] << '\n';
+  
+  unsigned int doneLabel = ++tempLabels , remLabel = ++tempLabels ;
+  if( simdWidth > 1 ) {
+    unsigned int shift = 0 , bytes = 8 * simdWidth ;
+    while( (1u << shift) < step ) shift++;
+    fout << "\tmovq\t" << Regs[CX][QUAD] << ", " << Regs[ACC][QUAD] << '\n';
+    fout << "\tshrq\t$" << shift << ", " << Regs[ACC][QUAD] << '\n';
+    fout << "\tjz\t.LTEMP" << remLabel << '\n';
+    unsigned int loopLabel = ++tempLabels ;
+    fout << ".LTEMP" << loopLabel << ":\n";
+    for( unsigned int u = 0 ; u < unroll ; u++ ) {
+      std::string offset = std::to_string( u * bytes ) ;
+      std::string acc = ( avx ? "%ymm" : "%xmm" ) + std::to_string( 2 + u ) ;
+      std::string aux = ( avx ? "%ymm" : "%xmm" ) + std::to_string( 4 + u ) ;
+      std::string arg = ( avx ? "%ymm1" : "%xmm1" ) ;
+      if( avx ) {
+	fout << "\tvmovupd\t" << offset << "(%rsi), " << acc << '\n';
+	if( binary ) fout << "\tv" << op << "pd\t" << offset << "(%rdx), " << acc << ", " << acc << '\n';
+	else fout << "\tv" << op << "pd\t" << arg << ", " << acc << ", " << acc << '\n';
+	fout << "\tvmovupd\t" << acc << ", " << offset << "(%rdi)\n";
+      } else { // SSE2 : packed memory operands must be aligned , load them first
+	fout << "\tmovupd\t" << offset << "(%rsi), " << acc << '\n';
+	if( binary ) {
+	  fout << "\tmovupd\t" << offset << "(%rdx), " << aux << '\n';
+	  fout << '\t' << op << "pd\t" << aux << ", " << acc << '\n';
+	} else {
+	  fout << '\t' << op << "pd\t" << arg << ", " << acc << '\n';
+	}
+	fout << "\tmovupd\t" << acc << ", " << offset << "(%rdi)\n";
+      }
+    }
+    fout << "\taddq\t$" << step * 8 << ", " << Regs[DI][QUAD] << '\n';
+    fout << "\taddq\t$" << step * 8 << ", " << Regs[SI][QUAD] << '\n';
+    if( binary ) fout << "\taddq\t$" << step * 8 << ", " << Regs[DX][QUAD] << '\n';
+    fout << "\tdecq\t" << Regs[ACC][QUAD] << '\n';
+    fout << "\tjnz\t.LTEMP" << loopLabel << '\n';
+    fout << ".LTEMP" << remLabel << ":\n";
+    fout << "\tandq\t$" << step - 1 << ", " << Regs[CX][QUAD] << '\n';
+  } else {
+    fout << "\ttestq\t" << Regs[CX][QUAD] << ", " << Regs[CX][QUAD] << '\n';
+  }
+  
+  /* Remaining elements , one at a time. */
+  fout << "\tjz\t.LTEMP" << doneLabel << '\n';
+  unsigned int scalarLabel = ++tempLabels ;
+  fout << ".LTEMP" << scalarLabel << ":\n";
+  fout << "\tmovsd\t(%rsi), %xmm0\n";
+  if( binary ) fout << '\t' << op << "sd\t(%rdx), %xmm0\n";
+  else if( opCode == OP_UMINUS ) fout << "\txorpd\t%xmm1, %xmm0\n";
+  else fout << '\t' << op << "sd\t%xmm1, %xmm0\n";
+  fout << "\tmovsd\t%xmm0, (%rdi)\n";
+  fout << "\taddq\t$8, " << Regs[DI][QUAD] << '\n';
+  fout << "\taddq\t$8, " << Regs[SI][QUAD] << '\n';
+  if( binary ) fout << "\taddq\t$8, " << Regs[DX][QUAD] << '\n';
+  fout << "\tdecq\t" << Regs[CX][QUAD] << '\n';
+  fout << "\tjnz\t.LTEMP" << scalarLabel << '\n';
+  fout << ".LTEMP" << doneLabel << ":\n";
+  emitRowsEnd( rows , regs );
+  if( avx ) fout << "\tvzeroupper\n"; // the broadcast operands are kept across rows
+}
+
+/*
+  Emits a fused chain of element-wise matrix operations as a single loop ( per
+  row , for slices ). The destination is addressed through %rdi and the matrix
+  operands through %rsi , %rdx , %r8 - %r11 , all indexed by the element
+  counter %rcx.
+  A step value in slot n lives in %xmm<n> , scalar operands are broadcast in
+  %xmm8 - %xmm13 , the sign mask sits in %xmm14 and %xmm15 is scratch.
+*/
+void mm_x86_64::emitFusedLoop(const FusedLoop & loop , const ActivationRecord & stack) {
+  const size_t ACC = 0 , CX = 2 , DI = 5 ;
+  const static size_t matRegs[] = { 4 , 3 , 8 , 9 , 10 , 11 };
+  bool avx = ( simdWidth == 4 ) ;
+  
+  std::string zId ; DataType zType ;
+  std::tie( zId , zType ) = getLocation( loop.z , stack );
+  if( zType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
   fout << zId << ", " << Regs[DI][QUAD] << '\n';
-  if( rType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
-  fout << xId << ", " << Regs[SI][QUAD] << '\n';
-  fout << "\tmovq\t(" << Regs[DI][QUAD] <<"), " << Regs[DX][QUAD] << '\n';
-  fout << "\tmovq\t(" << Regs[SI][QUAD] <<"), " << Regs[CX][QUAD] << '\n';
-  fout << "\tror\t$32, " << Regs[CX][QUAD] << '\n'; // `swap' dimensions
-  fout << "\tcmpq\t" << Regs[DX][QUAD] << ", " << Regs[CX][QUAD] << '\n';
-  fout << "\tje\t.LTEMP" << ++tempLabels << "\n\tcall\tabort\n.LTEMP" << tempLabels << ":\n";
   
-  fout << "\tmovl\t4(" << Regs[DI][QUAD] << "), " << Regs[DX][LONG] << '\n';
-  fout << "\timull\t$8, " << Regs[DX][LONG] << '\n'; // width of row
-  fout << "\tmovl\t" << Regs[DX][LONG] << ", " << Regs[CX][LONG] << '\n'; // store size of matrices in %rcx
-  fout << "\timull\t(" << Regs[DI][QUAD] << "), " << Regs[CX][LONG] << '\n'; // *= rows
+  /* Every matrix operand must have the dimensions of the destination. */
+  std::map<std::string,std::string> location; // operand -> element address or "%n" register
+  fout << "\tmovq\t(" << Regs[DI][QUAD] <<"), " << Regs[ACC][QUAD] << '\n';
+  for( unsigned int i = 0 ; i < loop.matrices.size() ; i++ ) {
+    std::string id ; DataType type ;
+    std::tie( id , type ) = getLocation( loop.matrices[i] , stack );
+    const std::string & reg = Regs[matRegs[i]][QUAD] ;
+    if( type.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
+    fout << id << ", " << reg << '\n';
+    if( not sameShape( zType , type ) ) {
+      fout << "\tcmpq\t(" << reg << "), " << Regs[ACC][QUAD] << '\n';
+      fout << "\tje\t.LTEMP" << ++tempLabels << "\n\tcall\tabort\n.LTEMP" << tempLabels << ":\n";
+    }
+    location[ loop.matrices[i] ] = "(" + reg + "," + Regs[CX][QUAD] + ",8)" ;
+  }
   
-  fout << "\tmovslq\t" << Regs[DX][LONG] << ", " << Regs[DX][QUAD] << '\n'; // in 8 bytes
-  fout << "\tmovslq\t" << Regs[CX][LONG] << ", " << Regs[CX][QUAD] << '\n'; // in 8 bytes
+  /* Scalars and sign mask , in all lanes. */
+  for( unsigned int i = 0 ; i < loop.scalars.size() ; i++ ) {
+    std::string id ; DataType type ;
+    std::tie( id , type ) = getLocation( loop.scalars[i] , stack );
+    std::string reg = std::to_string( 8 + i ) ;
+    if( avx ) fout << "\tvbroadcastsd\t" << id << ", %ymm" << reg << '\n';
+    else {
+      fout << "\tmovsd\t" << id << ", %xmm" << reg << '\n';
+      if( simdWidth > 1 ) fout << "\tunpcklpd\t%xmm" << reg << ", %xmm" << reg << '\n';
+    }
+    location[ loop.scalars[i] ] = "%" + reg ;
+  }
+  for( const FusedStep & step : loop.steps ) {
+    if( step.opCode != OP_UMINUS ) continue;
+    if( avx ) fout << "\tvmovupd\t.LNEGPD(%rip), %ymm14\n";
+    else fout << "\tmovupd\t.LNEGPD(%rip), %xmm14\n";
+    break;
+  }
+  
+  /* One element ( packed or not ) of the whole chain. */
+  auto emitBody = [&]( bool packed ) {
+    bool vex = packed and avx ;
+    std::string reg = vex ? "%ymm" : "%xmm" , type = packed ? "pd" : "sd" ;
+    std::string move = vex ? "vmovupd" : ( packed ? "movupd" : "movsd" ) ;
+    auto operand = [&]( const std::string & id ) {
+      if( id[0] == '%' ) return reg + std::to_string( loop.steps[ atoi( id.c_str() + 1 ) ].slot ) ;
+      std::string loc = location[id] ;
+      return loc[0] == '%' ? reg + loc.substr(1) : loc ;
+    };
+    for( const FusedStep & step : loop.steps ) {
+      std::string dst = reg + std::to_string( step.slot ) , x = operand( step.x ) , y , op = type ;
+      switch( step.opCode ) {
+      case OP_PLUS : op = "add" + type ; break;
+      case OP_MINUS : op = "sub" + type ; break;
+      case OP_MULT : op = "mul" + type ; break;
+      case OP_DIV : op = "div" + type ; break;
+      default : op = "xorpd" ; break; // OP_UMINUS
+      }
+      y = ( step.opCode == OP_UMINUS ) ? reg + "14" : operand( step.y ) ;
+      if( vex ) {
+	if( x[0] != '%' ) {
+	  fout << "\tvmovupd\t" << x << ", " << dst << '\n';
+	  x = dst;
+	}
+	fout << "\tv" << op << '\t' << y << ", " << x << ", " << dst << '\n';
+      } else { // SSE2 : packed memory operands must be aligned , load them first
+	if( x[0] != '%' ) fout << '\t' << move << '\t' << x << ", " << dst << '\n';
+	else if( x != dst ) fout << "\tmovapd\t" << x << ", " << dst << '\n';
+	if( packed and y[0] != '%' ) {
+	  fout << "\tmovupd\t" << y << ", %xmm15\n";
+	  y = "%xmm15";
+	}
+	fout << '\t' << op << '\t' << y << ", " << dst << '\n';
+      }
+    }
+    fout << '\t' << move << '\t' << reg << loop.steps.back().slot
+	 << ", (" << Regs[DI][QUAD] << "," << Regs[CX][QUAD] << ",8)\n";
+  };
   
-  fout << "\txorq\t" << Regs[8][QUAD] << ", " << Regs[8][QUAD] << '\n';
-  fout << "\txorq\t" << Regs[9][QUAD] << ", " << Regs[9][QUAD] << '\n'; // %r8 = %r9 = 0
+  /* Elements of a row. */
+  auto emitCount = [&]() {
+    fout << "\tmovq\t16(%rsp), " << Regs[ACC][QUAD] << '\n';
+  };
   
-  unsigned int loopLabel = ++tempLabels;
-  fout << ".LTEMP" << loopLabel << ":\n";
+  std::vector<size_t> regs = { DI };
+  regs.insert( regs.end() , matRegs , matRegs + loop.matrices.size() );
+  auto rows = emitRowsBegin( regs );
+  unsigned int doneLabel = ++tempLabels ;
+  emitCount();
+  fout << "\txorl\t" << Regs[CX][LONG] << ", " << Regs[CX][LONG] << '\n';
+  if( simdWidth > 1 ) {
+    unsigned int remLabel = ++tempLabels , loopLabel = ++tempLabels ;
+    fout << "\tandq\t$-" << simdWidth << ", " << Regs[ACC][QUAD] << '\n';
+    fout << "\tjz\t.LTEMP" << remLabel << '\n';
+    fout << ".LTEMP" << loopLabel << ":\n";
+    emitBody( true );
+    fout << "\taddq\t$" << simdWidth << ", " << Regs[CX][QUAD] << '\n';
+    fout << "\tcmpq\t" << Regs[ACC][QUAD] << ", " << Regs[CX][QUAD] << '\n';
+    fout << "\tjb\t.LTEMP" << loopLabel << '\n';
+    fout << ".LTEMP" << remLabel << ":\n";
+    emitCount();
+  }
   
-  fout << "\tmovsd\t8(%rsi,%r9), %xmm0\n";
-  fout << "\tmovsd\t%xmm0, 8(%rdi,%r8)\n";
+  /* Remaining elements , one at a time. */
+  unsigned int scalarLabel = ++tempLabels ;
+  fout << "\tcmpq\t" << Regs[ACC][QUAD] << ", " << Regs[CX][QUAD] << '\n';
+  fout << "\tjae\t.LTEMP" << doneLabel << '\n';
+  fout << ".LTEMP" << scalarLabel << ":\n";
+  emitBody( false );
+  fout << "\tincq\t" << Regs[CX][QUAD] << '\n';
+  fout << "\tcmpq\t" << Regs[ACC][QUAD] << ", " << Regs[CX][QUAD] << '\n';
+  fout << "\tjb\t.LTEMP" << scalarLabel << '\n';
+  fout << ".LTEMP" << doneLabel << ":\n";
+  emitRowsEnd( rows , regs );
+  if( avx ) fout << "\tvzeroupper\n"; // the broadcast operands are kept across rows
+}
+
+/*
+  Emits the packed loop running ahead of a vectorized loop's header. Stream k
+  is addressed through the k-th of %rsi , %rdi , %rdx , %r8 - %r11 , the vector
+  iterations are counted down in %rcx and their number kept in %rax. Step
+  values take %xmm0 upwards , broadcast scalars and the sign mask %xmm8
+  downwards. Counter and offsets are then advanced past the iterations done ,
+  and the original loop runs the remaining ones.
+*/
+void mm_x86_64::emitVectorLoop(const VectorLoop & loop , const ActivationRecord & stack) {
+  const size_t ACC = 0 , CX = 2 ;
+  const static size_t streamRegs[] = { 4 , 5 , 3 , 8 , 9 , 10 , 11 };
+  bool avx = ( simdWidth == 4 ) ;
+  unsigned int shift = ( avx ? 2 : 1 ) , skipLabel = ++tempLabels ;
+  std::string reg = avx ? "%ymm" : "%xmm" , move = avx ? "vmovupd" : "movupd" ;
+
+  /* Matrices stored to , with elements of their own. */
+  for( const FusedStep & step : loop.steps )
+    if( step.opCode == OP_LXC )
+      emitUnshare( loop.streams[ atoi( step.x.c_str() + 1 ) ].first , "mm_unshare_regs" , stack );
+
+  /* Element addresses of every stream. */
+  for( unsigned int k = 0 ; k < loop.streams.size() ; k++ ) {
+    std::string matrixId , offsetId ; DataType type ;
+    std::tie( matrixId , type ) = getLocation( loop.streams[k].first , stack );
+    std::tie( offsetId , std::ignore ) = getLocation( loop.streams[k].second , stack );
+    const std::string & ptr = Regs[streamRegs[k]][QUAD] ;
+    fout << "\tmovslq\t" << offsetId << ", " << ptr << '\n';
+    if( type.isStaticMatrix() ) {
+      fout << "\tleaq\t" << matrixId << ", " << Regs[ACC][QUAD] << '\n';
+      fout << "\taddq\t" << Regs[ACC][QUAD] << ", " << ptr << '\n';
+    } else { // offsets count the header
+      fout << "\tmovq\t" << matrixId << ", " << Regs[ACC][QUAD] << '\n';
+      fout << "\tmovq\t" << MATRIX_DATA << "(" << Regs[ACC][QUAD] << "), " << Regs[ACC][QUAD] << '\n';
+      fout << "\tleaq\t-" << MATRIX_HEADER << "(" << Regs[ACC][QUAD] << "," << ptr << "), " << ptr << '\n';
+    }
+  }
+
+  /* Number of vector iterations , if any. */
+  std::string counterId , boundId ;
+  std::tie( counterId , std::ignore ) = getLocation( loop.counter , stack );
+  std::tie( boundId , std::ignore ) = getLocation( loop.bound , stack );
+  fout << "\tmovl\t" << boundId << ", " << Regs[CX][LONG] << '\n';
+  fout << "\tmovslq\t" << Regs[CX][LONG] << ", " << Regs[CX][QUAD] << '\n';
+  fout << "\tmovslq\t" << counterId << ", " << Regs[ACC][QUAD] << '\n';
+  fout << "\tsubq\t" << Regs[ACC][QUAD] << ", " << Regs[CX][QUAD] << '\n';
+  if( loop.inclusive ) fout << "\tincq\t" << Regs[CX][QUAD] << '\n';
+  fout << "\tsarq\t$" << shift << ", " << Regs[CX][QUAD] << '\n';
+  fout << "\ttestq\t" << Regs[CX][QUAD] << ", " << Regs[CX][QUAD] << '\n';
+  fout << "\tjle\t.LTEMP" << skipLabel << '\n';
+  fout << "\tmovq\t" << Regs[CX][QUAD] << ", " << Regs[ACC][QUAD] << '\n';
+
+  /* Scalars and sign mask , in all lanes. */
+  for( unsigned int i = 0 ; i < loop.scalars.size() ; i++ ) {
+    std::string id , dst = std::to_string( 8 - i ) ;
+    std::tie( id , std::ignore ) = getLocation( loop.scalars[i] , stack );
+    if( not avx ) {
+      fout << moveCode( "movsd" , id , "%xmm" + dst );
+      fout << "\tunpcklpd\t%xmm" << dst << ", %xmm" << dst << '\n';
+    } else if( id.compare( 0 , 4 , XReg ) == 0 ) { // vbroadcastsd only takes memory before AVX2
+      fout << "\tvmovddup\t" << id << ", %xmm" << dst << '\n';
+      fout << "\tvinsertf128\t$1, %xmm" << dst << ", %ymm" << dst << ", %ymm" << dst << '\n';
+    } else {
+      fout << "\tvbroadcastsd\t" << id << ", %ymm" << dst << '\n';
+    }
+  }
+  std::string mask = reg + std::to_string( 8 - loop.scalars.size() ) ;
+  if( loop.negates ) fout << '\t' << move << "\t.LNEGPD(%rip), " << mask << '\n';
+
+  auto operand = [&]( const std::string & id ) {
+    if( id[0] == '%' ) return reg + std::to_string( loop.steps[ atoi( id.c_str() + 1 ) ].slot ) ;
+    unsigned int i = std::find( loop.scalars.begin() , loop.scalars.end() , id ) - loop.scalars.begin() ;
+    return reg + std::to_string( 8 - i ) ;
+  };
+  auto element = [&]( const std::string & id ) {
+    return "(" + Regs[ streamRegs[ atoi( id.c_str() + 1 ) ] ][QUAD] + ")" ;
+  };
+
+  unsigned int loopLabel = ++tempLabels ;
+  fout << ".LTEMP" << loopLabel << ":\n";
+  for( const FusedStep & step : loop.steps ) {
+    std::string dst = reg + std::to_string( step.slot ) , op ;
+    switch( step.opCode ) {
+    case OP_RXC : fout << '\t' << move << '\t' << element( step.x ) << ", " << dst << '\n'; continue;
+    case OP_LXC : fout << '\t' << move << '\t' << operand( step.y ) << ", " << element( step.x ) << '\n'; continue;
+    case OP_PLUS : op = "addpd" ; break;
+    case OP_MINUS : op = "subpd" ; break;
+    case OP_MULT : op = "mulpd" ; break;
+    case OP_DIV : op = "divpd" ; break;
+    default : op = "xorpd" ; break; // OP_UMINUS
+    }
+    std::string x = operand( step.x ) , y = ( step.opCode == OP_UMINUS ) ? mask : operand( step.y ) ;
+    if( avx ) {
+      fout << "\tv" << op << '\t' << y << ", " << x << ", " << dst << '\n';
+    } else {
+      if( x != dst ) fout << "\tmovapd\t" << x << ", " << dst << '\n';
+      fout << '\t' << op << '\t' << y << ", " << dst << '\n';
+    }
+  }
+  for( unsigned int k = 0 ; k < loop.streams.size() ; k++ )
+    fout << "\taddq\t$" << ( 8 << shift ) << ", " << Regs[streamRegs[k]][QUAD] << '\n';
+  fout << "\tdecq\t" << Regs[CX][QUAD] << '\n';
+  fout << "\tjnz\t.LTEMP" << loopLabel << '\n';
+  if( avx ) fout << "\tvzeroupper\n";
+
+  /* Skip the iterations done. */
+  fout << "\tshlq\t$" << shift << ", " << Regs[ACC][QUAD] << '\n';
+  fout << "\taddl\t" << Regs[ACC][LONG] << ", " << counterId << '\n';
+  fout << "\tleal\t0(," << Regs[ACC][QUAD] << ",8), " << Regs[CX][LONG] << '\n';
+  for( const std::string & offset : loop.offsets ) {
+    std::string offsetId ;
+    std::tie( offsetId , std::ignore ) = getLocation( offset , stack );
+    fout << "\taddl\t" << Regs[CX][LONG] << ", " << offsetId << '\n';
+  }
+  fout << ".LTEMP" << skipLabel << ":\n";
+}
+
+/*
+  Emits a matrix operation on small static matrices as straight-line code :
+  elements are addressed at constant offsets from %rdi ( destination ) , %rsi
+  and %rdx ( operands ) , and computed in %xmm0 - %xmm7 , simdWidth at a time
+  where rows allow. Covers element-wise operations , transposition and
+  products , when every matrix has at most unrollLimit elements and the
+  destination is none of the operands of a transposition or product.
+  Returns false , emitting nothing , for any other quad.
+*/
+bool mm_x86_64::emitUnrolledOps(const Taco & quad , const ActivationRecord & stack) {
+  const size_t DX = 3 , SI = 4 , DI = 5 ;
+  std::string zId , xId , yId ;
+  DataType zType , xType , yType ;
+  std::tie( zId , zType ) = getLocation( quad.z , stack );
+  if( not zType.isStaticMatrix() or zType.rows * zType.cols > unrollLimit ) return false;
+  std::tie( xId , xType ) = getLocation( quad.x , stack );
+  if( not xType.isStaticMatrix() or xType.rows * xType.cols > unrollLimit ) return false;
+  if( not quad.y.empty() and stack.constMap.find( quad.y ) == stack.constMap.end() ) // constants looked up once used
+    std::tie( yId , yType ) = getLocation( quad.y , stack );
+  bool yMatrix = yType.isMatrix();
+  if( yMatrix and ( not yType.isStaticMatrix() or yType.rows * yType.cols > unrollLimit ) ) return false;
+
+  bool product = yMatrix and ( quad.opCode == OP_MULT or quad.opCode == OP_MULT_NT or quad.opCode == OP_MULT_TN );
+  bool transpose = ( quad.opCode == OP_TRANSPOSE );
+  bool elementwise = ( quad.opCode == OP_UMINUS ) or ( ( quad.opCode == OP_PLUS or quad.opCode == OP_MINUS ) and yMatrix )
+    or ( ( quad.opCode == OP_MULT or quad.opCode == OP_DIV ) and not yMatrix );
+  if( elementwise ) {
+    if( xType != zType or ( yMatrix and yType != zType ) ) return false;
+  } else if( transpose ) {
+    if( xType.rows != zType.cols or xType.cols != zType.rows or quad.z == quad.x ) return false;
+  } else if( product ) {
+    if( quad.z == quad.x or quad.z == quad.y ) return false;
+  } else {
+    return false;
+  }
+
+  /* Product z = X * Y , with X m * p and Y p * n read off x and y as stored. */
+  unsigned int p = 0;
+  if( product ) {
+    DataType X = xType , Y = yType;
+    if( quad.opCode == OP_MULT_TN ) std::swap( X.rows , X.cols );
+    if( quad.opCode == OP_MULT_NT ) std::swap( Y.rows , Y.cols );
+    if( X.rows != zType.rows or Y.cols != zType.cols or X.cols != Y.rows ) return false;
+    p = X.cols;
+  }
+
+  bool avx = ( simdWidth == 4 ) ;
+  std::string pre = ( avx ? "v" : "" ) , vec = ( avx ? "%ymm" : "%xmm" );
+  auto elem = [](unsigned int index , const std::string & base) { // address of element index
+    return std::to_string( MATRIX_HEADER + SIZE_OF_DOUBLE * index ) + "(" + base + ")";
+  };
+  // op of width w ( 1 or simdWidth ) , dst = dst op src , src a register or an address
+  auto arith = [&](const std::string & op , unsigned int w , const std::string & src , unsigned int dst) {
+    std::string reg = ( w > 1 ? vec : std::string("%xmm") ) + std::to_string( dst );
+    if( avx ) fout << "\tv" << op << ( w > 1 ? "pd\t" : "sd\t" ) << src << ", " << reg << ", " << reg << '\n';
+    else fout << '\t' << op << ( w > 1 ? "pd\t" : "sd\t" ) << src << ", " << reg << '\n';
+  };
+  auto load = [&](const std::string & from , unsigned int w , unsigned int dst) {
+    fout << '\t' << pre << ( w > 1 ? "movupd\t" : "movsd\t" ) << from << ", "
+	 << ( w > 1 ? vec : std::string("%xmm") ) << dst << '\n';
+  };
+  auto store = [&](unsigned int src , unsigned int w , const std::string & to) {
+    fout << '\t' << pre << ( w > 1 ? "movupd\t" : "movsd\t" )
+	 << ( w > 1 ? vec : std::string("%xmm") ) << src << ", " << to << '\n';
+  };
+
+  fout << "\tleaq\t" << zId << ", " << Regs[DI][QUAD] << '\n';
+  fout << "\tleaq\t" << xId << ", " << Regs[SI][QUAD] << '\n';
+  if( yMatrix ) fout << "\tleaq\t" << yId << ", " << Regs[DX][QUAD] << '\n';
+
+  if( elementwise ) {
+    std::string op ;
+    switch( quad.opCode ) {
+    case OP_PLUS : op = "add" ; break;
+    case OP_MINUS : op = "sub" ; break;
+    case OP_MULT : op = "mul" ; break;
+    case OP_DIV : op = "div" ; break;
+    default : op = "xor" ; break; // OP_UMINUS
+    }
+    /* Scalar operand / sign mask in %xmm7 ( all lanes ). */
+    if( quad.opCode == OP_UMINUS ) {
+      fout << '\t' << pre << "movupd\t.LNEGPD(%rip), " << vec << "7\n";
+    } else if( not yMatrix ) {
+      if( yId.empty() ) std::tie( yId , std::ignore ) = getLocation( quad.y , stack );
+      if( avx ) fout << "\tvbroadcastsd\t" << yId << ", %ymm7\n";
+      else fout << "\tmovsd\t" << yId << ", %xmm7\n\tunpcklpd\t%xmm7, %xmm7\n";
+    }
+    unsigned int count = zType.rows * zType.cols , chunk = 0;
+    for( unsigned int k = 0 ; k < count ; chunk++ ) {
+      unsigned int w = ( k + simdWidth <= count ? simdWidth : 1 ) , acc = 2 * ( chunk % 3 ) ;
+      load( elem( k , "%rsi" ) , w , acc );
+      if( yMatrix ) {
+	if( w > 1 and not avx ) { // SSE2 : packed memory operands must be aligned
+	  load( elem( k , "%rdx" ) , w , acc + 1 );
+	  arith( op , w , "%xmm" + std::to_string( acc + 1 ) , acc );
+	} else {
+	  arith( op , w , elem( k , "%rdx" ) , acc );
+	}
+      } else if( quad.opCode == OP_UMINUS ) { // xorpd , which has no scalar form
+	std::string mask = ( w > 1 ? vec : std::string("%xmm") ) + "7" ;
+	std::string reg = ( w > 1 ? vec : std::string("%xmm") ) + std::to_string( acc );
+	if( avx ) fout << "\tvxorpd\t" << mask << ", " << reg << ", " << reg << '\n';
+	else fout << "\txorpd\t" << mask << ", " << reg << '\n';
+      } else {
+	arith( op , w , ( w > 1 ? vec : std::string("%xmm") ) + "7" , acc );
+      }
+      store( acc , w , elem( k , "%rdi" ) );
+      k += w;
+    }
+
+  } else if( transpose ) { // z[i][j] = x[j][i] , pairs of z elements gathered in one register
+    unsigned int reg = 0;
+    for( unsigned int i = 0 ; i < zType.rows ; i++ )
+      for( unsigned int j = 0 ; j < zType.cols ; ) {
+	std::string r = "%xmm" + std::to_string( reg++ % 8 );
+	fout << '\t' << pre << "movsd\t" << elem( j * xType.cols + i , "%rsi" ) << ", " << r << '\n';
+	if( simdWidth > 1 and j + 1 < zType.cols ) {
+	  if( avx ) fout << "\tvmovhpd\t" << elem( ( j + 1 ) * xType.cols + i , "%rsi" ) << ", " << r << ", " << r << '\n';
+	  else fout << "\tmovhpd\t" << elem( ( j + 1 ) * xType.cols + i , "%rsi" ) << ", " << r << '\n';
+	  fout << '\t' << pre << "movupd\t" << r << ", " << elem( i * zType.cols + j , "%rdi" ) << '\n';
+	  j += 2;
+	} else {
+	  fout << '\t' << pre << "movsd\t" << r << ", " << elem( i * zType.cols + j , "%rdi" ) << '\n';
+	  j++;
+	}
+      }
+
+  } else { // product : rows of z in groups of up to 4 accumulators , %xmm4 - %xmm5 for products
+    auto X = [&](unsigned int i , unsigned int k) {
+      return quad.opCode == OP_MULT_TN ? k * xType.cols + i : i * xType.cols + k ;
+    };
+    auto Y = [&](unsigned int k , unsigned int j) {
+      return quad.opCode == OP_MULT_NT ? j * yType.cols + k : k * yType.cols + j ;
+    };
+    bool rowsOfY = ( quad.opCode != OP_MULT_NT ); // Y(k,j) , Y(k,j+1) adjacent
+    unsigned int n = zType.cols;
+    for( unsigned int i = 0 ; i < zType.rows ; i++ ) {
+      std::vector< std::pair<unsigned int,unsigned int> > chunks; // first column , width
+      for( unsigned int j = 0 ; j < n ; ) {
+	unsigned int w = ( rowsOfY and j + simdWidth <= n ? simdWidth : 1 );
+	chunks.emplace_back( j , w );
+	j += w;
+      }
+      for( unsigned int g = 0 ; g < chunks.size() ; g += 4 ) {
+	unsigned int size = std::min( (unsigned int)chunks.size() - g , 4u );
+	for( unsigned int k = 0 ; k < p ; k++ ) {
+	  if( avx ) fout << "\tvbroadcastsd\t" << elem( X(i,k) , "%rsi" ) << ", %ymm6\n";
+	  else fout << "\tmovsd\t" << elem( X(i,k) , "%rsi" ) << ", %xmm6\n\tunpcklpd\t%xmm6, %xmm6\n";
+	  for( unsigned int c = 0 ; c < size ; c++ ) {
+	    unsigned int j = chunks[g+c].first , w = chunks[g+c].second , tmp = 4 + c % 2 ;
+	    std::string t = ( w > 1 ? vec : std::string("%xmm") ) + std::to_string( tmp );
+	    std::string acc = ( w > 1 ? vec : std::string("%xmm") ) + std::to_string( c );
+	    load( elem( Y(k,j) , "%rdx" ) , w , tmp );
+	    arith( "mul" , w , ( w > 1 ? vec : std::string("%xmm") ) + "6" , tmp );
+	    if( k == 0 ) fout << '\t' << pre << "movapd\t" << t << ", " << acc << '\n';
+	    else arith( "add" , w , t , c );
+	  }
+	}
+	for( unsigned int c = 0 ; c < size ; c++ )
+	  store( c , chunks[g+c].second , elem( i * n + chunks[g+c].first , "%rdi" ) );
+      }
+    }
+  }
+  if( avx ) fout << "\tvzeroupper\n";
+  return true;
+}
+
+void mm_x86_64::emitTransposeOps(const Taco & quad , const ActivationRecord & stack) {
+  if( emitUnrolledOps( quad , stack ) ) return ;
   
-  fout << "\taddq\t%rdx,%r8\n"; // %r8 += row-width
-  fout << "\tmovq\t%rcx, %rax\n";
-  fout << "\tcmpq\t%r8, %rax\n"; // %r8 < %rcx ?
-  fout << "\tjg\t.LTEMP" << ++tempLabels << '\n';
-  fout << "\tsubq\t%rcx, %r8\n";
-  fout << "\taddq\t$8, %r8\n";
+  const size_t SI = 4 , DI = 5 ;
+  DataType retType , rType ;
+  std::string zId , xId;
+  std::tie( zId , retType ) = getLocation( quad.z , stack );
+  std::tie( xId , rType ) = getLocation( quad.x , stack );
   
-  fout << ".LTEMP" << tempLabels << ":\n";
-  fout << "\taddq\t$8,%r9\n"; // %r9 += 8
-  fout << "\tcmpq\t%r9, %rcx\n"; // %r9 < %rcx ?
-  fout << "\tjg\t.LTEMP" << loopLabel << '\n';
+  /* Blocked transpose in the runtime , which also checks dimensions. */
+  if( retType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
+  fout << zId << ", " << Regs[DI][QUAD] << '\n'; // first argument
+  if( rType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
+  fout << xId << ", " << Regs[SI][QUAD] << '\n'; // second argument
+  fout << "\tcall\tmatTranspose\n" ;
   
 }
 
@@ -847,7 +1530,7 @@ void mm_x86_64::emitConversionOps(const Taco & quad , const ActivationRecord & s
       fout << "\tmovl\t" << xId << ", " << Regs[ACC][LONG] << '\n';
       fout << "\tmovb\t" << Regs[ACC][BYTE] << ", " << zId << '\n';
     } else if( rType == MM_DOUBLE_TYPE ) {
-      fout << "\tmovsd\t" << xId << ", %xmm0\n";
+      fout << moveCode( "movsd" , xId , "%xmm0" );
       fout << "\tcvttsd2si\t%xmm0, " << Regs[ACC][LONG] << '\n';
       fout << "\tmovb\t" << Regs[ACC][BYTE] << ", " << zId << '\n';
     }
@@ -857,7 +1540,7 @@ void mm_x86_64::emitConversionOps(const Taco & quad , const ActivationRecord & s
       fout << "\tmovzbl\t" << Regs[ACC][BYTE] << ", " << Regs[ACC][LONG] << '\n';
       fout << "\tmovl\t" << Regs[ACC][LONG] << ", " << zId << '\n';
     } else if( rType == MM_DOUBLE_TYPE ) {
-      fout << "\tmovsd\t" << xId << ", %xmm0\n";
+      fout << moveCode( "movsd" , xId , "%xmm0" );
       fout << "\tcvttsd2si\t%xmm0, " << Regs[ACC][LONG] << '\n';
       fout << "\tmovl\t" << Regs[ACC][LONG] << ", " << zId << '\n';
     }
@@ -869,7 +1552,7 @@ void mm_x86_64::emitConversionOps(const Taco & quad , const ActivationRecord & s
       fout << "\tmovl\t" << xId << ", " << Regs[ACC][LONG] << '\n';
     }
     fout << "\tcvtsi2sd\t" << Regs[ACC][LONG] << ", %xmm0\n" ;
-    fout << "\tmovsd\t%xmm0, " << zId << '\n';
+    fout << moveCode( "movsd" , "%xmm0" , zId );
   }
 
 }
@@ -878,7 +1561,7 @@ void mm_x86_64::emitCopyOps(const Taco & quad , const ActivationRecord & stack)
   const size_t BP = 6 , ACC = 0 , CX = 2 , DX = 3 , SI = 4 , DI = 5 , PTR = 3;
   switch(quad.opCode) {
     
-  case OP_COPY : {
+  case OP_COPY : case OP_MOVE : {
     if( stack.constMap.find( quad.z ) != stack.constMap.end() )
       return ; // Ignore.
     std::string lId , rId , movInstr , regName ;
@@ -897,22 +1580,35 @@ void mm_x86_64::emitCopyOps(const Taco & quad , const ActivationRecord & stack)
       if( rType.isStaticMatrix() ) fout << "\tleaq\t" ; else fout << "\tmovq\t" ;
       fout << rId << ", " << Regs[SI][QUAD] << '\n';
       
-      fout << "\tmovq\t(" << Regs[DI][QUAD] <<"), " << Regs[DX][QUAD] << '\n';
-      fout << "\tmovq\t(" << Regs[SI][QUAD] <<"), " << Regs[CX][QUAD] << '\n';
-      fout << "\tcmpq\t" << Regs[DX][QUAD] << ", " << Regs[CX][QUAD] << '\n';
-      fout << "\tje\t.LTEMP" << ++tempLabels << "\n\tcall\tabort\n.LTEMP" << tempLabels << ":\n";
+      if( not sameShape( type , rType ) ) {
+	fout << "\tmovq\t(" << Regs[DI][QUAD] <<"), " << Regs[DX][QUAD] << '\n';
+	fout << "\tmovq\t(" << Regs[SI][QUAD] <<"), " << Regs[CX][QUAD] << '\n';
+	fout << "\tcmpq\t" << Regs[DX][QUAD] << ", " << Regs[CX][QUAD] << '\n';
+	fout << "\tje\t.LTEMP" << ++tempLabels << "\n\tcall\tabort\n.LTEMP" << tempLabels << ":\n";
+      }
       
-      fout << "\tmovl\t(" << Regs[DI][QUAD] <<"), " << Regs[DX][LONG] << '\n';
-      fout << "\timull\t4(" << Regs[DI][QUAD] <<"), " << Regs[DX][LONG] << '\n';
-      fout << "\tincl\t" << Regs[DX][LONG] << '\n';
-      fout << "\timull\t$8, " << Regs[DX][LONG] << '\n';
-      fout << "\tmovslq\t" << Regs[DX][LONG] << ", " << Regs[DX][QUAD] << '\n';
-      fout << "\tcall\tmemcpy\n" ;
+      if( type.isStaticMatrix() and rType.isStaticMatrix() ) { // elements follow the headers
+	fout << "\tleaq\t" << MATRIX_HEADER << "(" << Regs[DI][QUAD] << "), " << Regs[DI][QUAD] << '\n';
+	fout << "\tleaq\t" << MATRIX_HEADER << "(" << Regs[SI][QUAD] << "), " << Regs[SI][QUAD] << '\n';
+	fout << "\tmovq\t$" << type.rows * type.cols * SIZE_OF_DOUBLE << ", " << Regs[DX][QUAD] << '\n';
+	fout << "\tcall\tmemcpy\n" ;
+      } else if( type.isStaticMatrix() ) {
+	fout << "\tcall\tmm_copy\n" ;
+      } else if( stack.frameMap.find( quad.x ) != stack.frameMap.end() ) {
+	/* A matrix of the caller of a loop body lends it no elements , as the
+	   iterations would all race to copy them back when it is next written. */
+	fout << "\tcall\tmm_assign_copy\n" ;
+      } else if( quad.opCode == OP_MOVE and not rType.isStaticMatrix() ) { // takes them over when it can
+	fout << "\tcall\tmm_move\n" ;
+	fout << "\tmovq\t" << Regs[ACC][QUAD] << ", " << rId << '\n';
+      } else { // shares the elements when it can
+	fout << "\tcall\tmm_assign\n" ;
+      }
       
       return ;
     }
-    fout << '\t' << movInstr << '\t' << rId << ", " << regName << '\n';
-    fout << '\t' << movInstr << '\t' << regName << ", " << lId << '\n';
+    fout << moveCode( movInstr , rId , regName );
+    fout << moveCode( movInstr , regName , lId );
   } break;
     
   case OP_R_DEREF : {
@@ -928,7 +1624,7 @@ void mm_x86_64::emitCopyOps(const Taco & quad , const ActivationRecord & stack)
     else if( type.isPointer() ) movInstr = "movq" , regName = Regs[ACC][QUAD] ;
     fout << "\tmovq\t" << rId << ", " << Regs[PTR][QUAD] << '\n';
     fout << '\t' << movInstr << "\t(" << Regs[PTR][QUAD] << "), " << regName << '\n';
-    fout << '\t' << movInstr << '\t' << regName << ", " << lId << '\n';
+    fout << moveCode( movInstr , regName , lId );
   } break;
     
   case OP_L_DEREF : {
@@ -943,7 +1639,7 @@ void mm_x86_64::emitCopyOps(const Taco & quad , const ActivationRecord & stack)
     else if( type == MM_DOUBLE_TYPE ) movInstr = "movsd" , regName = XReg+"0" ;
     else if( type.isPointer() ) movInstr = "movq" , regName = Regs[ACC][QUAD] ;
     fout << "\tmovq\t" << lId << ", " << Regs[PTR][QUAD] << '\n';
-    fout << '\t' << movInstr << '\t' << rId << ", " << regName << '\n';
+    fout << moveCode( movInstr , rId , regName );
     fout << '\t' << movInstr << '\t' << regName << ", (" << Regs[PTR][QUAD] << ")\n";
   } break;
     
@@ -959,15 +1655,22 @@ void mm_x86_64::emitCopyOps(const Taco & quad , const ActivationRecord & stack)
 
   case OP_LXC : {
     DataType matType;
-    std::string zId , xId , yId , movInstr , dataReg ;
+    std::string zId , xId , yId , movInstr , dataReg , disp ;
 
     std::tie( zId , matType ) = getLocation( quad.z , stack );
+    if( isElementOffset( quad.x ) ) // between any two quads , so saving every register
+      emitUnshare( quad.z , "mm_unshare_regs" , stack );
 
     /* Get base address. */
     if( matType.isStaticMatrix() )
       fout << "\tleaq\t" << zId << ", " << Regs[PTR][QUAD] << '\n';
-    else
+    else {
       fout << "\tmovq\t" << zId << ", " << Regs[PTR][QUAD] << '\n';
+      if( isElementOffset( quad.x ) ) { // offsets count the header
+	fout << "\tmovq\t" << MATRIX_DATA << "(" << Regs[PTR][QUAD] << "), " << Regs[PTR][QUAD] << '\n';
+	disp = "-" + std::to_string( MATRIX_HEADER );
+      }
+    }
     
     /* Get index. */
     try {
@@ -989,24 +1692,29 @@ void mm_x86_64::emitCopyOps(const Taco & quad , const ActivationRecord & stack)
     } else {
       dataReg = XReg+"0"; movInstr = "movsd";
     }
-    fout << '\t' << movInstr << '\t' << yId << ", " << dataReg << '\n';
+    fout << moveCode( movInstr , yId , dataReg );
 
     /* Copy into memory. */
-    fout << '\t' << movInstr << '\t' << dataReg << ", (" << Regs[PTR][QUAD] << ',' << Regs[ACC][QUAD] << ")\n";
+    fout << '\t' << movInstr << '\t' << dataReg << ", " << disp << "(" << Regs[PTR][QUAD] << ',' << Regs[ACC][QUAD] << ")\n";
     
   } break;
     
   case OP_RXC : {
     DataType retType , matType ;
-    std::string zId , xId , yId , movInstr , dataReg ;
+    std::string zId , xId , yId , movInstr , dataReg , disp ;
 
     std::tie( xId , matType ) = getLocation( quad.x , stack );
 
     /* Get base address. */
     if( matType.isStaticMatrix() )
       fout << "\tleaq\t" << xId << ", " << Regs[PTR][QUAD] << '\n';
-    else
+    else {
       fout << "\tmovq\t" << xId << ", " << Regs[PTR][QUAD] << '\n';
+      if( isElementOffset( quad.y ) ) { // offsets count the header
+	fout << "\tmovq\t" << MATRIX_DATA << "(" << Regs[PTR][QUAD] << "), " << Regs[PTR][QUAD] << '\n';
+	disp = "-" + std::to_string( MATRIX_HEADER );
+      }
+    }
     
     /* Get index. */
     try {
@@ -1024,11 +1732,11 @@ void mm_x86_64::emitCopyOps(const Taco & quad , const ActivationRecord & stack)
     std::tie( zId , retType ) = getLocation( quad.z , stack );
     if( retType == MM_DOUBLE_TYPE ) {
       dataReg = XReg+"0";
-      fout << "\tmovsd\t(" << Regs[PTR][QUAD] << ',' << Regs[ACC][QUAD] << "), " << dataReg << '\n';
-      fout << "\tmovsd\t" << dataReg << ", " << zId << '\n';
+      fout << "\tmovsd\t" << disp << "(" << Regs[PTR][QUAD] << ',' << Regs[ACC][QUAD] << "), " << dataReg << '\n';
+      fout << moveCode( "movsd" , dataReg , zId );
     } else if( retType == MM_INT_TYPE ) {
       dataReg = Regs[CX][LONG];
-      fout << "\tmovl\t(" << Regs[PTR][QUAD] << ',' << Regs[ACC][QUAD] << "), " << dataReg << '\n';
+      fout << "\tmovl\t" << disp << "(" << Regs[PTR][QUAD] << ',' << Regs[ACC][QUAD] << "), " << dataReg << '\n';
       fout << "\tmovl\t" << dataReg << ", " << zId << '\n';
     }
     
@@ -1044,7 +1752,7 @@ void mm_x86_64::emitJumpOps(const Taco & quad , const ActivationRecord & stack)
     /* Conditional jumps */
   case OP_LT : case OP_LTE : case OP_GT : case OP_GTE : case OP_EQ : case OP_NEQ : {
     std::string regName , lId , rId, movInstr, cmpInstr;
-    const size_t ACC = 1;
+    const size_t ACC = 0;
     DataType type;
     std::tie( lId , type ) = getLocation( quad.x , stack );
     std::tie( rId , std::ignore ) = getLocation( quad.y , stack );
@@ -1057,7 +1765,7 @@ void mm_x86_64::emitJumpOps(const Taco & quad , const ActivationRecord & stack)
     else if( type.isPointer() )
       movInstr = "movq" , cmpInstr = "cmpq" , regName = Regs[ACC][QUAD] ;
     // Move first operand to register
-    fout << '\t' << movInstr << '\t' << lId << " , " << regName << '\n';
+    fout << moveCode( movInstr , lId , regName );
     // Compare operands
     fout << '\t' << cmpInstr << '\t' << rId << " , " << regName << "\n\t";
     switch( quad.opCode ) {
@@ -1077,8 +1785,43 @@ void mm_x86_64::emitJumpOps(const Taco & quad , const ActivationRecord & stack)
   }
 }
 
-ActivationRecord::ActivationRecord(mm_translator& mic,unsigned int rootId){
+/* parFor(body , frame , lo , hi) from the standard library runs body(frame , from , to)
+   over chunks of [lo,hi) on its worker pool. The variables of this function the
+   body uses are on the stack : it finds them at the same offsets from the frame. */
+void mm_x86_64::emitParallelLoop(const Taco & quad , const ActivationRecord & stack) {
+  std::vector<Record> & frame = frames[quad.z];
+  for( const std::string & id : mic.captures[quad.z] ) {
+    auto ref = stack.locMap.find( id );
+    if( ref == stack.locMap.end() ) throw 1; // not on the stack
+    frame.push_back( stack.acR[ref->second] );
+  }
+  /* Matrices whose elements the iterations write , or may write through the
+     functions they pass them to , get elements of their own beforehand
+     rather than in every iteration at once. */
+  const std::vector<Taco> & QA = mic.quadArray;
+  auto body = std::find_if( QA.begin() , QA.end() , [&](const Taco & q) {
+      return q.opCode == OP_FUNC_START and q.z == quad.z;
+    } );
+  std::set<std::string> written;
+  for( ; body != QA.end() and body->opCode != OP_FUNC_END ; ++body )
+    if( ( body->opCode == OP_LXC or body->opCode == OP_PARAM ) and mic.captures[quad.z].count( body->z ) )
+      written.insert( body->z );
+  for( const std::string & id : written ) emitUnshare( id , "mm_unshare" , stack );
+  std::string lo , hi ; DataType type ;
+  std::tie( lo , type ) = getLocation( quad.x , stack );
+  std::tie( hi , type ) = getLocation( quad.y , stack );
+  fout << "\tmovl\t" << lo << ", %edx\n"
+       << "\tmovl\t" << hi << ", %ecx\n"
+       << "\tleaq\t" << quad.z << "(%rip), %rdi\n"
+       << "\tmovq\t%rbp, %rsi\n"
+       << "\tcall\tparFor\n";
+}
+
+ActivationRecord::ActivationRecord(mm_translator& mic,unsigned int rootId,unsigned int from,unsigned int to){
+  outlined = mic.tables[rootId].parent != 0; // linked to the function enclosing the loop
   dft(mic,rootId);
+  allocateRegisters(mic,from,to);
+  if( outlined ) savedRegs.emplace( savedRegs.begin() , 1 , 0 ); // %rbx
   
   // Populate stack
   std::vector< Record > callerStack , calleeStack;
@@ -1129,6 +1872,13 @@ ActivationRecord::ActivationRecord(mm_translator& mic,unsigned int rootId){
     }
   }
 
+  // Save area of callee-saved registers
+  for(auto & save : savedRegs) {
+    calleeOffset &= -8;
+    calleeOffset -= 8;
+    save.second = calleeOffset;
+  }
+
   std::reverse( callerStack.begin() , callerStack.end() ) ;
   acR.clear() ; std::swap( acR , callerStack );
   acR.insert( acR.end() , calleeStack.begin() , calleeStack.end());
@@ -1144,6 +1894,11 @@ ActivationRecord::ActivationRecord(mm_translator& mic,unsigned int rootId){
     Symbol & constant = toC[index];
     constMap[constant.id] = index;
   }
+
+  for(unsigned int index = 0; index < regR.size() ; index++ ) {
+    Record & record = regR[index];
+    regMap[record.first.id] = index;
+  }
   
   params.clear();
   vars.clear();
@@ -1178,7 +1933,9 @@ int main( int argc , char * argv[] ){
   using namespace yy ;
   
   bool trace_scan = false , trace_parse = false
-    , trace_tacos = false , emit_mic = false;
+    , trace_tacos = false , emit_mic = false , optimize = false;
+  unsigned int simd_width = 2; // SSE2 is part of the x86-64 baseline
+  unsigned int unroll_limit = 64; // elements , up to 8 x 8 matrices
   
   for(int i=1;i<argc;i++){
     string cmd = string(argv[i]);
@@ -1190,6 +1947,16 @@ int main( int argc , char * argv[] ){
       trace_tacos = true;
     } else if(cmd == "--emit-mic") {
       emit_mic = true;
+    } else if(cmd == "-O") {
+      optimize = true;
+    } else if(cmd.compare(0,13,"--simd-width=") == 0) {
+      simd_width = atoi(cmd.c_str() + 13);
+      if( simd_width != 1 and simd_width != 2 and simd_width != 4 ) {
+	cerr << "Error : --simd-width must be 1, 2 or 4" << endl;
+	return 1;
+      }
+    } else if(cmd.compare(0,15,"--unroll-limit=") == 0) {
+      unroll_limit = atoi(cmd.c_str() + 15);
     } else {
       int result;
       try {
@@ -1204,11 +1971,20 @@ int main( int argc , char * argv[] ){
 	  cerr << cmd << " : Translation failed" << endl;
 	  return 1;
 	}
+
+	if( optimize ) {
+	  mm_optimizer optimizer(translator);
+	  optimizer.optimize();
+	}
 	
 	if( emit_mic ) { /* Generate machine-independant code */
 	  translator.emit_MIC();
 	} else { /* Generate target code */
-	  mm_x86_64 generator(translator);
+	  mm_fusion fusion(translator);
+	  fusion.fuseElementwiseChains();
+	  mm_vectorizer vectorizer(translator);
+	  if( simd_width > 1 ) vectorizer.vectorizeElementLoops();
+	  mm_x86_64 generator(translator,fusion,vectorizer,simd_width,unroll_limit);
 	  generator.generateTargetCode();
 	}
 
@@ -1,4 +1,6 @@
 #include "translator.hh"
+#include "fusion.hh"
+#include "vectorizer.hh"
 
 /* A map from string identifiers to locations on tables. */
 typedef __gnu_pbds::trie<std::string, unsigned int ,
@@ -12,17 +14,28 @@ typedef std::pair< Symbol , int > Record;
 /* An activation record corresponding to a function instantiation. */
 class ActivationRecord {
   void dft(mm_translator&,unsigned int);
+  void allocateRegisters(mm_translator&,unsigned int,unsigned int);
 public:
 
-  /* Constructor. */
-  ActivationRecord(mm_translator&,unsigned int);
+  /* Constructor , for the function whose quads lie in [from,to]. */
+  ActivationRecord(mm_translator&,unsigned int,unsigned int,unsigned int);
   virtual ~ActivationRecord();
   
   /* Getting position of a symbol in the record. */
-  LocMap locMap , constMap;
+  LocMap locMap , constMap , regMap;
+
+  /* Wether the function is the outlined body of a parallel loop , and the
+     variables of its caller it uses , located relative to %rbx. */
+  bool outlined;
+  LocMap frameMap;
+  std::vector< Record > frame;
   
   // Elements of the record.
   std::vector< Record > acR;
+  // Variables kept in registers , with the register number (index in Regs , or n of %xmm<n>).
+  std::vector< Record > regR;
+  // Callee-saved registers used by the function , with their save slots.
+  std::vector< std::pair< size_t , int > > savedRegs;
   // Function variables.
   std::vector< Symbol > vars;
   // Function parameters.
@@ -59,7 +72,7 @@ public:
     { "%r15" , "%r15d" , "%r15b" }
   } , XReg = "%xmm" ;
   
-  mm_x86_64(mm_translator&);
+  mm_x86_64(mm_translator&,const mm_fusion&,const mm_vectorizer&,unsigned int,unsigned int);
   virtual ~mm_x86_64();
   
   /* Reference to machine independant code and data. */
@@ -68,6 +81,18 @@ public:
   /* Output stream to write generated .s file. */
   std::ostream & fout;
 
+  /* Element-wise chains to be emitted as single loops. */
+  const mm_fusion & fusion;
+
+  /* Element loops to be run ahead by packed loops. */
+  const mm_vectorizer & vectorizer;
+
+  /* Doubles per packed instruction in element-wise loops : 1 (scalar) , 2 (SSE2) or 4 (AVX). */
+  unsigned int simdWidth;
+
+  /* Elements of the largest static matrix operated on by straight-line code. */
+  unsigned int unrollLimit;
+
   /* Output the entire target code. */
   void generateTargetCode();
 
@@ -77,6 +102,9 @@ public:
   /* Gets location and type of an address in tacos.
      Any constants / string used are pushed in usedConstants / usedString containers. */
   std::tuple< std::string , DataType > getLocation(const std::string &,const ActivationRecord &);
+
+  /* Code of a scalar move between locations , which may both be registers. */
+  std::string moveCode(const std::string &,const std::string &,const std::string &);
   
   /* Emit target code corresponding to a jump instruction quad. */
   void emitJumpOps(const Taco &,const ActivationRecord &);
@@ -92,6 +120,29 @@ public:
   void emitUnaryMinusOps(const Taco &,const ActivationRecord &);
   void emitMultDivOps(const Taco &,const ActivationRecord &);
 
+  /* Emit an operation on small static matrices without loops or calls , if possible. */
+  bool emitUnrolledOps(const Taco &,const ActivationRecord &);
+
+  /* Emit the check that a dynamic matrix about to be written has elements of
+     its own , calling the given runtime routine with it in %rdi if not. */
+  void emitUnshare(const std::string &,const std::string &,const ActivationRecord &);
+
+  /* Emit the loop of an element-wise matrix operation. */
+  void emitElementwiseLoop(OpCode,const std::string &);
+
+  /* Emit the loop over rows around an element-wise loop , given the registers
+     holding the matrices , the destination first. Each pass leaves the address
+     of a row in each register and the elements in a row at 16(%rsp). Returns
+     the labels of the rows loop and of its exit , for emitRowsEnd. */
+  std::pair<unsigned int,unsigned int> emitRowsBegin(const std::vector<size_t> &);
+  void emitRowsEnd(const std::pair<unsigned int,unsigned int> &,const std::vector<size_t> &);
+
+  /* Emit a fused chain of element-wise matrix operations. */
+  void emitFusedLoop(const FusedLoop &,const ActivationRecord &);
+
+  /* Emit the packed loop of a vectorized element loop. */
+  void emitVectorLoop(const VectorLoop &,const ActivationRecord &);
+
   /* Emit conversion operations. */
   void emitConversionOps(const Taco &,const ActivationRecord &);
   
@@ -102,6 +153,12 @@ public:
   /* Emit opcodes to transpose a matrix. */
   void emitTransposeOps(const Taco &,const ActivationRecord &);
 
+  /* Emit the call running an outlined loop body on the worker pool. */
+  void emitParallelLoop(const Taco &,const ActivationRecord &);
+
+  /* Caller's variables used by every outlined loop body , with their offsets. */
+  std::map< std::string , std::vector< Record > > frames;
+
   /* Auxiliary data */
   std::vector< std::pair<int,int> > usedConstants; // constant ids actually used
   std::vector< int > usedStrings; // string ids actually used